@@ -0,0 +1,62 @@
+/*----------------------------------------------------------------------------*/
+/* alloc.c                                                                    */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "alloc.h"
+
+static void *default_alloc(size_t size, void *ctx)
+{
+    (void)ctx;
+    return malloc(size);
+}
+
+static void default_free(void *ptr, void *ctx)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+LsAllocator ls_allocator_or_default(const LsAllocator *allocator)
+{
+    LsAllocator std = {default_alloc, default_free, NULL};
+
+    if (allocator == NULL)
+        return std;
+
+    return *allocator;
+}
+
+void *ls_alloc(const LsAllocator *allocator, size_t size)
+{
+    assert(allocator != NULL);
+
+    /* Some allocators return NULL for zero bytes */
+    if (size == 0)
+        size = 1;
+
+    return allocator->alloc(size, allocator->ctx);
+}
+
+void *ls_calloc(const LsAllocator *allocator, size_t size)
+{
+    void *ptr;
+
+    ptr = ls_alloc(allocator, size);
+    if (ptr != NULL)
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void ls_free(const LsAllocator *allocator, void *ptr)
+{
+    assert(allocator != NULL);
+
+    if (ptr != NULL)
+        allocator->free(ptr, allocator->ctx);
+}
@@ -0,0 +1,26 @@
+/*----------------------------------------------------------------------------*/
+/* alloc.h                                                                    */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef ALLOC_INCLUDED
+#define ALLOC_INCLUDED
+
+#include <stddef.h>
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. Allocation through a caller's LsAllocator. */
+
+/* Returns allocator, or an allocator using malloc and free if it is NULL */
+LsAllocator ls_allocator_or_default(const LsAllocator *allocator);
+
+/* Allocates size bytes from allocator. Returns NULL on failure. */
+void *ls_alloc(const LsAllocator *allocator, size_t size);
+
+/* Allocates size zeroed bytes from allocator. Returns NULL on failure. */
+void *ls_calloc(const LsAllocator *allocator, size_t size);
+
+/* Returns ptr to allocator. Accepts NULL. */
+void ls_free(const LsAllocator *allocator, void *ptr);
+
+#endif
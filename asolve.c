@@ -5,9 +5,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 
+#include <gsl/gsl_errno.h>
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_blas.h>
@@ -15,6 +19,45 @@
 #include <gsl/gsl_linalg.h>
 
 #include "asolve.h"
+#include "msolve.h"
+#include "ring.h"
+#include "mapsolve.h"
+#include "plan.h"
+#include "alloc.h"
+
+/* Scratch space for solving systems of one size. Every matrix and vector is a
+ * view into a single block from the caller's allocator, which also holds this
+ * struct, so solves with the same Scratch never allocate. GSL's eigensolver
+ * workspace and LU permutation come from GSL's own allocators, which use
+ * malloc, when the Scratch is allocated. */
+struct scratch
+{
+    int num_beads; /* Size of the systems this scratch can solve */
+    gsl_matrix_view mass_matrix;
+    gsl_matrix_view k_matrix;
+    gsl_matrix_view invsqrtm;
+    gsl_matrix_view tempm;
+    gsl_matrix_view d_matrix;
+    gsl_matrix_view evec;
+    gsl_matrix_view eigv; /* LU decomposition of the eigenvectors */
+    gsl_vector_view eval;
+    gsl_vector_view ix, iv, a, b; /* Initial conditions and coefficients */
+    double *sines; /* Table of 2 (num_beads + 1) sines for uniform chains,
+                      then the data of their sine transforms */
+    gsl_eigen_symmv_workspace *w;
+    gsl_permutation *p;
+    gsl_fft_real_wavetable *wavetable; /* For the sine transforms */
+    gsl_fft_real_workspace *fft_work;
+};
+
+static pthread_once_t gsl_handler_once = PTHREAD_ONCE_INIT;
+
+/* GSL's default error handler aborts the process. Errors are reported
+ * through return values instead. */
+static void turn_off_gsl_handler(void)
+{
+    gsl_set_error_handler_off();
+}
 
 /* Prints gsl_matrix m. Used for debugging. */
 #ifndef NDEBUG
@@ -24,7 +67,7 @@ static void print_matrix(const gsl_matrix *m)
     int rows, cols;
 
     assert(m != NULL);
-    
+
     rows = m->size1;
     cols = m->size2;
 
@@ -39,40 +82,166 @@ static void print_matrix(const gsl_matrix *m)
 }
 #endif
 
-/* Creates and returns a diagonal square matrix of size num_beads x num_beads.
- * Diagonal entries correspond to masses of beads. Caller responsible for
- * freeing matrix. */
-static gsl_matrix *create_mass_matrix(const Bead *beads, int num_beads)
+size_t scratch_size(int num_beads)
+{
+    size_t n = num_beads;
+
+    /* The struct, then 7 matrices, 5 vectors and the sine table */
+    return sizeof(Scratch) + (7 * n * n + 7 * n + 2) * sizeof(double);
+}
+
+Scratch *alloc_scratch(int num_beads, const LsAllocator *allocator)
+{
+    size_t n = num_beads;
+    size_t nn = n * n;
+    Scratch *s;
+    double *pos;
+
+    assert(num_beads > 0);
+    assert(allocator != NULL);
+
+    s = ls_alloc(allocator, scratch_size(num_beads));
+    if (s == NULL)
+        return NULL;
+
+    s->num_beads = num_beads;
+    pos = (double *)(s + 1);
+    s->mass_matrix = gsl_matrix_view_array(pos, n, n);
+    pos += nn;
+    s->k_matrix = gsl_matrix_view_array(pos, n, n);
+    pos += nn;
+    s->invsqrtm = gsl_matrix_view_array(pos, n, n);
+    pos += nn;
+    s->tempm = gsl_matrix_view_array(pos, n, n);
+    pos += nn;
+    s->d_matrix = gsl_matrix_view_array(pos, n, n);
+    pos += nn;
+    s->evec = gsl_matrix_view_array(pos, n, n);
+    pos += nn;
+    s->eigv = gsl_matrix_view_array(pos, n, n);
+    pos += nn;
+    s->eval = gsl_vector_view_array(pos, n);
+    pos += n;
+    s->ix = gsl_vector_view_array(pos, n);
+    pos += n;
+    s->iv = gsl_vector_view_array(pos, n);
+    pos += n;
+    s->a = gsl_vector_view_array(pos, n);
+    pos += n;
+    s->b = gsl_vector_view_array(pos, n);
+    pos += n;
+    s->sines = pos;
+
+    /* A failed GSL allocation would otherwise abort */
+    pthread_once(&gsl_handler_once, turn_off_gsl_handler);
+    s->w = gsl_eigen_symmv_alloc(n);
+    s->p = gsl_permutation_alloc(n);
+    s->wavetable = gsl_fft_real_wavetable_alloc(2 * (n + 1));
+    s->fft_work = gsl_fft_real_workspace_alloc(2 * (n + 1));
+    if (s->w == NULL || s->p == NULL || s->wavetable == NULL
+            || s->fft_work == NULL)
+    {
+        free_scratch(s, allocator);
+        return NULL;
+    }
+
+    return s;
+}
+
+void free_scratch(Scratch *scratch, const LsAllocator *allocator)
+{
+    if (scratch == NULL)
+        return;
+    if (scratch->w != NULL)
+        gsl_eigen_symmv_free(scratch->w);
+    if (scratch->p != NULL)
+        gsl_permutation_free(scratch->p);
+    if (scratch->wavetable != NULL)
+        gsl_fft_real_wavetable_free(scratch->wavetable);
+    if (scratch->fft_work != NULL)
+        gsl_fft_real_workspace_free(scratch->fft_work);
+    ls_free(allocator, scratch);
+}
+
+size_t result_size(int num_beads, int num_modes)
+{
+    size_t n = num_beads;
+    size_t k = num_modes;
+
+    return n * sizeof(double *) + (k + n * k) * sizeof(double)
+        + k * sizeof(Coefficient);
+}
+
+void layout_result(void *arena, int num_beads, int num_modes, Result *result)
+{
+    char *pos = arena;
+    double *vectors;
+    int i;
+
+    assert(arena != NULL);
+    assert(result != NULL);
+
+    /* Row pointers come first so that the arena is result->eigenvectors */
+    result->num_beads = num_beads;
+    result->num_modes = num_modes;
+    result->eigenvectors = (double **)pos;
+    pos += num_beads * sizeof(double *);
+    result->eigenfrequencies = (double *)pos;
+    pos += num_modes * sizeof(double);
+    vectors = (double *)pos;
+    pos += (size_t)num_beads * num_modes * sizeof(double);
+    result->coefficients = (Coefficient *)pos;
+    result->sine_modes = false;
+    result->tile_rows = 0;
+    result->lazy = NULL;
+
+    for (i = 0; i < num_beads; i++)
+        result->eigenvectors[i] = vectors + (size_t)i * num_modes;
+}
+
+void layout_frequencies(void *arena, int num_beads, Result *result)
+{
+    assert(arena != NULL);
+    assert(result != NULL);
+
+    result->num_beads = num_beads;
+    result->num_modes = num_beads;
+    result->eigenfrequencies = arena;
+    result->eigenvectors = NULL;
+    result->coefficients = NULL;
+    result->sine_modes = false;
+    result->tile_rows = 0;
+    result->lazy = NULL;
+}
+
+/* Fills m, a square matrix of size num_beads x num_beads, with a diagonal
+ * matrix. Diagonal entries correspond to masses of beads. */
+static void create_mass_matrix(const Bead *beads, int num_beads,
+        gsl_matrix *m)
 {
     int i;
-    gsl_matrix *m;
 
     assert(beads != NULL);
     assert(num_beads > 0);
-    
-    m = gsl_matrix_calloc(num_beads, num_beads);
-    /* Skipping error checking */
+    assert(m != NULL);
 
+    gsl_matrix_set_zero(m);
     for (i = 0; i < num_beads; i++)
         gsl_matrix_set(m, i, i, beads[i].mass);
-
-    return m;
 }
 
-/* Creates and returns a tridiagonal square matrix of size num_beads x
- * num_beads. Entries correspond to the spring constants that connect beads.
- * Caller responsible for freeing matrix. */
-static gsl_matrix *create_spring_k_matrix(const double *connections,
-        int num_beads)
+/* Fills m, a square matrix of size num_beads x num_beads, with a tridiagonal
+ * matrix. Entries correspond to the spring constants that connect beads. */
+static void create_spring_k_matrix(const double *connections, int num_beads,
+        gsl_matrix *m)
 {
     int i, j;
-    gsl_matrix *m;
 
     assert(connections != NULL);
     assert(num_beads > 0);
+    assert(m != NULL);
 
-    m = gsl_matrix_calloc(num_beads, num_beads);
-    /* Skipping error checking */
+    gsl_matrix_set_zero(m);
 
     /* i is row number, j is col number */
     for (i = 0; i < num_beads; i++)
@@ -81,30 +250,27 @@ static gsl_matrix *create_spring_k_matrix(const double *connections,
         {
             if (i == j)
                 gsl_matrix_set(m, i, j, connections[i] + connections[i + 1]);
-            if (i == j - 1) 
+            if (i == j - 1)
                 gsl_matrix_set(m, i, j, -1 * connections[i + 1]);
             if (i == j + 1)
                 gsl_matrix_set(m, i, j, -1 * connections[i]);
         }
     }
-
-    return m;
 }
 
-/* Creates and returns a tridiagonal square matrix of size num_beads x
- * num_beads. Entries correspond to the string tensions and lengths that
- * connect beads. Caller responsible for freeing matrix. */
-static gsl_matrix *create_string_k_matrix(const double *connections,
-        double tension, int num_beads)
+/* Fills m, a square matrix of size num_beads x num_beads, with a tridiagonal
+ * matrix. Entries correspond to the string tensions and lengths that connect
+ * beads. */
+static void create_string_k_matrix(const double *connections, double tension,
+        int num_beads, gsl_matrix *m)
 {
     int i, j;
-    gsl_matrix *m;
 
     assert(connections != NULL);
     assert(num_beads > 0);
+    assert(m != NULL);
 
-    m = gsl_matrix_calloc(num_beads, num_beads);
-    /* Skipping error checking */
+    gsl_matrix_set_zero(m);
 
     for (i = 0; i < num_beads; i++)
     {
@@ -113,231 +279,529 @@ static gsl_matrix *create_string_k_matrix(const double *connections,
             if (i == j)
                 gsl_matrix_set(m, i, j, tension * (1 / connections[i] +
                             1 / connections[i + 1]));
-            if (i == j - 1) 
+            if (i == j - 1)
                 gsl_matrix_set(m, i, j, -1 * tension * (1 / connections[i + 1]));
             if (i == j + 1)
                 gsl_matrix_set(m, i, j, -1 * tension * (1 / connections[i]));
         }
     }
+}
+
+double spring_constant(const Simulation *sim, double connection)
+{
+    if (sim->sim_type == SPRING)
+        return connection;
 
-    return m;
+    return sim->tension / connection;
 }
 
-/* Creates and returns the inverse square root of mass_matrix. Caller
- * responsible for freeing matrix. */
-static gsl_matrix *create_invsqrt_mass_matrix(const gsl_matrix *mass_matrix)
+/* Adds connection 0 of sim, a ring, between its last and first beads to the
+ * stiffness matrix m. The diagonal already counts it, since
+ * connections[num_beads] mirrors connections[0]. */
+static void close_ring(const Simulation *sim, gsl_matrix *m)
 {
-    gsl_matrix *invsqrtm;
-    int i, j;
+    int last = sim->num_beads - 1;
+    double k = spring_constant(sim, sim->connections[0]);
+
+    /* Entries add, so a ring of two beads is joined twice */
+    gsl_matrix_set(m, 0, last, gsl_matrix_get(m, 0, last) - k);
+    gsl_matrix_set(m, last, 0, gsl_matrix_get(m, last, 0) - k);
+}
+
+/* Fills invsqrtm with the inverse square root of mass_matrix */
+static void create_invsqrt_mass_matrix(const gsl_matrix *mass_matrix,
+        gsl_matrix *invsqrtm)
+{
+    size_t i, j;
 
     assert(mass_matrix != NULL);
+    assert(invsqrtm != NULL);
 
-    invsqrtm = gsl_matrix_alloc(mass_matrix->size1, mass_matrix->size2);
     gsl_matrix_memcpy(invsqrtm, mass_matrix);
     for (i = 0; i < invsqrtm->size1; i++)
         for (j = 0; j < invsqrtm->size2; j++)
             if (i == j)
                 gsl_matrix_set(invsqrtm, i, j,
                         pow(gsl_matrix_get(invsqrtm, i, j), -0.5));
-
-    return invsqrtm;
 }
 
-/* Creates and returns the dynamical D matrix given by
- * (mass_matrix)^-1/2(k_matrix)(mass_matrix)^-1/2. Caller responsible for
- * freeing matrix. */
-static gsl_matrix *create_d_matrix(const gsl_matrix *mass_matrix,
-        const gsl_matrix *k_matrix)
+/* Fills the dynamical D matrix of s, given by
+ * (mass_matrix)^-1/2(k_matrix)(mass_matrix)^-1/2. Also fills invsqrtm. */
+static void create_d_matrix(Scratch *s)
 {
-    gsl_matrix *d_matrix, *invsqrtm, *tempm;
-
-    assert(mass_matrix != NULL);
-    assert(k_matrix != NULL);
+    gsl_matrix *mass_matrix = &s->mass_matrix.matrix;
+    gsl_matrix *k_matrix = &s->k_matrix.matrix;
 
     /* Both matrices must be square and the same size */
     assert(mass_matrix->size1 == mass_matrix->size2);
     assert(k_matrix->size1 == k_matrix->size2);
     assert(mass_matrix->size1 == k_matrix->size1);
 
-    tempm = gsl_matrix_alloc(mass_matrix->size1, mass_matrix->size2);
-    d_matrix = gsl_matrix_alloc(mass_matrix->size1, mass_matrix->size2);
-    /* Skipping error checking */
-
-    invsqrtm = create_invsqrt_mass_matrix(mass_matrix);
-
-    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, k_matrix, invsqrtm, 0.0,
-            tempm);
-    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, invsqrtm, tempm, 0.0,
-            d_matrix);
-    
-    gsl_matrix_free(invsqrtm);
-    gsl_matrix_free(tempm);
+    create_invsqrt_mass_matrix(mass_matrix, &s->invsqrtm.matrix);
 
-    return d_matrix;
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, k_matrix,
+            &s->invsqrtm.matrix, 0.0, &s->tempm.matrix);
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &s->invsqrtm.matrix,
+            &s->tempm.matrix, 0.0, &s->d_matrix.matrix);
 }
 
-/* Calculates the normal modes of the system defined by mass_matrix and k_matrix
- * and saves resultant eigenfrequencies and eigenvectors in the Result it
- * returns. Caller responsible for freeing eigenfrequencies and eigenvectors. */
-static Result find_normal_modes(const gsl_matrix *mass_matrix,
-        const gsl_matrix *k_matrix)
+/* Calculates the normal modes of the system in the mass and k matrices of s
+ * and saves resultant eigenfrequencies and eigenvectors in result. Returns 1
+ * if an error occured, 0 otherwise. */
+static int find_normal_modes(Scratch *s, Result *result)
 {
-    Result result;
-    gsl_eigen_symmv_workspace *w;
-    gsl_vector *eval;
-    gsl_matrix *evec;
-    gsl_matrix *d_matrix;
-    gsl_matrix *invsqrtm;
+    gsl_matrix *evec = &s->evec.matrix;
+    gsl_matrix *invsqrtm = &s->invsqrtm.matrix;
+    double largest;
     int i, j;
 
-    assert(mass_matrix != NULL);
-    assert(k_matrix != NULL);
-
-    d_matrix = create_d_matrix(mass_matrix, k_matrix);
-
-    w = gsl_eigen_symmv_alloc(d_matrix->size1);
-    eval = gsl_vector_alloc(d_matrix->size1);
-    evec = gsl_matrix_alloc(d_matrix->size1, d_matrix->size2);
+    create_d_matrix(s);
 
     /* Destroys d_matrix */
-    gsl_eigen_symmv(d_matrix, eval, evec, w);
-    gsl_eigen_symmv_free(w);
-    gsl_eigen_symmv_sort(eval, evec, GSL_EIGEN_SORT_ABS_ASC);
+    if (gsl_eigen_symmv(&s->d_matrix.matrix, &s->eval.vector, evec, s->w))
+        return 1;
+    gsl_eigen_symmv_sort(&s->eval.vector, evec, GSL_EIGEN_SORT_ABS_ASC);
 
-    result.num_modes = d_matrix->size1;
+    /* A system that can move rigidly, like a ring, has an eigenvalue of 0
+     * that comes out within rounding of it, possibly negative */
+    largest = fabs(gsl_vector_get(&s->eval.vector, result->num_modes - 1));
+    for (i = 0; i < result->num_modes; i++)
+        if (gsl_vector_get(&s->eval.vector, i) < ZERO_EIGENVALUE_TOL * largest)
+            gsl_vector_set(&s->eval.vector, i, 0);
 
     /* Load in eigenfrequencies */
     /* Eigenfrequency = sqrt(eigenvalue) */
-    result.eigenfrequencies = malloc(result.num_modes * sizeof(double));
-    for (i = 0; i < result.num_modes; i++)
-        result.eigenfrequencies[i] = sqrt(gsl_vector_get(eval, i));
+    for (i = 0; i < result->num_modes; i++)
+        result->eigenfrequencies[i] = sqrt(gsl_vector_get(&s->eval.vector, i));
 
     /* Translate eigenvectors back to regular coordinates */
     /* Then load in the translated eigenvectors */
-    result.eigenvectors = malloc(result.num_modes * sizeof(double*));
-    invsqrtm = create_invsqrt_mass_matrix(mass_matrix);
-    for (i = 0; i < result.num_modes; i++)
+    for (i = 0; i < result->num_modes; i++)
     {
-        result.eigenvectors[i] = malloc(result.num_modes * sizeof(double));
         double mscalar = gsl_matrix_get(invsqrtm, i, i);
-        for (j = 0; j < result.num_modes; j++)
-            result.eigenvectors[i][j] = mscalar * gsl_matrix_get(evec, i, j);
+        for (j = 0; j < result->num_modes; j++)
+            result->eigenvectors[i][j] = mscalar * gsl_matrix_get(evec, i, j);
     }
 
-    /* Normalize the translated eigenvectors */
-    for (i = 0; i < result.num_modes; i++)
+    /* Normalize the translated eigenvectors, with the first of their largest
+     * entries positive */
+    for (i = 0; i < result->num_modes; i++)
     {
         double mag = 0;
-        for (j = 0; j < result.num_modes; j++)
-            mag += pow(result.eigenvectors[j][i], 2);
+        for (j = 0; j < result->num_modes; j++)
+            mag += pow(result->eigenvectors[j][i], 2);
 
-        mag = sqrt(mag);
+        mag = sqrt(mag) * largest_sign(result->eigenvectors[0] + i,
+                result->num_modes, result->num_modes);
 
-        for (j = 0; j < result.num_modes; j++)
-            result.eigenvectors[j][i] /= mag;
+        for (j = 0; j < result->num_modes; j++)
+            result->eigenvectors[j][i] /= mag;
     }
 
-    gsl_vector_free(eval);
-    gsl_matrix_free(evec);
-    gsl_matrix_free(invsqrtm);
-    gsl_matrix_free(d_matrix);
-
-    return result;
+    return 0;
 }
 
-/* Given result containing eigenfrequencies and eigenvectors, finds and returns
- * coefficients that satisfy the initial conditions given in beads. a
- * corresponds to the cosine term and b corresponds to the sine term. Caller
- * responsible for freeing coefficient array. */
-static Coefficient *apply_ics(Bead *beads, Result result)
+/* Given result containing eigenfrequencies and eigenvectors, finds the
+ * coefficients that satisfy the initial conditions given in beads and stores
+ * them in result. a corresponds to the cosine term and b corresponds to the
+ * sine term. Returns 1 if an error occured, 0 otherwise. */
+static int apply_ics(const Bead *beads, Scratch *s, Result *result)
 {
-    Coefficient *coeffs;
-    gsl_vector *ix, *iv, *a, *b;
-    gsl_matrix *eigv;
-    gsl_permutation *p;
+    gsl_matrix *eigv = &s->eigv.matrix;
     int i, j;
 
     assert(beads != NULL);
-    assert(result.eigenfrequencies != NULL);
-    assert(result.eigenvectors != NULL);
-
-    coeffs = malloc(result.num_modes * sizeof(Coefficient));
-    /* Skipping error checking */
-
-    a = gsl_vector_alloc(result.num_modes);
-    b = gsl_vector_alloc(result.num_modes);
+    assert(result->eigenfrequencies != NULL);
+    assert(result->eigenvectors != NULL);
 
-    ix = gsl_vector_alloc(result.num_modes);
-    iv = gsl_vector_alloc(result.num_modes);
-    for (i = 0; i < result.num_modes; i++)
+    for (i = 0; i < result->num_modes; i++)
     {
-        gsl_vector_set(ix, i, beads[i].x0);
-        gsl_vector_set(iv, i, beads[i].v0);
+        gsl_vector_set(&s->ix.vector, i, beads[i].x0);
+        gsl_vector_set(&s->iv.vector, i, beads[i].v0);
     }
 
-    eigv = gsl_matrix_alloc(result.num_modes, result.num_modes);
-    for (i = 0; i < result.num_modes; i++)
-        for (j = 0; j < result.num_modes; j++)
-            gsl_matrix_set(eigv, i, j, result.eigenvectors[i][j]);
+    for (i = 0; i < result->num_modes; i++)
+        for (j = 0; j < result->num_modes; j++)
+            gsl_matrix_set(eigv, i, j, result->eigenvectors[i][j]);
 
     /* Initial positions calculation */
     /* Solved using LU decomposition */
-    p = gsl_permutation_alloc(result.num_modes);
-    gsl_linalg_LU_decomp (eigv, p, &i);
-    gsl_linalg_LU_solve (eigv, p, ix, a);
-    
+    if (gsl_linalg_LU_decomp(eigv, s->p, &i)
+            || gsl_linalg_LU_solve(eigv, s->p, &s->ix.vector, &s->a.vector))
+        return 1;
+
     /* Initial velocities calculation */
-    gsl_linalg_LU_solve (eigv, p, iv, b);
+    if (gsl_linalg_LU_solve(eigv, s->p, &s->iv.vector, &s->b.vector))
+        return 1;
 
     /* Load results into coefficients array */
-    for (i = 0; i < result.num_modes; i++)
+    for (i = 0; i < result->num_modes; i++)
+    {
+        result->coefficients[i].a = gsl_vector_get(&s->a.vector, i);
+        /* For velocity terms, we divide by the eigenfrequency since we took a
+         * derivative. A mode of zero frequency keeps its velocity. */
+        result->coefficients[i].b = gsl_vector_get(&s->b.vector, i);
+        if (result->eigenfrequencies[i] > 0)
+            result->coefficients[i].b /= result->eigenfrequencies[i];
+    }
+
+    return 0;
+}
+
+int largest_sign(const double *v, int n, size_t stride)
+{
+    double largest = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        largest = fmax(largest, fabs(v[i * stride]));
+
+    for (i = 0; i < n; i++)
+        if (fabs(v[i * stride]) >= (1 - SIGN_TOL) * largest)
+            return v[i * stride] < 0 ? -1 : 1;
+
+    return 1;
+}
+
+void fix_sign(Result *result, int j)
+{
+    int i;
+
+    assert(result != NULL);
+    assert(j >= 0 && j < result->num_modes);
+
+    if (largest_sign(result->eigenvectors[0] + j, result->num_beads,
+                result->num_modes) > 0)
+        return;
+
+    for (i = 0; i < result->num_beads; i++)
+        result->eigenvectors[i][j] = -result->eigenvectors[i][j];
+    if (result->coefficients != NULL)
+    {
+        result->coefficients[j].a = -result->coefficients[j].a;
+        result->coefficients[j].b = -result->coefficients[j].b;
+    }
+}
+
+/* Returns true if x is within UNIFORM_TOL of y, relative to y */
+static bool nearly_equal(double x, double y)
+{
+    return fabs(x - y) <= UNIFORM_TOL * fabs(y);
+}
+
+bool is_uniform(const Simulation *sim)
+{
+    int i;
+
+    for (i = 1; i < sim->num_beads; i++)
+        if (!nearly_equal(sim->beads[i].mass, sim->beads[0].mass))
+            return false;
+
+    for (i = 1; i <= sim->num_beads; i++)
+        if (!nearly_equal(sim->connections[i], sim->connections[0]))
+            return false;
+
+    return true;
+}
+
+void find_uniform_frequencies(const Simulation *sim, double *frequencies)
+{
+    int n = sim->num_beads;
+    double k = spring_constant(sim, sim->connections[0]);
+    int j;
+
+    for (j = 0; j < n; j++)
+        frequencies[j] = 2 * sqrt(k / sim->beads[0].mass)
+            * sin(M_PI * (j + 1) / (2.0 * (n + 1)));
+}
+
+/* The transform is a real FFT of the odd extension of data to 2 (n + 1)
+ * points: the imaginary part of output k is
+ * -2 sum over p of x_p sin(p k pi / (n + 1)). GSL's mixed-radix FFT costs
+ * O(n f) for each prime factor f of n + 1 above 5, so if n + 1 is prime this
+ * is no faster than the direct sum. Padding the extension to a smoother
+ * length would change the transform, so the length is left as it is. */
+void sine_transform(double *data, int n,
+        const gsl_fft_real_wavetable *wavetable, gsl_fft_real_workspace *work)
+{
+    size_t size = 2 * (size_t)(n + 1);
+    double scale = -0.5 * sqrt(2.0 / (n + 1));
+    int i;
+
+    for (i = n; i >= 1; i--)
+    {
+        data[i] = data[i - 1];
+        data[size - i] = -data[i];
+    }
+    data[0] = 0;
+    data[n + 1] = 0;
+
+    gsl_fft_real_transform(data, 1, size, wavetable, work);
+
+    /* Output k is stored in halfcomplex order, its imaginary part at 2k */
+    for (i = 0; i < n; i++)
+        data[i] = scale * data[2 * (i + 1)];
+}
+
+int uniform_coefficients(const Simulation *sim, double *data,
+        const gsl_fft_real_wavetable *wavetable, gsl_fft_real_workspace *work,
+        Result *result)
+{
+    int n = sim->num_beads;
+    gsl_fft_real_wavetable *own_wavetable = NULL;
+    gsl_fft_real_workspace *own_work = NULL;
+    int j;
+
+    assert(data != NULL);
+    assert(result->coefficients != NULL);
+
+    if (wavetable == NULL || work == NULL)
+    {
+        own_wavetable = gsl_fft_real_wavetable_alloc(2 * (n + 1));
+        own_work = gsl_fft_real_workspace_alloc(2 * (n + 1));
+        if (own_wavetable == NULL || own_work == NULL)
+        {
+            if (own_wavetable != NULL)
+                gsl_fft_real_wavetable_free(own_wavetable);
+            if (own_work != NULL)
+                gsl_fft_real_workspace_free(own_work);
+            return 1;
+        }
+        wavetable = own_wavetable;
+        work = own_work;
+    }
+
+    for (j = 0; j < n; j++)
+        data[j] = sim->beads[j].x0;
+    sine_transform(data, n, wavetable, work);
+    for (j = 0; j < n; j++)
+        result->coefficients[j].a = data[j];
+
+    /* For velocity terms, we divide by the eigenfrequency since we took a
+     * derivative */
+    for (j = 0; j < n; j++)
+        data[j] = sim->beads[j].v0;
+    sine_transform(data, n, wavetable, work);
+    for (j = 0; j < n; j++)
+        result->coefficients[j].b = data[j] / result->eigenfrequencies[j];
+
+    if (own_wavetable != NULL)
+    {
+        gsl_fft_real_wavetable_free(own_wavetable);
+        gsl_fft_real_workspace_free(own_work);
+    }
+
+    return 0;
+}
+
+/* Fills result with the normal modes of sim, a uniform chain of N beads of
+ * mass m joined by springs of constant k (tension / spacing for strings).
+ * These are known in closed form: mode j is the sine wave
+ * sqrt(2 / (N + 1)) sin((i + 1)(j + 1) pi / (N + 1)) with eigenfrequency
+ * 2 sqrt(k / m) sin((j + 1) pi / (2 (N + 1))). The modes are orthonormal, so
+ * the coefficients are the discrete sine transforms of the initial
+ * conditions and no eigensolver or LU decomposition is needed. sines holds
+ * 2 (N + 1) doubles, and wavetable and work are as for uniform_coefficients.
+ * Returns 1 if they couldn't be allocated, 0 otherwise. */
+static int find_uniform_modes(const Simulation *sim, double *sines,
+        const gsl_fft_real_wavetable *wavetable, gsl_fft_real_workspace *work,
+        Result *result)
+{
+    int n = sim->num_beads;
+    double scale;
+    int i, j;
+
+    /* sin(p pi / (N + 1)) only depends on p mod 2 (N + 1) */
+    scale = sqrt(2.0 / (n + 1));
+    for (i = 0; i < 2 * (n + 1); i++)
+        sines[i] = scale * sin(M_PI * i / (n + 1));
+
+    find_uniform_frequencies(sim, result->eigenfrequencies);
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+            result->eigenvectors[i][j] =
+                sines[(size_t)(i + 1) * (j + 1) % (2 * (n + 1))];
+    result->sine_modes = true;
+
+    /* The table is done with, and becomes the transform's data */
+    return uniform_coefficients(sim, sines, wavetable, work, result);
+}
+
+LsStatus solve_with(const Simulation *sim, Scratch *s, Result *result)
+{
+    assert(sim != NULL);
+    assert(sim->beads != NULL);
+    assert(sim->connections != NULL || sim->sim_type == MEMBRANE);
+    assert(s != NULL);
+    assert(result != NULL);
+
+    if (sim->sim_type == MEMBRANE || sim->num_beads != s->num_beads
+            || result->num_modes != s->num_beads)
+        return LS_ERR_INVALID;
+
+    result->sine_modes = false;
+    if (!sim->periodic && is_uniform(sim))
+    {
+        find_uniform_modes(sim, s->sines, s->wavetable, s->fft_work, result);
+        return LS_OK;
+    }
+
+    pthread_once(&gsl_handler_once, turn_off_gsl_handler);
+
+    create_mass_matrix(sim->beads, sim->num_beads, &s->mass_matrix.matrix);
+    if (sim->sim_type == SPRING)
+        create_spring_k_matrix(sim->connections, sim->num_beads,
+                &s->k_matrix.matrix);
+    else
+        create_string_k_matrix(sim->connections, sim->tension,
+                sim->num_beads, &s->k_matrix.matrix);
+    if (sim->periodic)
+        close_ring(sim, &s->k_matrix.matrix);
+
+    if (find_normal_modes(s, result) || apply_ics(sim->beads, s, result))
+        return LS_ERR_SOLVER;
+
+    return LS_OK;
+}
+
+/* Solves sim, a uniform chain, in closed form without a Scratch. Only the
+ * eigenfrequencies are found unless needs asks for eigenvectors. */
+static LsStatus solve_closed_form(const Simulation *sim, unsigned needs,
+        const LsAllocator *allocator, Result *result)
+{
+    int n = sim->num_beads;
+    double *sines;
+    void *arena;
+
+    if (!(needs & (LS_NEED_VECTORS | LS_NEED_COEFFICIENTS)))
+    {
+        if ((arena = ls_alloc(allocator, n * sizeof(double))) == NULL)
+            return LS_ERR_NOMEM;
+        layout_frequencies(arena, n, result);
+        find_uniform_frequencies(sim, result->eigenfrequencies);
+        return LS_OK;
+    }
+
+    arena = ls_alloc(allocator, result_size(n, n));
+    sines = ls_alloc(allocator, 2 * (n + 1) * sizeof(double));
+    if (arena == NULL || sines == NULL)
     {
-        coeffs[i].a = gsl_vector_get(a, i);
-        /* For velocity terms, we divide by the eigenfrequency since we took a 
-         * derivative */
-        coeffs[i].b = gsl_vector_get(b, i) / result.eigenfrequencies[i];
+        ls_free(allocator, arena);
+        ls_free(allocator, sines);
+        return LS_ERR_NOMEM;
     }
 
-    gsl_vector_free(a);
-    gsl_vector_free(b);
-    gsl_vector_free(ix);
-    gsl_vector_free(iv);
-    gsl_matrix_free(eigv);
-    gsl_permutation_free(p);
+    layout_result(arena, n, n, result);
+    if (find_uniform_modes(sim, sines, NULL, NULL, result))
+    {
+        ls_free(allocator, sines);
+        free_result(result, allocator);
+        return LS_ERR_NOMEM;
+    }
+    ls_free(allocator, sines);
 
-    return coeffs;
+    return LS_OK;
 }
 
-Result asolve(Simulation sim)
+/* Solves sim with the dense eigensolver */
+static LsStatus solve_dense(const Simulation *sim,
+        const LsAllocator *allocator, Result *result)
 {
-    Result result;
-    gsl_matrix *mass_matrix, *k_matrix;
+    Scratch *s;
+    void *arena;
+    LsStatus status;
+
+    /* solve_with would only use the sine table of a Scratch */
+    if (!sim->periodic && is_uniform(sim))
+        return solve_closed_form(sim, LS_NEED_ALL, allocator, result);
 
-    assert(sim.beads != NULL);
-    assert(sim.connections != NULL);
+    s = alloc_scratch(sim->num_beads, allocator);
+    arena = ls_alloc(allocator, result_size(sim->num_beads, sim->num_beads));
+    if (s == NULL || arena == NULL)
+    {
+        free_scratch(s, allocator);
+        ls_free(allocator, arena);
+        return LS_ERR_NOMEM;
+    }
+
+    layout_result(arena, sim->num_beads, sim->num_beads, result);
+    if ((status = solve_with(sim, s, result)) != LS_OK)
+        free_result(result, allocator);
 
-    printf("Performing an analytical solution for a ");
-    if (sim.sim_type == STRING)
-        printf("string with ");
-    else if (sim.sim_type == SPRING)
-        printf("spring with ");
-    printf("%d beads.\n", sim.num_beads);
-    printf("\n");
+    free_scratch(s, allocator);
+
+    return status;
+}
 
-    mass_matrix = create_mass_matrix(sim.beads, sim.num_beads);
-    if (sim.sim_type == SPRING)
-        k_matrix = create_spring_k_matrix(sim.connections, sim.num_beads);
-    if (sim.sim_type == STRING)
-        k_matrix = create_string_k_matrix(sim.connections, sim.tension,
-                sim.num_beads);
+LsStatus solve_engine(const Simulation *sim, LsEngine engine, unsigned needs,
+        const LsAllocator *allocator, Result *result)
+{
+    LsStatus status;
 
-    result = find_normal_modes(mass_matrix, k_matrix);
-    result.coefficients = apply_ics(sim.beads, result);
+    assert(sim != NULL);
+    assert(allocator != NULL);
+    assert(result != NULL);
 
-    gsl_matrix_free(mass_matrix);
-    gsl_matrix_free(k_matrix);
+    /* The GSL based engines report errors through return values */
+    pthread_once(&gsl_handler_once, turn_off_gsl_handler);
 
-    return result;
+    switch (engine)
+    {
+        case LS_ENGINE_DENSE:
+            if (sim->sim_type == MEMBRANE)
+                return LS_ERR_INVALID;
+            return solve_dense(sim, allocator, result);
+        case LS_ENGINE_CLOSED_FORM:
+            if (sim->sim_type == MEMBRANE || sim->periodic || !is_uniform(sim))
+                return LS_ERR_INVALID;
+            return solve_closed_form(sim, needs, allocator, result);
+        case LS_ENGINE_BLOCH:
+            if (!sim->periodic || ring_period(sim) == sim->num_beads)
+                return LS_ERR_INVALID;
+            return ring_solve(sim, ring_period(sim), allocator, result);
+        case LS_ENGINE_TRIDIAGONAL:
+            /* Inverse iteration checks its vectors, and the dense solver,
+             * which can't fail that way, takes over if one falls short */
+            status = tdsolve(sim, needs, allocator, result);
+            if (status == LS_ERR_SOLVER)
+                status = solve_dense(sim, allocator, result);
+            return status;
+        case LS_ENGINE_LANCZOS:
+            if (sim->sim_type != MEMBRANE)
+                return LS_ERR_INVALID;
+            return msolve(sim, allocator, result);
+        default:
+            return LS_ERR_INVALID;
+    }
 }
 
+LsStatus asolve(const Simulation *sim, const LsAllocator *allocator,
+        Result *result)
+{
+    LsPlan plan;
+    LsStatus status;
+
+    assert(sim != NULL);
+    assert(allocator != NULL);
+    assert(result != NULL);
 
+    if ((status = make_plan(sim, LS_NEED_ALL, SIZE_MAX, &plan)) != LS_OK)
+        return status;
+
+    return solve_engine(sim, plan.engine, plan.needs, allocator, result);
+}
+
+void free_result(Result *result, const LsAllocator *allocator)
+{
+    assert(result != NULL);
+
+    /* Everything lives in the arena starting at the row pointers, or at the
+     * eigenfrequencies if there are no eigenvectors, except what
+     * ls_find_mode uses */
+    ls_free(allocator, result->lazy);
+    if (result->eigenvectors != NULL)
+        ls_free(allocator, result->eigenvectors);
+    else
+        ls_free(allocator, result->eigenfrequencies);
+    memset(result, 0, sizeof(Result));
+}
@@ -6,12 +6,118 @@
 #ifndef ASOLVE_INCLUDED
 #define ASOLVE_INCLUDED
 
+#include <float.h>
+#include <gsl/gsl_fft_real.h>
 #include "types.h"
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. */
+
+/* Eigenvalues below this fraction of the largest are rounding errors of 0,
+ * as for a ring moving rigidly */
+#define ZERO_EIGENVALUE_TOL (64 * DBL_EPSILON)
+
+/* Entries of an eigenvector within this fraction of its largest are equally
+ * large when choosing its sign */
+#define SIGN_TOL 1e-8
+
+/* Masses or connections within this fraction of each other count as equal
+ * when deciding whether a chain is uniform */
+#define UNIFORM_TOL 1e-12
+
+/* Scratch matrices and vectors for solving systems of one size */
+typedef struct scratch Scratch;
+
+/* Returns the number of bytes alloc_scratch takes from its allocator for
+ * num_beads beads. GSL's workspaces add O(num_beads) more from malloc. */
+size_t scratch_size(int num_beads);
+
+/* Allocates scratch for solving systems of num_beads beads from allocator, as
+ * a single block, and GSL's workspaces for them. Returns NULL on failure. */
+Scratch *alloc_scratch(int num_beads, const LsAllocator *allocator);
+
+/* Frees scratch. Accepts NULL. */
+void free_scratch(Scratch *scratch, const LsAllocator *allocator);
+
+/* Returns the number of bytes needed to hold a Result of num_modes modes of
+ * num_beads beads */
+size_t result_size(int num_beads, int num_modes);
+
+/* Points the arrays of result into arena, which holds
+ * result_size(num_beads, num_modes) bytes. The arena starts at
+ * result->eigenvectors. */
+void layout_result(void *arena, int num_beads, int num_modes, Result *result);
+
+/* Points result at arena, which holds num_beads doubles, for the
+ * eigenfrequencies alone: its eigenvectors and coefficients are NULL. The
+ * arena starts at result->eigenfrequencies. */
+void layout_frequencies(void *arena, int num_beads, Result *result);
+
+/* Returns -1 if the first of the largest in magnitude of the n entries of v,
+ * stride apart, is negative, 1 otherwise. Entries within SIGN_TOL of the
+ * largest count as largest, so that rounding can't choose between them. */
+int largest_sign(const double *v, int n, size_t stride);
+
+/* Flips the sign of eigenvector j of result, laid out by layout_result, and
+ * of its coefficients, unless the first of its largest entries is already
+ * positive. Every engine but the closed form, whose sine modes are fixed,
+ * leaves its eigenvectors so, and they agree with each other. */
+void fix_sign(Result *result, int j);
+
+/* Returns the spring constant of a connection of sim whose value is
+ * connection, a spring constant or, for strings, the spacing of two beads.
+ * Strings act as springs of constant tension / spacing. */
+double spring_constant(const Simulation *sim, double connection);
+
+/* Returns true if every bead of sim has the same mass and every connection,
+ * including those to the walls, is the same, to within UNIFORM_TOL */
+bool is_uniform(const Simulation *sim);
+
+/* Stores the eigenfrequencies of sim, a uniform chain, in frequencies, an
+ * array of sim->num_beads doubles, in closed form */
+void find_uniform_frequencies(const Simulation *sim, double *frequencies);
+
+/* Replaces data[0] to data[n - 1] by their discrete sine transform
+ * sqrt(2 / (n + 1)) sum over i of data[i] sin((i + 1)(j + 1) pi / (n + 1)),
+ * the displacements of a uniform chain of n beads with modal weights data.
+ * data has room for 2 (n + 1) doubles, and wavetable and work are GSL's
+ * tables for an FFT of that many points. */
+void sine_transform(double *data, int n,
+        const gsl_fft_real_wavetable *wavetable, gsl_fft_real_workspace *work);
+
+/* Stores in the coefficients of result the initial conditions of sim, a
+ * uniform chain whose eigenfrequencies result already holds, projected onto
+ * its sine modes. These are discrete sine transforms, done by FFT. data holds
+ * 2 (N + 1) doubles. wavetable and work are GSL's tables for an FFT of that
+ * many points, or NULL to allocate them for the call. Returns 1 if they
+ * couldn't be allocated, 0 otherwise. */
+int uniform_coefficients(const Simulation *sim, double *data,
+        const gsl_fft_real_wavetable *wavetable, gsl_fft_real_workspace *work,
+        Result *result);
 
 /* Given simulation parameters in sim, calculates eigenfrequencies,
- * eigenvectors, coefficients corresponding to initial conditions, stores these
- * in a Result which is returned. Caller responsible for freeing all dynamically
- * allocated parts of the Result. */
-Result asolve(Simulation sim);
+ * eigenvectors, coefficients corresponding to initial conditions, and stores
+ * these in result, which must already be laid out for sim->num_beads modes.
+ * s must be sized for sim->num_beads. Does not allocate. Uniform chains are
+ * solved in closed form and rings densely. Membranes are not supported. */
+LsStatus solve_with(const Simulation *sim, Scratch *s, Result *result);
+
+/* Solves sim with engine, allocating everything from allocator. The closed
+ * form and tridiagonal engines find the eigenfrequencies alone, laid out by
+ * layout_frequencies, if needs asks for nothing else. If the tridiagonal
+ * engine fails its checks, sim is solved densely instead. Returns
+ * LS_ERR_INVALID if engine can't solve sim. On failure nothing is left
+ * allocated. Caller responsible for freeing result with free_result. */
+LsStatus solve_engine(const Simulation *sim, LsEngine engine, unsigned needs,
+        const LsAllocator *allocator, Result *result);
+
+/* Same as solve_with, but picks the engine with make_plan and allocates
+ * everything from allocator. On failure nothing is left allocated. Caller
+ * responsible for freeing result with free_result. */
+LsStatus asolve(const Simulation *sim, const LsAllocator *allocator,
+        Result *result);
+
+/* Frees the arena of a Result from asolve or solve_engine */
+void free_result(Result *result, const LsAllocator *allocator);
 
 #endif
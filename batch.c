@@ -0,0 +1,531 @@
+/*----------------------------------------------------------------------------*/
+/* batch.c                                                                    */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+
+#include "loadedstring.h"
+#include "asolve.h"
+#include "tridiag.h"
+#include "importdata.h"
+#include "alloc.h"
+
+#define LANES 8 /* Systems solved together, one per vector lane */
+#define MAX_SWEEPS 30 /* Jacobi sweeps before giving up */
+#define MAX_QL_ITERATIONS 30 /* QL iterations per eigenvalue of a chain */
+
+struct ls_batch
+{
+    LsAllocator allocator; /* Everything below comes from here */
+    int num_beads;
+    int capacity; /* Most systems solved at once */
+    double *a; /* Dynamical matrices of a block of LANES systems, entry (i, j)
+                  of lane l at (i * num_beads + j) * LANES + l */
+    double *v; /* Their eigenvectors, laid out like a */
+    double *diag; /* The same matrices of a block of chains, which are
+                     tridiagonal: entry i of lane l at i * LANES + l */
+    double *offdiag; /* Their off-diagonals, laid out like diag, with offdiag
+                        i joining beads i and i + 1 */
+    Result *results; /* Array of capacity results, each laid out in an arena
+                        after the blocks */
+};
+
+/* Stores D = M^-1/2 K M^-1/2 of sim, a chain or ring of n beads, in lane l of
+ * a, and the identity in lane l of v */
+static void load_lane(const Simulation *sim, int n, int l, double *a,
+        double *v)
+{
+    const Bead *beads = sim->beads;
+    int i, j;
+
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+        {
+            a[(i * n + j) * LANES + l] = 0;
+            v[(i * n + j) * LANES + l] = i == j;
+        }
+
+    for (i = 0; i < n; i++)
+    {
+        a[(i * n + i) * LANES + l] =
+            (spring_constant(sim, sim->connections[i])
+             + spring_constant(sim, sim->connections[i + 1])) / beads[i].mass;
+        if (i + 1 < n)
+        {
+            double k = -spring_constant(sim, sim->connections[i + 1])
+                / sqrt(beads[i].mass * beads[i + 1].mass);
+
+            a[(i * n + i + 1) * LANES + l] += k;
+            a[((i + 1) * n + i) * LANES + l] += k;
+        }
+    }
+
+    /* Connection 0 of a ring joins the last bead to the first; a ring of two
+     * is joined twice */
+    if (sim->periodic)
+    {
+        double k = -spring_constant(sim, sim->connections[0])
+            / sqrt(beads[0].mass * beads[n - 1].mass);
+
+        a[(n - 1) * LANES + l] += k;
+        a[((n - 1) * n) * LANES + l] += k;
+    }
+}
+
+/* Stores the tridiagonal D = M^-1/2 K M^-1/2 of sim, a chain of n beads, in
+ * lane l of diag and offdiag, and the identity in lane l of v */
+static void load_chain_lane(const Simulation *sim, int n, int l, double *diag,
+        double *offdiag, double *v)
+{
+    double d[LS_BATCH_MAX_BEADS], e[LS_BATCH_MAX_BEADS];
+    int i, j;
+
+    chain_tridiagonal(sim, d, e);
+    for (i = 0; i < n; i++)
+    {
+        diag[i * LANES + l] = d[i];
+        offdiag[i * LANES + l] = i + 1 < n ? e[i] : 0;
+        for (j = 0; j < n; j++)
+            v[(i * n + j) * LANES + l] = i == j;
+    }
+}
+
+/* Returns true once the off-diagonal entries of every lane of a are
+ * negligible */
+static inline bool converged(int n, const double *a)
+{
+    double off[LANES], total[LANES];
+    int i, j, l;
+
+    for (l = 0; l < LANES; l++)
+        off[l] = total[l] = 0;
+
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+            for (l = 0; l < LANES; l++)
+            {
+                double x = a[(i * n + j) * LANES + l];
+
+                if (i != j)
+                    off[l] += x * x;
+                total[l] += x * x;
+            }
+
+    for (l = 0; l < LANES; l++)
+        if (off[l] > DBL_EPSILON * DBL_EPSILON * total[l])
+            return false;
+
+    return true;
+}
+
+/* Diagonalizes the block of matrices in a by cyclic Jacobi rotations,
+ * accumulating them in v. Every lane takes the same rotations in the same
+ * order, each by its own angle, so the innermost loops run across the lanes
+ * and vectorize. Returns 1 if some lane hasn't converged, 0 otherwise. */
+static inline __attribute__((always_inline)) int jacobi(int n, double *a,
+        double *v)
+{
+    double t[LANES], c[LANES], s[LANES];
+    int sweep, p, q, k, l;
+
+    for (sweep = 0; sweep < MAX_SWEEPS; sweep++)
+    {
+        if (converged(n, a))
+            return 0;
+
+        for (p = 0; p < n - 1; p++)
+            for (q = p + 1; q < n; q++)
+            {
+                double *app = a + (p * n + p) * LANES;
+                double *aqq = a + (q * n + q) * LANES;
+                double *apq = a + (p * n + q) * LANES;
+                double *aqp = a + (q * n + p) * LANES;
+
+                /* The smaller root of t^2 + 2 theta t - 1 = 0, written so
+                 * that a zero apq gives t = 0 without a branch */
+                for (l = 0; l < LANES; l++)
+                {
+                    double tau = aqq[l] - app[l];
+
+                    t[l] = 2 * apq[l] * copysign(1.0, tau)
+                        / (fabs(tau) + sqrt(tau * tau + 4 * apq[l] * apq[l])
+                                + DBL_MIN);
+                    c[l] = 1 / sqrt(1 + t[l] * t[l]);
+                    s[l] = t[l] * c[l];
+                    app[l] -= t[l] * apq[l];
+                    aqq[l] += t[l] * apq[l];
+                    apq[l] = aqp[l] = 0;
+                }
+
+                for (k = 0; k < n; k++)
+                {
+                    double *akp = a + (k * n + p) * LANES;
+                    double *akq = a + (k * n + q) * LANES;
+                    double *apk = a + (p * n + k) * LANES;
+                    double *aqk = a + (q * n + k) * LANES;
+
+                    if (k == p || k == q)
+                        continue;
+
+                    for (l = 0; l < LANES; l++)
+                    {
+                        double x = akp[l], y = akq[l];
+
+                        akp[l] = apk[l] = c[l] * x - s[l] * y;
+                        akq[l] = aqk[l] = s[l] * x + c[l] * y;
+                    }
+                }
+
+                for (k = 0; k < n; k++)
+                {
+                    double *vkp = v + (k * n + p) * LANES;
+                    double *vkq = v + (k * n + q) * LANES;
+
+                    for (l = 0; l < LANES; l++)
+                    {
+                        double x = vkp[l], y = vkq[l];
+
+                        vkp[l] = c[l] * x - s[l] * y;
+                        vkq[l] = s[l] * x + c[l] * y;
+                    }
+                }
+            }
+    }
+
+    return !converged(n, a);
+}
+
+/* Diagonalizes the block of tridiagonal matrices in diag and offdiag by the
+ * QL algorithm with implicit shifts, as tridiag_eigenvalues does, but
+ * accumulating the rotations in v, which must start as the identity. The
+ * eigenvalues are left on the diagonal of a, as jacobi leaves them. Each
+ * lane splits off its own converged blocks and takes its own shifts, but all
+ * step through the same rotations, those outside a lane's active block
+ * turned into the identity, so the innermost loops run across the lanes and
+ * vectorize. This costs O(n) rotations per eigenvalue, each O(n) for the
+ * eigenvectors, against the O(n^2) rotations per sweep of jacobi. Returns 1
+ * if some lane hasn't converged, 0 otherwise. */
+static inline __attribute__((always_inline)) int tridiagonal(int n,
+        const double *diag, const double *offdiag, double *a, double *v)
+{
+    double d[LS_BATCH_MAX_BEADS * LANES], e[LS_BATCH_MAX_BEADS * LANES];
+    double end[LANES], d_end[LANES], g[LANES], s[LANES], c[LANES], p[LANES];
+    double active[LANES], bad[LANES];
+    int top, iter, i, k, l;
+
+    memcpy(d, diag, n * LANES * sizeof(double));
+    memcpy(e, offdiag, n * LANES * sizeof(double));
+    for (l = 0; l < LANES; l++)
+        bad[l] = 0;
+
+    for (top = 0; top < n; top++)
+        for (iter = 0; ; iter++)
+        {
+            double any = 0;
+
+            /* A lane's active block runs from top to its first negligible
+             * off-diagonal */
+            for (l = 0; l < LANES; l++)
+            {
+                end[l] = n - 1;
+                d_end[l] = d[(n - 1) * LANES + l];
+            }
+            for (k = n - 2; k >= top; k--)
+                for (l = 0; l < LANES; l++)
+                {
+                    bool split = fabs(e[k * LANES + l]) <= DBL_EPSILON
+                        * (fabs(d[k * LANES + l])
+                                + fabs(d[(k + 1) * LANES + l]));
+
+                    end[l] = split ? k : end[l];
+                    d_end[l] = split ? d[k * LANES + l] : d_end[l];
+                }
+            for (l = 0; l < LANES; l++)
+            {
+                active[l] = end[l] != top;
+                any += active[l];
+            }
+            if (any == 0)
+                break;
+            if (iter == MAX_QL_ITERATIONS)
+                return 1;
+
+            /* Shift by the eigenvalue of the leading 2 x 2 nearer its top */
+            for (l = 0; l < LANES; l++)
+            {
+                double t = (d[(top + 1) * LANES + l] - d[top * LANES + l])
+                    / (2 * e[top * LANES + l]);
+                double r = sqrt(t * t + 1);
+
+                g[l] = d_end[l] - d[top * LANES + l]
+                    + e[top * LANES + l] / (t + copysign(r, t));
+                s[l] = c[l] = 1;
+                p[l] = 0;
+            }
+
+            for (i = n - 2; i >= top; i--)
+            {
+                double rc[LANES], rs[LANES];
+
+                for (l = 0; l < LANES; l++)
+                {
+                    bool on = i < end[l];
+                    double f = s[l] * e[i * LANES + l];
+                    double b = c[l] * e[i * LANES + l];
+                    double r = sqrt(f * f + g[l] * g[l]);
+                    double sn = f / r, cs = g[l] / r;
+                    double gn = d[(i + 1) * LANES + l] - p[l];
+                    double rn = (d[i * LANES + l] - gn) * sn + 2 * cs * b;
+
+                    bad[l] += on && r == 0;
+                    e[(i + 1) * LANES + l] = on ? r : e[(i + 1) * LANES + l];
+                    d[(i + 1) * LANES + l] = on ? gn + sn * rn
+                        : d[(i + 1) * LANES + l];
+                    p[l] = on ? sn * rn : p[l];
+                    g[l] = on ? cs * rn - b : g[l];
+                    s[l] = on ? sn : s[l];
+                    c[l] = on ? cs : c[l];
+                    rs[l] = on ? sn : 0;
+                    rc[l] = on ? cs : 1;
+                }
+
+                for (k = 0; k < n; k++)
+                {
+                    double *vki = v + (k * n + i) * LANES;
+                    double *vkj = v + (k * n + i + 1) * LANES;
+
+                    for (l = 0; l < LANES; l++)
+                    {
+                        double x = vki[l], y = vkj[l];
+
+                        vkj[l] = rs[l] * x + rc[l] * y;
+                        vki[l] = rc[l] * x - rs[l] * y;
+                    }
+                }
+            }
+
+            for (l = 0; l < LANES; l++)
+            {
+                d[top * LANES + l] -= active[l] ? p[l] : 0;
+                e[top * LANES + l] = active[l] ? g[l] : e[top * LANES + l];
+            }
+            for (k = top + 1; k < n; k++)
+                for (l = 0; l < LANES; l++)
+                    e[k * LANES + l] = active[l] && k == end[l] ? 0
+                        : e[k * LANES + l];
+        }
+
+    for (l = 0; l < LANES; l++)
+        if (bad[l] > 0)
+            return 1;
+
+    for (i = 0; i < n; i++)
+        for (l = 0; l < LANES; l++)
+            a[(i * n + i) * LANES + l] = d[i * LANES + l];
+
+    return 0;
+}
+
+/* One copy of jacobi per size, so that n is a constant the compiler can
+ * unroll and schedule for */
+#define DEFINE_JACOBI(N) \
+    static int jacobi_##N(double *a, double *v) { return jacobi(N, a, v); }
+
+DEFINE_JACOBI(1) DEFINE_JACOBI(2) DEFINE_JACOBI(3) DEFINE_JACOBI(4)
+DEFINE_JACOBI(5) DEFINE_JACOBI(6) DEFINE_JACOBI(7) DEFINE_JACOBI(8)
+DEFINE_JACOBI(9) DEFINE_JACOBI(10) DEFINE_JACOBI(11) DEFINE_JACOBI(12)
+DEFINE_JACOBI(13) DEFINE_JACOBI(14) DEFINE_JACOBI(15) DEFINE_JACOBI(16)
+
+static int (*const jacobi_kernels[LS_BATCH_MAX_BEADS + 1])(double *,
+        double *) =
+{
+    NULL, jacobi_1, jacobi_2, jacobi_3, jacobi_4, jacobi_5, jacobi_6,
+    jacobi_7, jacobi_8, jacobi_9, jacobi_10, jacobi_11, jacobi_12, jacobi_13,
+    jacobi_14, jacobi_15, jacobi_16
+};
+
+/* And of tridiagonal */
+#define DEFINE_TRIDIAGONAL(N) \
+    static int tridiagonal_##N(const double *diag, const double *offdiag, \
+            double *a, double *v) \
+    { return tridiagonal(N, diag, offdiag, a, v); }
+
+DEFINE_TRIDIAGONAL(1) DEFINE_TRIDIAGONAL(2) DEFINE_TRIDIAGONAL(3)
+DEFINE_TRIDIAGONAL(4) DEFINE_TRIDIAGONAL(5) DEFINE_TRIDIAGONAL(6)
+DEFINE_TRIDIAGONAL(7) DEFINE_TRIDIAGONAL(8) DEFINE_TRIDIAGONAL(9)
+DEFINE_TRIDIAGONAL(10) DEFINE_TRIDIAGONAL(11) DEFINE_TRIDIAGONAL(12)
+DEFINE_TRIDIAGONAL(13) DEFINE_TRIDIAGONAL(14) DEFINE_TRIDIAGONAL(15)
+DEFINE_TRIDIAGONAL(16)
+
+static int (*const tridiagonal_kernels[LS_BATCH_MAX_BEADS + 1])(
+        const double *, const double *, double *, double *) =
+{
+    NULL, tridiagonal_1, tridiagonal_2, tridiagonal_3, tridiagonal_4,
+    tridiagonal_5, tridiagonal_6, tridiagonal_7, tridiagonal_8,
+    tridiagonal_9, tridiagonal_10, tridiagonal_11, tridiagonal_12,
+    tridiagonal_13, tridiagonal_14, tridiagonal_15, tridiagonal_16
+};
+
+/* Fills result with the modes of sim from lane l of the diagonalized block:
+ * eigenvalues sorted ascending, eigenvectors translated back to regular
+ * coordinates and normalized, and the coefficients found by projecting the
+ * initial conditions, as the eigenvectors of D are orthonormal */
+static void store_lane(const Simulation *sim, int n, int l, const double *a,
+        const double *v, Result *result)
+{
+    int order[LS_BATCH_MAX_BEADS];
+    double largest = 0;
+    int i, j, k;
+
+    /* Insertion sort of the eigenvalues, few enough for it */
+    for (j = 0; j < n; j++)
+    {
+        double lambda = a[(j * n + j) * LANES + l];
+
+        for (k = j; k > 0 && a[(order[k - 1] * n + order[k - 1]) * LANES + l]
+                > lambda; k--)
+            order[k] = order[k - 1];
+        order[k] = j;
+        largest = fmax(largest, fabs(lambda));
+    }
+
+    for (j = 0; j < n; j++)
+    {
+        int m = order[j];
+        double lambda = a[(m * n + m) * LANES + l];
+        double mag = 0, a0 = 0, b0 = 0;
+
+        /* A ring's rigid motion has an eigenvalue within rounding of 0 */
+        if (lambda < ZERO_EIGENVALUE_TOL * largest)
+            lambda = 0;
+        result->eigenfrequencies[j] = sqrt(lambda);
+
+        for (i = 0; i < n; i++)
+        {
+            double z = v[(i * n + m) * LANES + l];
+            double sqrtm = sqrt(sim->beads[i].mass);
+
+            result->eigenvectors[i][j] = z / sqrtm;
+            mag += z * z / sim->beads[i].mass;
+            a0 += z * sqrtm * sim->beads[i].x0;
+            b0 += z * sqrtm * sim->beads[i].v0;
+        }
+
+        mag = sqrt(mag);
+        for (i = 0; i < n; i++)
+            result->eigenvectors[i][j] /= mag;
+
+        /* For velocity terms, we divide by the eigenfrequency since we took a
+         * derivative. A mode of zero frequency keeps its velocity. */
+        result->coefficients[j].a = a0 * mag;
+        result->coefficients[j].b = b0 * mag;
+        if (result->eigenfrequencies[j] > 0)
+            result->coefficients[j].b /= result->eigenfrequencies[j];
+        fix_sign(result, j);
+    }
+}
+
+LsStatus ls_batch_create(int num_beads, int capacity,
+        const LsAllocator *allocator, LsBatch **batch)
+{
+    LsAllocator al = ls_allocator_or_default(allocator);
+    size_t block = (size_t)num_beads * num_beads * LANES;
+    size_t arena;
+    LsBatch *b;
+    char *pos;
+    int k;
+
+    if (num_beads <= 0 || num_beads > LS_BATCH_MAX_BEADS || capacity <= 0
+            || batch == NULL)
+        return LS_ERR_INVALID;
+
+    arena = result_size(num_beads, num_beads);
+    b = ls_alloc(&al, sizeof(LsBatch) + 2 * block * sizeof(double)
+            + 2 * (size_t)num_beads * LANES * sizeof(double)
+            + capacity * (sizeof(Result) + arena));
+    if (b == NULL)
+        return LS_ERR_NOMEM;
+
+    b->allocator = al;
+    b->num_beads = num_beads;
+    b->capacity = capacity;
+    b->a = (double *)(b + 1);
+    b->v = b->a + block;
+    b->diag = b->v + block;
+    b->offdiag = b->diag + num_beads * LANES;
+    b->results = (Result *)(b->offdiag + num_beads * LANES);
+
+    pos = (char *)(b->results + capacity);
+    for (k = 0; k < capacity; k++, pos += arena)
+        layout_result(pos, num_beads, num_beads, &b->results[k]);
+
+    *batch = b;
+
+    return LS_OK;
+}
+
+LsStatus ls_batch_solve(LsBatch *batch, const Simulation *sims, int count,
+        const Result **results)
+{
+    int n, start, k, l;
+
+    if (batch == NULL || (sims == NULL && count > 0) || results == NULL
+            || count < 0 || count > batch->capacity)
+        return LS_ERR_INVALID;
+
+    n = batch->num_beads;
+    for (k = 0; k < count; k++)
+        if (sims[k].sim_type == MEMBRANE || sims[k].num_beads != n
+                || check_simulation(&sims[k]) != LS_OK)
+            return LS_ERR_INVALID;
+
+    for (start = 0; start < count; start += LANES)
+    {
+        int lanes = count - start < LANES ? count - start : LANES;
+        bool rings = false;
+
+        /* Idle lanes of the last block repeat its last system */
+        for (l = 0; l < LANES; l++)
+            rings |= sims[start + (l < lanes ? l : lanes - 1)].periodic;
+
+        /* Blocks of chains are tridiagonal. Rings, and chains QL fails to
+         * converge on, are left to Jacobi. */
+        if (!rings)
+            for (l = 0; l < LANES; l++)
+                load_chain_lane(&sims[start + (l < lanes ? l : lanes - 1)],
+                        n, l, batch->diag, batch->offdiag, batch->v);
+        if (rings || tridiagonal_kernels[n](batch->diag, batch->offdiag,
+                    batch->a, batch->v))
+        {
+            for (l = 0; l < LANES; l++)
+                load_lane(&sims[start + (l < lanes ? l : lanes - 1)], n, l,
+                        batch->a, batch->v);
+            if (jacobi_kernels[n](batch->a, batch->v))
+                return LS_ERR_SOLVER;
+        }
+
+        for (l = 0; l < lanes; l++)
+            store_lane(&sims[start + l], n, l, batch->a, batch->v,
+                    &batch->results[start + l]);
+    }
+
+    *results = batch->results;
+
+    return LS_OK;
+}
+
+void ls_batch_free(LsBatch *batch)
+{
+    LsAllocator a;
+
+    if (batch == NULL)
+        return;
+
+    a = batch->allocator;
+    ls_free(&a, batch);
+}
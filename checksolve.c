@@ -0,0 +1,472 @@
+/*----------------------------------------------------------------------------*/
+/* checksolve.c                                                               */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+/* Checks every engine that can solve each system named on the command line
+ * against the dense solver, as make check does for the examples. Each result
+ * must satisfy K x = w^2 M x and reproduce the initial conditions, and agree
+ * with the dense result in its eigenfrequencies, in the motion it predicts
+ * and, for chains, in its eigenvectors. Membranes are skipped. Exits with
+ * status 1 if any check fails. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "loadedstring.h"
+#include "types.h"
+#include "asolve.h"
+
+/* Largest difference allowed, relative to the size of what is compared */
+#define CHECK_TOL 1e-9
+
+/* Times at which the motion of two results is compared, in s */
+static const double check_times[] = {0, 0.37, 1.9, 7.3};
+#define NUM_CHECK_TIMES (sizeof(check_times) / sizeof(check_times[0]))
+
+/* Returns the largest of |K x - w^2 M x| over the eigenvectors x of result,
+ * relative to the largest diagonal entry of K */
+static double residual(const Simulation *sim, const Result *result)
+{
+    int n = sim->num_beads;
+    double scale = 0, worst = 0;
+    int i, j;
+
+    for (i = 0; i < n; i++)
+        scale = fmax(scale, spring_constant(sim, sim->connections[i])
+                + spring_constant(sim, sim->connections[i + 1]));
+
+    for (j = 0; j < result->num_modes; j++)
+    {
+        double w2 = result->eigenfrequencies[j] * result->eigenfrequencies[j];
+
+        for (i = 0; i < n; i++)
+        {
+            double left = spring_constant(sim, sim->connections[i]);
+            double right = spring_constant(sim, sim->connections[i + 1]);
+            double r = (left + right - w2 * sim->beads[i].mass)
+                * result->eigenvectors[i][j];
+
+            /* A ring's connection 0 joins its last bead to its first, and
+             * connection n mirrors it */
+            if (i > 0 || sim->periodic)
+                r -= left * result->eigenvectors[(i + n - 1) % n][j];
+            if (i < n - 1 || sim->periodic)
+                r -= right * result->eigenvectors[(i + 1) % n][j];
+            worst = fmax(worst, fabs(r));
+        }
+    }
+
+    return worst / scale;
+}
+
+/* Stores in u, an array of num_beads doubles, the displacements result
+ * predicts at time t */
+static void displacements(const Result *result, double t, double *u)
+{
+    int i, j;
+
+    for (i = 0; i < result->num_beads; i++)
+    {
+        u[i] = 0;
+        for (j = 0; j < result->num_modes; j++)
+        {
+            double w = result->eigenfrequencies[j];
+            const Coefficient *c = &result->coefficients[j];
+
+            u[i] += result->eigenvectors[i][j] * (w == 0 ? c->a + c->b * t
+                    : c->a * cos(w * t) + c->b * sin(w * t));
+        }
+    }
+}
+
+/* Returns how far the initial displacements and velocities result predicts
+ * are from those of sim, relative to the largest of them */
+static double initial_error(const Simulation *sim, const Result *result)
+{
+    double scale = 0, worst = 0;
+    int i, j;
+
+    for (i = 0; i < sim->num_beads; i++)
+        scale = fmax(scale, fmax(fabs(sim->beads[i].x0),
+                    fabs(sim->beads[i].v0)));
+
+    for (i = 0; i < sim->num_beads; i++)
+    {
+        double x = 0, v = 0;
+
+        for (j = 0; j < result->num_modes; j++)
+        {
+            double w = result->eigenfrequencies[j];
+
+            x += result->eigenvectors[i][j] * result->coefficients[j].a;
+            v += result->eigenvectors[i][j] * result->coefficients[j].b
+                * (w == 0 ? 1 : w);
+        }
+        worst = fmax(worst, fmax(fabs(x - sim->beads[i].x0),
+                    fabs(v - sim->beads[i].v0)));
+    }
+
+    return scale > 0 ? worst / scale : worst;
+}
+
+/* Returns the largest difference between the motions of result and ref at
+ * check_times, relative to the largest displacement of ref. Degenerate modes
+ * may be any basis of their eigenspace, but the motion is the same. work
+ * holds 2 num_beads doubles. */
+static double motion_error(const Result *ref, const Result *result,
+        double *work)
+{
+    int n = ref->num_beads;
+    double scale = 0, worst = 0;
+    size_t k;
+    int i;
+
+    for (k = 0; k < NUM_CHECK_TIMES; k++)
+    {
+        displacements(ref, check_times[k], work);
+        displacements(result, check_times[k], work + n);
+        for (i = 0; i < n; i++)
+        {
+            scale = fmax(scale, fabs(work[i]));
+            worst = fmax(worst, fabs(work[i] - work[n + i]));
+        }
+    }
+
+    return scale > 0 ? worst / scale : worst;
+}
+
+/* Returns the largest difference between the eigenvectors of result and
+ * ref, each taken with whichever sign is closer, since sine modes keep their
+ * own signs */
+static double vector_error(const Result *ref, const Result *result)
+{
+    double worst = 0;
+    int i, j;
+
+    for (j = 0; j < ref->num_modes; j++)
+    {
+        double same = 0, flipped = 0;
+
+        for (i = 0; i < ref->num_beads; i++)
+        {
+            same = fmax(same, fabs(result->eigenvectors[i][j]
+                        - ref->eigenvectors[i][j]));
+            flipped = fmax(flipped, fabs(result->eigenvectors[i][j]
+                        + ref->eigenvectors[i][j]));
+        }
+        worst = fmax(worst, fmin(same, flipped));
+    }
+
+    return worst;
+}
+
+/* Returns the largest difference between the eigenfrequencies of result and
+ * ref, relative to the largest of ref */
+static double frequency_error(const Result *ref, const Result *result)
+{
+    double scale = ref->eigenfrequencies[ref->num_modes - 1];
+    double worst = 0;
+    int j;
+
+    for (j = 0; j < ref->num_modes; j++)
+        worst = fmax(worst, fabs(result->eigenfrequencies[j]
+                    - ref->eigenfrequencies[j]));
+
+    return scale > 0 ? worst / scale : worst;
+}
+
+/* Checks result, from the engine called name, on its own and against ref,
+ * the dense result for sim, and prints the outcome. Results without
+ * coefficients are only checked in their eigenvectors. work holds
+ * 2 num_beads doubles. Returns 1 if a check failed, 0 otherwise. */
+static int compare(const Simulation *sim, const Result *ref,
+        const Result *result, const char *name, double *work)
+{
+    double err[5] = {0, 0, 0, 0, 0};
+    static const char *what[5] = {"residual", "initial conditions",
+        "eigenfrequencies", "motion", "eigenvectors"};
+    int k, failed = 0;
+
+    if (result->num_modes != ref->num_modes)
+    {
+        printf("  %-12s FAILED: %d modes, dense found %d\n", name,
+                result->num_modes, ref->num_modes);
+        return 1;
+    }
+
+    err[0] = residual(sim, result);
+    err[2] = frequency_error(ref, result);
+    if (result->coefficients != NULL)
+    {
+        err[1] = initial_error(sim, result);
+        err[3] = motion_error(ref, result, work);
+    }
+    /* Ring modes come in degenerate pairs, so only their motion compares */
+    if (!sim->periodic)
+        err[4] = vector_error(ref, result);
+
+    for (k = 0; k < 5; k++)
+        if (!(err[k] <= CHECK_TOL))
+        {
+            printf("  %-12s FAILED: %s off by %.3g\n", name, what[k], err[k]);
+            failed = 1;
+        }
+    if (!failed)
+        printf("  %-12s ok\n", name);
+
+    return failed;
+}
+
+/* Solves system with engine for needs and stores the solution in solution.
+ * Returns the status of the solve. */
+static LsStatus solve_with_engine(const LsSystem *system, LsEngine engine,
+        unsigned needs, LsSolution **solution)
+{
+    LsPlan plan;
+    LsStatus status;
+
+    if ((status = ls_plan(system, needs, SIZE_MAX, &plan)) != LS_OK)
+        return status;
+    plan.engine = engine;
+    plan.needs = needs;
+    plan.mapped = false;
+
+    return ls_solve_planned(system, &plan, NULL, SIZE_MAX, NULL, solution);
+}
+
+/* Solves system with engine and checks it against ref. Returns 1 if a check
+ * failed, 0 otherwise. */
+static int check_engine(const LsSystem *system, const Result *ref,
+        LsEngine engine, double *work)
+{
+    LsSolution *solution;
+    LsStatus status;
+    int failed;
+
+    if ((status = solve_with_engine(system, engine, LS_NEED_ALL, &solution))
+            != LS_OK)
+    {
+        printf("  %-12s FAILED: %s\n", ls_engine_name(engine),
+                ls_strerror(status));
+        return 1;
+    }
+    failed = compare(ls_system_simulation(system), ref,
+            ls_solution_result(solution), ls_engine_name(engine), work);
+    ls_solution_free(solution);
+
+    return failed;
+}
+
+/* Solves system for its eigenvectors alone, so that the tridiagonal engine
+ * leaves them to ls_find_mode, finds every one and checks them against ref.
+ * Returns 1 if a check failed, 0 otherwise. */
+static int check_lazy(const LsSystem *system, const Result *ref,
+        double *work)
+{
+    LsSolution *solution;
+    Result result;
+    LsStatus status;
+    int j, failed;
+
+    if ((status = solve_with_engine(system, LS_ENGINE_TRIDIAGONAL,
+                    LS_NEED_FREQUENCIES | LS_NEED_VECTORS, &solution))
+            != LS_OK)
+    {
+        printf("  %-12s FAILED: %s\n", "lazy", ls_strerror(status));
+        return 1;
+    }
+
+    result = *ls_solution_result(solution);
+    for (j = 0; j < result.num_modes; j++)
+        if ((status = ls_find_mode(&result, j)) != LS_OK)
+        {
+            printf("  %-12s FAILED: mode %d: %s\n", "lazy", j,
+                    ls_strerror(status));
+            ls_solution_free(solution);
+            return 1;
+        }
+    failed = compare(ls_system_simulation(system), ref, &result, "lazy",
+            work);
+    ls_solution_free(solution);
+
+    return failed;
+}
+
+/* Solves the simulation of system alone through an LsBatch and checks it
+ * against ref. Returns 1 if a check failed, 0 otherwise. */
+static int check_batch(const LsSystem *system, const Result *ref,
+        double *work)
+{
+    const Simulation *sim = ls_system_simulation(system);
+    const Result *results;
+    LsBatch *batch;
+    LsStatus status;
+    int failed;
+
+    if ((status = ls_batch_create(sim->num_beads, 1, NULL, &batch)) != LS_OK
+            || (status = ls_batch_solve(batch, sim, 1, &results)) != LS_OK)
+    {
+        printf("  %-12s FAILED: %s\n", "batch", ls_strerror(status));
+        ls_batch_free(batch);
+        return 1;
+    }
+    failed = compare(sim, ref, results, "batch", work);
+    ls_batch_free(batch);
+
+    return failed;
+}
+
+/* Solves the system in filename, changes the mass and initial conditions of
+ * its middle bead and then its first connection through ls_update_bead and
+ * ls_update_connection, and checks each update against a dense solve of the
+ * changed system. Returns 1 if a check failed, 0 otherwise. */
+static int check_update(const char *filename, double *work)
+{
+    LsSystem *system;
+    LsSolution *solution, *ref;
+    const Simulation *sim;
+    Bead bead;
+    LsStatus status;
+    int step, middle, failed = 0;
+
+    if (ls_system_load(filename, NULL, &system) != LS_OK)
+        return 1;
+    if ((status = ls_solve(system, NULL, &solution)) != LS_OK)
+    {
+        printf("  %-12s FAILED: %s\n", "update", ls_strerror(status));
+        ls_system_free(system);
+        return 1;
+    }
+
+    sim = ls_system_simulation(system);
+    middle = sim->num_beads / 2;
+    for (step = 0; step < 2 && !failed; step++)
+    {
+        if (step == 0)
+        {
+            bead = sim->beads[middle];
+            bead.mass *= 1.5;
+            bead.x0 += 0.25;
+            status = ls_update_bead(system, solution, middle, bead);
+        }
+        else
+            status = ls_update_connection(system, solution, 0,
+                    0.75 * sim->connections[0]);
+        if (status != LS_OK)
+        {
+            printf("  %-12s FAILED: %s\n", "update", ls_strerror(status));
+            ls_solution_free(solution);
+            ls_system_free(system);
+            return 1;
+        }
+
+        if ((status = solve_with_engine(system, LS_ENGINE_DENSE, LS_NEED_ALL,
+                        &ref)) != LS_OK)
+        {
+            printf("  %-12s FAILED: dense: %s\n", "update",
+                    ls_strerror(status));
+            failed = 1;
+            break;
+        }
+        failed = compare(sim, ls_solution_result(ref),
+                ls_solution_result(solution),
+                step == 0 ? "update bead" : "update link", work);
+        ls_solution_free(ref);
+    }
+
+    ls_solution_free(solution);
+    ls_system_free(system);
+
+    return failed;
+}
+
+/* Checks every engine that can solve the system in filename. Returns 1 if a
+ * check failed, 0 otherwise. */
+static int check_file(const char *filename)
+{
+    LsSystem *system;
+    LsSolution *ref;
+    const Simulation *sim;
+    LsPlan plan;
+    LsStatus status;
+    double *work;
+    int failed = 0;
+
+    printf("%s\n", filename);
+    if ((status = ls_system_load(filename, NULL, &system)) != LS_OK)
+    {
+        printf("  FAILED: %s\n", ls_strerror(status));
+        return 1;
+    }
+    sim = ls_system_simulation(system);
+    if (sim->sim_type == MEMBRANE)
+    {
+        printf("  membrane, skipped\n");
+        ls_system_free(system);
+        return 0;
+    }
+
+    work = malloc(2 * sim->num_beads * sizeof(double));
+    if (work == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory.\n");
+        ls_system_free(system);
+        return 1;
+    }
+    if ((status = ls_plan(system, LS_NEED_ALL, SIZE_MAX, &plan)) != LS_OK
+            || (status = solve_with_engine(system, LS_ENGINE_DENSE,
+                    LS_NEED_ALL, &ref)) != LS_OK)
+    {
+        printf("  FAILED: dense: %s\n", ls_strerror(status));
+        free(work);
+        ls_system_free(system);
+        return 1;
+    }
+
+    /* The dense result is checked on its own like the rest */
+    failed |= compare(sim, ls_solution_result(ref), ls_solution_result(ref),
+            "dense", work);
+    if (plan.flops[LS_ENGINE_CLOSED_FORM] >= 0)
+        failed |= check_engine(system, ls_solution_result(ref),
+                LS_ENGINE_CLOSED_FORM, work);
+    if (plan.flops[LS_ENGINE_BLOCH] >= 0)
+        failed |= check_engine(system, ls_solution_result(ref),
+                LS_ENGINE_BLOCH, work);
+    if (plan.flops[LS_ENGINE_TRIDIAGONAL] >= 0)
+    {
+        failed |= check_engine(system, ls_solution_result(ref),
+                LS_ENGINE_TRIDIAGONAL, work);
+        failed |= check_lazy(system, ls_solution_result(ref), work);
+    }
+    if (sim->num_beads <= LS_BATCH_MAX_BEADS)
+        failed |= check_batch(system, ls_solution_result(ref), work);
+    failed |= check_update(filename, work);
+
+    ls_solution_free(ref);
+    free(work);
+    ls_system_free(system);
+
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, failed = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++)
+        failed |= check_file(argv[i]);
+
+    printf(failed ? "Some checks FAILED\n" : "All checks passed\n");
+
+    return failed;
+}
@@ -0,0 +1,301 @@
+/*----------------------------------------------------------------------------*/
+/* export.c                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <math.h>
+
+#include "export.h"
+#include "synth.h"
+#include "plot.h"
+
+#define CHUNK_BYTES (8 << 20) /* Approximate size of one chunk */
+#define INDEX_ENTRY_SIZE 24
+
+/* Returns true if the host stores numbers little-endian */
+static bool little_endian(void)
+{
+    const uint16_t one = 1;
+
+    return *(const uint8_t *)&one == 1;
+}
+
+/* Reverses the bytes of each of count elements of size bytes in data */
+static void swap_bytes(void *data, size_t count, size_t size)
+{
+    uint8_t *p = data;
+    size_t i, j;
+
+    for (i = 0; i < count; i++, p += size)
+        for (j = 0; j < size / 2; j++)
+        {
+            uint8_t tmp = p[j];
+            p[j] = p[size - 1 - j];
+            p[size - 1 - j] = tmp;
+        }
+}
+
+/* Stores value in the size bytes at p, least significant byte first */
+static void put_le(uint8_t *p, uint64_t value, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+        p[i] = (value >> (8 * i)) & 0xff;
+}
+
+/* Stores the bits of value at p, little-endian */
+static void put_le_double(uint8_t *p, double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    put_le(p, bits, 8);
+}
+
+/* Rounds size up to a multiple of TRAJ_ALIGN */
+static size_t align_up(size_t size)
+{
+    return (size + TRAJ_ALIGN - 1) / TRAJ_ALIGN * TRAJ_ALIGN;
+}
+
+/* Returns the number of seconds since an arbitrary point */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* State of one export */
+typedef struct writer
+{
+    FILE *fp;
+    Synth synth;
+    int num_beads;
+    size_t elem; /* Bytes per displacement */
+    long num_frames;
+    long chunk_frames;
+    long num_chunks;
+    double timestep;
+    uint8_t *chunk; /* Buffer for one chunk, padded to TRAJ_ALIGN */
+    uint8_t *index; /* The chunk index, as written */
+    double *y; /* Scratch for one frame */
+    uint64_t size; /* Bytes written so far, including the header block */
+} Writer;
+
+/* Fills the chunk buffer of w with n frames starting at frame first, in
+ * columns. Returns the padded size of the chunk in bytes. */
+static size_t fill_chunk(Writer *w, long first, long n)
+{
+    double *times = (double *)w->chunk;
+    size_t used = n * (sizeof(double) + w->num_beads * w->elem);
+    size_t padded = align_up(used);
+    long f;
+    int i;
+
+    /* Frames come out of the synthesizer bead by bead; scatter them into the
+     * bead columns */
+    for (f = 0; f < n; f++)
+    {
+        times[f] = (first + f) * w->timestep;
+        synth_frame(&w->synth, times[f], w->y);
+
+        if (w->elem == sizeof(float))
+        {
+            float *cols = (float *)(times + n);
+            for (i = 0; i < w->num_beads; i++)
+                cols[(size_t)i * n + f] = w->y[i];
+        }
+        else
+        {
+            double *cols = times + n;
+            for (i = 0; i < w->num_beads; i++)
+                cols[(size_t)i * n + f] = w->y[i];
+        }
+    }
+
+    if (!little_endian())
+    {
+        swap_bytes(times, n, sizeof(double));
+        swap_bytes(times + n, (size_t)n * w->num_beads, w->elem);
+    }
+    memset(w->chunk + used, 0, padded - used);
+
+    return padded;
+}
+
+/* Writes the chunks, the index and the header of w. Returns 1 if an error
+ * occured, 0 otherwise. */
+static int write_file(Writer *w)
+{
+    uint8_t header[TRAJ_HEADER_SIZE] = {0};
+    long c;
+
+    /* The header is filled in once the index offset is known; the first
+     * chunk starts on the next alignment boundary */
+    w->size = TRAJ_ALIGN;
+    if (fseek(w->fp, w->size, SEEK_SET))
+        return 1;
+
+    for (c = 0; c < w->num_chunks; c++)
+    {
+        long first = c * w->chunk_frames;
+        long n = w->num_frames - first < w->chunk_frames
+            ? w->num_frames - first : w->chunk_frames;
+        size_t size = fill_chunk(w, first, n);
+
+        /* One large sequential write per chunk */
+        if (fwrite(w->chunk, 1, size, w->fp) != size)
+            return 1;
+
+        put_le(w->index + c * INDEX_ENTRY_SIZE, w->size, 8);
+        put_le(w->index + c * INDEX_ENTRY_SIZE + 8, first, 8);
+        put_le(w->index + c * INDEX_ENTRY_SIZE + 16, n, 8);
+        w->size += size;
+    }
+
+    if (fwrite(w->index, INDEX_ENTRY_SIZE, w->num_chunks, w->fp)
+            != (size_t)w->num_chunks)
+        return 1;
+
+    memcpy(header, "LSTRAJ\0\0", 8);
+    put_le(header + 8, TRAJ_VERSION, 4);
+    put_le(header + 12, w->elem == sizeof(float) ? TRAJ_FLOAT32 : 0, 4);
+    put_le(header + 16, w->num_beads, 4);
+    put_le(header + 20, w->chunk_frames, 4);
+    put_le(header + 24, w->num_frames, 8);
+    put_le(header + 32, w->num_chunks, 8);
+    put_le(header + 40, w->size, 8);
+    put_le_double(header + 48, w->timestep);
+    w->size += w->num_chunks * INDEX_ENTRY_SIZE;
+
+    return fseek(w->fp, 0, SEEK_SET)
+        || fwrite(header, 1, TRAJ_HEADER_SIZE, w->fp) != TRAJ_HEADER_SIZE;
+}
+
+int export_trajectory(const char *filename, Result result, ExportOptions opts)
+{
+    Writer w;
+    double start;
+    int error;
+
+    assert(filename != NULL);
+
+    if (opts.num_frames <= 0)
+        return 1;
+
+    memset(&w, 0, sizeof(Writer));
+    w.num_beads = result.num_beads;
+    w.elem = opts.single_precision ? sizeof(float) : sizeof(double);
+    w.num_frames = opts.num_frames;
+    w.timestep = opts.frame_rate > 0 ? 1 / opts.frame_rate
+        : calc_timestep(result);
+
+    w.chunk_frames = CHUNK_BYTES / (sizeof(double) + w.num_beads * w.elem);
+    if (w.chunk_frames < 1)
+        w.chunk_frames = 1;
+    if (w.chunk_frames > w.num_frames)
+        w.chunk_frames = w.num_frames;
+    w.num_chunks = (w.num_frames + w.chunk_frames - 1) / w.chunk_frames;
+
+    if (synth_init(&w.synth, result, opts.single_precision,
+                opts.energy_fraction,
+                opts.frame_rate > 0 ? M_PI * opts.frame_rate : 0))
+        return 1;
+
+    w.chunk = malloc(align_up(w.chunk_frames * (sizeof(double)
+                    + w.num_beads * w.elem)));
+    w.index = malloc(w.num_chunks * INDEX_ENTRY_SIZE);
+    w.y = malloc(w.num_beads * sizeof(double));
+    if (w.chunk == NULL || w.index == NULL || w.y == NULL
+            || (w.fp = fopen(filename, "wb")) == NULL)
+    {
+        fprintf(stderr, "Failed to open %s for export.\n", filename);
+        free(w.chunk);
+        free(w.index);
+        free(w.y);
+        synth_free(&w.synth);
+        return 1;
+    }
+
+    start = now();
+    error = write_file(&w);
+    if (fclose(w.fp))
+        error = 1;
+
+    if (error)
+        fprintf(stderr, "Failed to write %s.\n", filename);
+    else
+        printf("Exported %ld frames of %d beads to %s: %.1lf MB in %.2lfs.\n",
+                w.num_frames, w.num_beads, filename, w.size / 1e6,
+                now() - start);
+
+    free(w.chunk);
+    free(w.index);
+    free(w.y);
+    synth_free(&w.synth);
+
+    return error;
+}
+
+int export_response(const char *filename, int num_beads, int drive_bead,
+        const double *frequencies, const double *response, size_t count)
+{
+    uint8_t header[RESP_HEADER_SIZE] = {0};
+    size_t row_size = 1 + 2 * (size_t)num_beads;
+    double *row;
+    FILE *fp;
+    size_t k;
+    int error;
+
+    assert(filename != NULL);
+    assert(frequencies != NULL || count == 0);
+    assert(response != NULL || count == 0);
+
+    row = malloc(row_size * sizeof(double));
+    if (row == NULL || (fp = fopen(filename, "wb")) == NULL)
+    {
+        fprintf(stderr, "Failed to open %s for export.\n", filename);
+        free(row);
+        return 1;
+    }
+
+    memcpy(header, "LSRESP\0\0", 8);
+    put_le(header + 8, RESP_VERSION, 4);
+    put_le(header + 12, num_beads, 4);
+    put_le(header + 16, drive_bead, 4);
+    put_le(header + 24, count, 8);
+    error = fwrite(header, 1, RESP_HEADER_SIZE, fp) != RESP_HEADER_SIZE;
+
+    for (k = 0; k < count && !error; k++)
+    {
+        row[0] = frequencies[k];
+        memcpy(row + 1, response + k * (row_size - 1),
+                (row_size - 1) * sizeof(double));
+        if (!little_endian())
+            swap_bytes(row, row_size, sizeof(double));
+        error = fwrite(row, sizeof(double), row_size, fp) != row_size;
+    }
+
+    if (fclose(fp))
+        error = 1;
+
+    if (error)
+        fprintf(stderr, "Failed to write %s.\n", filename);
+    else
+        printf("Exported the response of %d beads at %zu frequencies to "
+                "%s.\n", num_beads, count, filename);
+
+    free(row);
+
+    return error;
+}
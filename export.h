@@ -0,0 +1,87 @@
+/*----------------------------------------------------------------------------*/
+/* export.h                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef EXPORT_INCLUDED
+#define EXPORT_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "types.h"
+
+/* Trajectory files hold the displacement of every bead at num_frames evenly
+ * spaced times. Everything is little-endian.
+ *
+ * Header, 64 bytes at offset 0:
+ *     char     magic[8]      "LSTRAJ\0\0"
+ *     uint32   version       TRAJ_VERSION
+ *     uint32   flags         TRAJ_FLOAT32 if displacements are float32,
+ *                            otherwise they are float64
+ *     uint32   num_beads
+ *     uint32   chunk_frames  frames per chunk; the last may hold fewer
+ *     uint64   num_frames
+ *     uint64   num_chunks
+ *     uint64   index_offset  byte offset of the chunk index
+ *     float64  timestep      time between frames, in s
+ *     (zero padding)
+ *
+ * Chunks start on TRAJ_ALIGN byte boundaries so that a mapped file can be
+ * read in place. A chunk of n frames is columnar: n float64 times, then n
+ * displacements of bead 0, n of bead 1, and so on.
+ *
+ * Chunk index, num_chunks entries of 24 bytes at index_offset:
+ *     uint64   offset        byte offset of the chunk
+ *     uint64   first_frame
+ *     uint64   num_frames */
+
+/* Response files hold the steady-state complex amplitude of every bead of a
+ * driven system at num_points driving frequencies. Everything is
+ * little-endian.
+ *
+ * Header, 32 bytes at offset 0:
+ *     char     magic[8]      "LSRESP\0\0"
+ *     uint32   version       RESP_VERSION
+ *     uint32   num_beads
+ *     uint32   drive_bead    zero indexed
+ *     uint32   reserved      0
+ *     uint64   num_points
+ *
+ * Then num_points rows of 8 (1 + 2 num_beads) bytes:
+ *     float64  frequency     driving frequency, in rad/s
+ *     float64  amplitude[2 num_beads]
+ *                            real and imaginary part of each bead's
+ *                            amplitude X, in m; the bead moves as
+ *                            Re(X e^(i w t)) */
+
+#define TRAJ_VERSION 1
+#define TRAJ_FLOAT32 0x1
+#define TRAJ_HEADER_SIZE 64
+#define TRAJ_ALIGN 4096
+#define RESP_VERSION 1
+#define RESP_HEADER_SIZE 32
+
+typedef struct export_options
+{
+    long num_frames; /* Number of frames to write */
+    bool single_precision; /* Write float32 displacements, synthesized with
+                              the float32 kernel */
+    double energy_fraction; /* Fraction of the mode energy kept in frames.
+                               1.0 keeps every mode. */
+    double frame_rate; /* Frames per simulated second. 0 spaces frames by
+                          calc_timestep instead. */
+} ExportOptions;
+
+/* Writes opts.num_frames frames of result, one animation timestep apart, or
+ * 1 / opts.frame_rate apart with modes too fast for that rate filtered out,
+ * and starting at t = 0, to the trajectory file filename. Returns 1 if an
+ * error occured, 0 otherwise. */
+int export_trajectory(const char *filename, Result result, ExportOptions opts);
+
+/* Writes the response of num_beads beads driven at drive_bead, at count
+ * frequencies, to the response file filename. response is laid out as by
+ * ls_frequency_response. Returns 1 if an error occured, 0 otherwise. */
+int export_response(const char *filename, int num_beads, int drive_bead,
+        const double *frequencies, const double *response, size_t count);
+
+#endif
@@ -3,79 +3,265 @@
 /* Author: Godwin Duan                                                        */
 /*----------------------------------------------------------------------------*/
 
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <assert.h>
 
 #include "importdata.h"
+#include "alloc.h"
 
-int import_data(char *filename, Simulation *sim)
+#define MAX_TOKEN_LENGTH 63
+
+/* Reads through the parameter text */
+typedef struct cursor
 {
-    FILE *fp;
-    char string_sim_type[7];
-    int i;
+    const char *pos; /* Next character to read */
+    const char *end; /* One past the last character */
+} Cursor;
 
-    assert(filename != NULL);
+/* Copies the next whitespace separated token of cursor into token, which
+ * holds MAX_TOKEN_LENGTH + 1 characters. Returns 1 if there is no token or it
+ * is too long, 0 otherwise. */
+static int next_token(Cursor *cursor, char *token)
+{
+    size_t len = 0;
 
-    fp = fopen(filename, "r");
-    if (fp == NULL)
+    while (cursor->pos < cursor->end && isspace((unsigned char)*cursor->pos))
+        cursor->pos++;
+
+    while (cursor->pos < cursor->end && !isspace((unsigned char)*cursor->pos))
     {
-        fprintf(stderr, "Failed to open input file.\n");
+        if (len == MAX_TOKEN_LENGTH)
+            return 1;
+        token[len++] = *cursor->pos++;
+    }
+    token[len] = '\0';
+
+    return len == 0;
+}
+
+/* Reads the next token of cursor as a number into value. Returns 1 if there
+ * is no number, 0 otherwise. */
+static int next_double(Cursor *cursor, double *value)
+{
+    char token[MAX_TOKEN_LENGTH + 1];
+    char *end;
+
+    if (next_token(cursor, token))
+        return 1;
+
+    *value = strtod(token, &end);
+
+    return *end != '\0';
+}
+
+/* Reads the next token of cursor as an integer into value. Returns 1 if there
+ * is no integer, 0 otherwise. */
+static int next_int(Cursor *cursor, int *value)
+{
+    char token[MAX_TOKEN_LENGTH + 1];
+    char *end;
+    long l;
+
+    if (next_token(cursor, token))
+        return 1;
+
+    l = strtol(token, &end, 10);
+    if (*end != '\0' || l < 0 || l > INT_MAX)
         return 1;
+    *value = (int)l;
+
+    return 0;
+}
+
+/* Reads the rest of a membrane from cursor into sim, whose type is already
+ * set: the two tensions, the grid size, the two spacings, the number of modes
+ * to find, then mass, x0 and v0 of each bead row by row. */
+static LsStatus import_membrane(Cursor *cursor, const LsAllocator *allocator,
+        Simulation *sim)
+{
+    int i;
+
+    if (next_double(cursor, &(sim->tension))
+            || next_double(cursor, &(sim->tension_y))
+            || next_int(cursor, &(sim->rows))
+            || next_int(cursor, &(sim->cols))
+            || next_double(cursor, &(sim->spacing_x))
+            || next_double(cursor, &(sim->spacing_y))
+            || next_int(cursor, &(sim->num_modes)))
+        return LS_ERR_PARSE;
+
+    if (sim->rows == 0 || sim->cols == 0 || sim->rows > INT_MAX / sim->cols)
+        return LS_ERR_PARSE;
+    sim->num_beads = sim->rows * sim->cols;
+
+    sim->beads = ls_calloc(allocator, (size_t)sim->num_beads * sizeof(Bead));
+    if (sim->beads == NULL)
+        return LS_ERR_NOMEM;
+
+    for (i = 0; i < sim->num_beads; i++)
+    {
+        if (next_double(cursor, &(sim->beads[i].mass))
+                || next_double(cursor, &(sim->beads[i].x0))
+                || next_double(cursor, &(sim->beads[i].v0)))
+        {
+            free_simulation(sim, allocator);
+            return LS_ERR_PARSE;
+        }
     }
 
-    if (strrchr(filename, '.') != NULL)
-        *strrchr(filename, '.') = '\0';
-    strcpy(sim->filename, filename);
+    return LS_OK;
+}
+
+LsStatus import_data(const char *text, size_t length,
+        const LsAllocator *allocator, Simulation *sim)
+{
+    Cursor cursor, peek;
+    char string_sim_type[MAX_TOKEN_LENGTH + 1];
+    char token[MAX_TOKEN_LENGTH + 1];
+    LsStatus status;
+    int i;
+
+    assert(text != NULL);
+    assert(allocator != NULL);
+    assert(sim != NULL);
+
+    memset(sim, 0, sizeof(Simulation));
+    cursor.pos = text;
+    cursor.end = text + length;
 
-    fscanf(fp, "%6s\n", string_sim_type);
+    if (next_token(&cursor, string_sim_type))
+        return LS_ERR_PARSE;
 
     if (strcasecmp("String", string_sim_type) == 0)
         sim->sim_type = STRING;
     else if (strcasecmp("Spring", string_sim_type) == 0)
         sim->sim_type = SPRING;
+    else if (strcasecmp("Membrane", string_sim_type) == 0)
+        sim->sim_type = MEMBRANE;
     else
+        return LS_ERR_PARSE;
+
+    if (sim->sim_type == MEMBRANE)
     {
-        fprintf(stderr, "Simulation type must be either string or spring.\n");
-        return 1;
+        if ((status = import_membrane(&cursor, allocator, sim)) == LS_OK
+                && (status = check_simulation(sim)) != LS_OK)
+            free_simulation(sim, allocator);
+        return status;
+    }
+
+    /* An optional Ring joins the last bead back to the first */
+    peek = cursor;
+    if (!next_token(&peek, token) && strcasecmp("Ring", token) == 0)
+    {
+        sim->periodic = true;
+        cursor = peek;
     }
 
     /* Scan in tension if it's a string simulation */
     if (sim->sim_type == STRING)
-        fscanf(fp, "%lf", &(sim->tension));
+        if (next_double(&cursor, &(sim->tension)))
+            return LS_ERR_PARSE;
+
+    if (next_int(&cursor, &(sim->num_beads)) || sim->num_beads == 0)
+        return LS_ERR_PARSE;
 
-    fscanf(fp, "%d", &(sim->num_beads));
-    
     /* Allocate memory for beads and connections */
-    sim->beads = calloc(sim->num_beads, sizeof(Bead));
-    if (sim->beads == NULL)
+    sim->beads = ls_calloc(allocator, sim->num_beads * sizeof(Bead));
+    sim->connections = ls_calloc(allocator,
+            (sim->num_beads + 1) * sizeof(double));
+    if (sim->beads == NULL || sim->connections == NULL)
     {
-        fprintf(stderr, "Failed to allocate memory for beads.\n");
-        return 1;
+        free_simulation(sim, allocator);
+        return LS_ERR_NOMEM;
     }
 
-    sim->connections = calloc(sim->num_beads + 1, sizeof(double));
-    if (sim->connections == NULL)
+    for (i = 0; i < sim->num_beads; i++)
     {
-        fprintf(stderr, "Failed to allocate memory for connections.\n");
-        return 1;
+        if (next_double(&cursor, &(sim->connections[i]))
+                || next_double(&cursor, &(sim->beads[i].mass))
+                || next_double(&cursor, &(sim->beads[i].x0))
+                || next_double(&cursor, &(sim->beads[i].v0)))
+        {
+            free_simulation(sim, allocator);
+            return LS_ERR_PARSE;
+        }
+    }
+
+    /* There's one more connection than bead; scan that in. A ring has as
+     * many connections as beads, since connection 0 also closes it. */
+    if (sim->periodic)
+        sim->connections[sim->num_beads] = sim->connections[0];
+    else if (next_double(&cursor, &(sim->connections[sim->num_beads])))
+    {
+        free_simulation(sim, allocator);
+        return LS_ERR_PARSE;
+    }
+
+    if ((status = check_simulation(sim)) != LS_OK)
+    {
+        free_simulation(sim, allocator);
+        return status;
     }
 
+    return LS_OK;
+}
+
+LsStatus check_simulation(const Simulation *sim)
+{
+    int i;
+
+    assert(sim != NULL);
+
+    if (sim->num_beads <= 0 || sim->beads == NULL)
+        return LS_ERR_INVALID;
+
     for (i = 0; i < sim->num_beads; i++)
+        if (!(sim->beads[i].mass > 0))
+            return LS_ERR_INVALID;
+
+    /* Membranes have no connections array; the frame is fixed */
+    if (sim->sim_type == MEMBRANE)
     {
-        fscanf(fp, "%lf", &(sim->connections[i]));
-        fscanf(fp, "%lf %lf %lf", &(sim->beads[i].mass),
-                &(sim->beads[i].x0),
-                &(sim->beads[i].v0));
+        if (!(sim->tension > 0) || !(sim->tension_y > 0)
+                || !(sim->spacing_x > 0) || !(sim->spacing_y > 0)
+                || sim->rows * sim->cols != sim->num_beads
+                || sim->num_modes <= 0 || sim->num_modes > sim->num_beads)
+            return LS_ERR_INVALID;
+        return LS_OK;
     }
 
-    /* There's one more connection than bead; scan that in */
-    fscanf(fp, "%lf", &(sim->connections[sim->num_beads]));
+    if (sim->connections == NULL)
+        return LS_ERR_INVALID;
 
-    fclose(fp);
+    if (sim->sim_type == STRING && !(sim->tension > 0))
+        return LS_ERR_INVALID;
 
-    printf("Finished importing data from %s\n\n", filename);
-    return 0;
+    /* A ring of one bead would only be joined to itself */
+    if (sim->periodic && (sim->num_beads < 2
+                || sim->connections[sim->num_beads] != sim->connections[0]))
+        return LS_ERR_INVALID;
+
+    /* Strings divide by the spacing; springs may have a missing spring */
+    for (i = 0; i <= sim->num_beads; i++)
+    {
+        if (sim->sim_type == STRING && !(sim->connections[i] > 0))
+            return LS_ERR_INVALID;
+        if (sim->sim_type == SPRING && !(sim->connections[i] >= 0))
+            return LS_ERR_INVALID;
+    }
+
+    return LS_OK;
 }
 
+void free_simulation(Simulation *sim, const LsAllocator *allocator)
+{
+    assert(sim != NULL);
+
+    ls_free(allocator, sim->beads);
+    ls_free(allocator, sim->connections);
+    sim->beads = NULL;
+    sim->connections = NULL;
+}
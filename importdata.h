@@ -6,12 +6,25 @@
 #ifndef IMPORTDATA_INCLUDED
 #define IMPORTDATA_INCLUDED
 
+#include <stddef.h>
 #include "types.h"
+#include "loadedstring.h"
 
-/* Given a simulation parameter file of the form described in
- * examplestringinput.txt or examplespringinput.txt, read in and store
- * simulation parameters into sim. Changes filename.
- * Returns 1 if an error occured, 0 otherwise */
-int import_data(char *filename, Simulation *sim);
+/* Internal to libloadedstring. */
+
+/* Given length bytes of simulation parameters of the form described in
+ * examplestringinput.txt, examplespringinput.txt or examplemembraneinput.txt,
+ * read in and store simulation parameters into sim, allocating from
+ * allocator. A string or spring whose type is followed by Ring is periodic
+ * and has no connection after its last bead. filename of sim is left empty.
+ * On failure nothing is left allocated. */
+LsStatus import_data(const char *text, size_t length,
+        const LsAllocator *allocator, Simulation *sim);
+
+/* Checks that the parameters of sim describe a system that can be solved */
+LsStatus check_simulation(const Simulation *sim);
+
+/* Frees all dynamically allocated parts of sim */
+void free_simulation(Simulation *sim, const LsAllocator *allocator);
 
 #endif
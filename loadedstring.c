@@ -0,0 +1,518 @@
+/*----------------------------------------------------------------------------*/
+/* loadedstring.c                                                             */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "loadedstring.h"
+#include "alloc.h"
+#include "importdata.h"
+#include "asolve.h"
+#include "update.h"
+#include "mapsolve.h"
+#include "plan.h"
+
+struct ls_system
+{
+    LsAllocator allocator; /* Everything below comes from here */
+    Simulation sim;
+};
+
+struct ls_solution
+{
+    LsAllocator allocator; /* Everything below comes from here */
+    Result result;
+    Mapping map; /* Eigenvectors mapped from a file, from ls_solve_mapped */
+};
+
+struct ls_workspace
+{
+    LsAllocator allocator; /* Everything below comes from here */
+    Scratch *scratch;
+    Result result; /* Laid out in an arena after this struct */
+};
+
+const char *ls_strerror(LsStatus status)
+{
+    switch (status)
+    {
+        case LS_OK:
+            return "success";
+        case LS_ERR_INVALID:
+            return "invalid argument or simulation parameters";
+        case LS_ERR_NOMEM:
+            return "out of memory";
+        case LS_ERR_IO:
+            return "failed to read or write a file";
+        case LS_ERR_PARSE:
+            return "malformed simulation parameters";
+        case LS_ERR_SOLVER:
+            return "numerical solver failed";
+    }
+
+    return "unknown error";
+}
+
+LsStatus ls_system_parse(const char *text, size_t length,
+        const LsAllocator *allocator, LsSystem **system)
+{
+    LsAllocator a = ls_allocator_or_default(allocator);
+    LsSystem *sys;
+    LsStatus status;
+
+    if (text == NULL || system == NULL)
+        return LS_ERR_INVALID;
+
+    sys = ls_alloc(&a, sizeof(LsSystem));
+    if (sys == NULL)
+        return LS_ERR_NOMEM;
+    sys->allocator = a;
+
+    if ((status = import_data(text, length, &a, &sys->sim)) != LS_OK)
+    {
+        ls_free(&a, sys);
+        return status;
+    }
+
+    *system = sys;
+
+    return LS_OK;
+}
+
+LsStatus ls_system_load(const char *filename, const LsAllocator *allocator,
+        LsSystem **system)
+{
+    LsAllocator a = ls_allocator_or_default(allocator);
+    FILE *fp;
+    char *text;
+    long length;
+    LsStatus status;
+
+    if (filename == NULL || system == NULL
+            || strlen(filename) >= sizeof((*system)->sim.filename))
+        return LS_ERR_INVALID;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        return LS_ERR_IO;
+
+    if (fseek(fp, 0, SEEK_END) || (length = ftell(fp)) < 0
+            || fseek(fp, 0, SEEK_SET))
+    {
+        fclose(fp);
+        return LS_ERR_IO;
+    }
+
+    text = ls_alloc(&a, length);
+    if (text == NULL)
+    {
+        fclose(fp);
+        return LS_ERR_NOMEM;
+    }
+
+    if (fread(text, 1, length, fp) != (size_t)length)
+    {
+        ls_free(&a, text);
+        fclose(fp);
+        return LS_ERR_IO;
+    }
+    fclose(fp);
+
+    status = ls_system_parse(text, length, &a, system);
+    ls_free(&a, text);
+    if (status != LS_OK)
+        return status;
+
+    strcpy((*system)->sim.filename, filename);
+    if (strrchr((*system)->sim.filename, '.') != NULL)
+        *strrchr((*system)->sim.filename, '.') = '\0';
+
+    return LS_OK;
+}
+
+const Simulation *ls_system_simulation(const LsSystem *system)
+{
+    assert(system != NULL);
+
+    return &system->sim;
+}
+
+LsStatus ls_system_set_bead(LsSystem *system, int bead, Bead value)
+{
+    Bead old;
+    LsStatus status;
+
+    if (system == NULL || bead < 0 || bead >= system->sim.num_beads)
+        return LS_ERR_INVALID;
+
+    old = system->sim.beads[bead];
+    system->sim.beads[bead] = value;
+    if ((status = check_simulation(&system->sim)) != LS_OK)
+        system->sim.beads[bead] = old;
+
+    return status;
+}
+
+LsStatus ls_system_set_connection(LsSystem *system, int connection,
+        double value)
+{
+    double old;
+    LsStatus status;
+
+    if (system == NULL || system->sim.sim_type == MEMBRANE || connection < 0
+            || connection > system->sim.num_beads)
+        return LS_ERR_INVALID;
+
+    /* Connection 0 of a ring is also the one after its last bead */
+    if (system->sim.periodic && connection == system->sim.num_beads)
+        connection = 0;
+
+    old = system->sim.connections[connection];
+    system->sim.connections[connection] = value;
+    if (system->sim.periodic && connection == 0)
+        system->sim.connections[system->sim.num_beads] = value;
+
+    if ((status = check_simulation(&system->sim)) != LS_OK)
+    {
+        system->sim.connections[connection] = old;
+        if (system->sim.periodic && connection == 0)
+            system->sim.connections[system->sim.num_beads] = old;
+    }
+
+    return status;
+}
+
+LsStatus ls_system_set_tension(LsSystem *system, double tension)
+{
+    if (system == NULL || system->sim.sim_type == SPRING || !(tension > 0))
+        return LS_ERR_INVALID;
+
+    system->sim.tension = tension;
+
+    return LS_OK;
+}
+
+void ls_system_free(LsSystem *system)
+{
+    LsAllocator a;
+
+    if (system == NULL)
+        return;
+
+    a = system->allocator;
+    free_simulation(&system->sim, &a);
+    ls_free(&a, system);
+}
+
+LsStatus ls_solve(const LsSystem *system, const LsAllocator *allocator,
+        LsSolution **solution)
+{
+    LsAllocator a = ls_allocator_or_default(allocator);
+    LsSolution *sol;
+    LsStatus status;
+
+    if (system == NULL || solution == NULL)
+        return LS_ERR_INVALID;
+
+    sol = ls_alloc(&a, sizeof(LsSolution));
+    if (sol == NULL)
+        return LS_ERR_NOMEM;
+    sol->allocator = a;
+    sol->map.base = NULL;
+
+    if ((status = asolve(&system->sim, &a, &sol->result)) != LS_OK)
+    {
+        ls_free(&a, sol);
+        return status;
+    }
+
+    *solution = sol;
+
+    return LS_OK;
+}
+
+LsStatus ls_solve_mapped(const LsSystem *system, const char *path,
+        size_t ram_budget, const LsAllocator *allocator,
+        LsSolution **solution)
+{
+    LsAllocator a = ls_allocator_or_default(allocator);
+    LsSolution *sol;
+    LsStatus status;
+
+    if (system == NULL || path == NULL || solution == NULL)
+        return LS_ERR_INVALID;
+
+    sol = ls_alloc(&a, sizeof(LsSolution));
+    if (sol == NULL)
+        return LS_ERR_NOMEM;
+    sol->allocator = a;
+
+    if ((status = mapsolve(&system->sim, path, ram_budget, &a, &sol->result,
+                    &sol->map)) != LS_OK)
+    {
+        ls_free(&a, sol);
+        return status;
+    }
+
+    *solution = sol;
+
+    return LS_OK;
+}
+
+LsStatus ls_plan(const LsSystem *system, unsigned needs, size_t memory_limit,
+        LsPlan *plan)
+{
+    if (system == NULL || plan == NULL)
+        return LS_ERR_INVALID;
+
+    return make_plan(&system->sim, needs, memory_limit, plan);
+}
+
+LsStatus ls_solve_planned(const LsSystem *system, const LsPlan *plan,
+        const char *path, size_t memory_limit, const LsAllocator *allocator,
+        LsSolution **solution)
+{
+    LsAllocator a = ls_allocator_or_default(allocator);
+    LsSolution *sol;
+    LsStatus status;
+
+    if (system == NULL || plan == NULL || solution == NULL
+            || (plan->mapped && path == NULL))
+        return LS_ERR_INVALID;
+
+    if (plan->mapped)
+        return ls_solve_mapped(system, path, memory_limit, allocator,
+                solution);
+
+    sol = ls_alloc(&a, sizeof(LsSolution));
+    if (sol == NULL)
+        return LS_ERR_NOMEM;
+    sol->allocator = a;
+    sol->map.base = NULL;
+
+    if ((status = solve_engine(&system->sim, plan->engine, plan->needs, &a,
+                    &sol->result)) != LS_OK)
+    {
+        ls_free(&a, sol);
+        return status;
+    }
+
+    *solution = sol;
+
+    return LS_OK;
+}
+
+const char *ls_engine_name(LsEngine engine)
+{
+    switch (engine)
+    {
+        case LS_ENGINE_DENSE:
+            return "dense";
+        case LS_ENGINE_CLOSED_FORM:
+            return "closed form";
+        case LS_ENGINE_BLOCH:
+            return "Bloch";
+        case LS_ENGINE_TRIDIAGONAL:
+            return "tridiagonal";
+        case LS_ENGINE_LANCZOS:
+            return "Lanczos";
+        default:
+            return "unknown engine";
+    }
+}
+
+const Result *ls_solution_result(const LsSolution *solution)
+{
+    assert(solution != NULL);
+
+    return &solution->result;
+}
+
+void ls_solution_free(LsSolution *solution)
+{
+    LsAllocator a;
+
+    if (solution == NULL)
+        return;
+
+    a = solution->allocator;
+    if (solution->map.base != NULL)
+        free_mapped(&solution->result, &solution->map, &a);
+    else
+        free_result(&solution->result, &a);
+    ls_free(&a, solution);
+}
+
+/* Solves system from scratch into solution, replacing its result, for the
+ * parts the result holds: a result of eigenfrequencies alone, or without
+ * coefficients, is found again as such, so no eigenvectors are formed for it.
+ * The old result is kept if the solve fails. */
+static LsStatus resolve(const LsSystem *system, LsSolution *solution)
+{
+    unsigned needs = LS_NEED_ALL;
+    Result result;
+    LsPlan plan;
+    LsStatus status;
+
+    if (solution->result.eigenvectors == NULL)
+        needs = LS_NEED_FREQUENCIES;
+    else if (solution->result.coefficients == NULL)
+        needs = LS_NEED_FREQUENCIES | LS_NEED_VECTORS;
+    if ((status = make_plan(&system->sim, needs, SIZE_MAX, &plan)) != LS_OK
+            || (status = solve_engine(&system->sim, plan.engine, plan.needs,
+                    &solution->allocator, &result)) != LS_OK)
+        return status;
+
+    free_result(&solution->result, &solution->allocator);
+    solution->result = result;
+
+    return LS_OK;
+}
+
+/* Brings solution, the solution of system before change, up to date with
+ * system. Falls back to a full solve if the update is inaccurate. */
+static LsStatus update_solution(const LsSystem *system, LsSolution *solution,
+        Change change)
+{
+    LsStatus status;
+
+    /* The update works on the tridiagonal stiffness of a chain, from all of
+     * its old eigenvectors */
+    if (system->sim.sim_type == MEMBRANE || system->sim.periodic
+            || solution->result.coefficients == NULL)
+        return resolve(system, solution);
+
+    status = update_modes(&system->sim, change, &solution->allocator,
+            &solution->result);
+    if (status == LS_ERR_SOLVER)
+        status = resolve(system, solution);
+
+    return status;
+}
+
+LsStatus ls_update_bead(LsSystem *system, LsSolution *solution, int bead,
+        Bead value)
+{
+    Bead old;
+    Change change;
+    LsStatus status;
+
+    if (system == NULL || solution == NULL
+            || solution->result.num_beads != system->sim.num_beads
+            || solution->map.base != NULL)
+        return LS_ERR_INVALID;
+    if (bead < 0 || bead >= system->sim.num_beads)
+        return LS_ERR_INVALID;
+
+    old = system->sim.beads[bead];
+    if ((status = ls_system_set_bead(system, bead, value)) != LS_OK)
+        return status;
+
+    change.mass = true;
+    change.index = bead;
+    change.old_value = old.mass;
+
+    /* Only the coefficients depend on the initial conditions */
+    if (value.mass == old.mass && solution->result.coefficients == NULL)
+        status = LS_OK;
+    else if (value.mass == old.mass && system->sim.sim_type != MEMBRANE)
+        status = update_coefficients(&system->sim, &solution->allocator,
+                &solution->result);
+    else
+        status = update_solution(system, solution, change);
+
+    if (status != LS_OK)
+        system->sim.beads[bead] = old;
+
+    return status;
+}
+
+LsStatus ls_update_connection(LsSystem *system, LsSolution *solution,
+        int connection, double value)
+{
+    double old;
+    Change change;
+    LsStatus status;
+
+    if (system == NULL || solution == NULL
+            || solution->result.num_beads != system->sim.num_beads
+            || solution->map.base != NULL
+            || system->sim.sim_type == MEMBRANE)
+        return LS_ERR_INVALID;
+    if (connection < 0 || connection > system->sim.num_beads)
+        return LS_ERR_INVALID;
+
+    old = system->sim.connections[connection];
+    if ((status = ls_system_set_connection(system, connection, value))
+            != LS_OK)
+        return status;
+
+    change.mass = false;
+    change.index = connection;
+    change.old_value = old;
+
+    if ((status = update_solution(system, solution, change)) != LS_OK)
+        ls_system_set_connection(system, connection, old);
+
+    return status;
+}
+
+LsStatus ls_workspace_create(int num_beads, const LsAllocator *allocator,
+        LsWorkspace **workspace)
+{
+    LsAllocator a = ls_allocator_or_default(allocator);
+    LsWorkspace *ws;
+
+    if (num_beads <= 0 || workspace == NULL)
+        return LS_ERR_INVALID;
+
+    ws = ls_alloc(&a, sizeof(LsWorkspace)
+            + result_size(num_beads, num_beads));
+    if (ws == NULL)
+        return LS_ERR_NOMEM;
+    ws->allocator = a;
+
+    if ((ws->scratch = alloc_scratch(num_beads, &a)) == NULL)
+    {
+        ls_free(&a, ws);
+        return LS_ERR_NOMEM;
+    }
+    layout_result(ws + 1, num_beads, num_beads, &ws->result);
+
+    *workspace = ws;
+
+    return LS_OK;
+}
+
+LsStatus ls_workspace_solve(LsWorkspace *workspace, const LsSystem *system,
+        const Result **result)
+{
+    LsStatus status;
+
+    if (workspace == NULL || system == NULL || result == NULL)
+        return LS_ERR_INVALID;
+
+    if ((status = solve_with(&system->sim, workspace->scratch,
+                    &workspace->result)) != LS_OK)
+        return status;
+
+    *result = &workspace->result;
+
+    return LS_OK;
+}
+
+void ls_workspace_free(LsWorkspace *workspace)
+{
+    LsAllocator a;
+
+    if (workspace == NULL)
+        return;
+
+    a = workspace->allocator;
+    free_scratch(workspace->scratch, &a);
+    ls_free(&a, workspace);
+}
@@ -0,0 +1,321 @@
+/*----------------------------------------------------------------------------*/
+/* loadedstring.h                                                             */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef LOADEDSTRING_INCLUDED
+#define LOADEDSTRING_INCLUDED
+
+#include <stddef.h>
+#include "types.h"
+
+#define LS_BATCH_MAX_BEADS 16 /* Largest systems ls_batch_solve takes */
+
+/* libloadedstring: solves loaded strings and mass-spring coupled oscillators.
+ *
+ * A system is parsed into an LsSystem and solved into an LsSolution. Both are
+ * opaque handles; their contents are read through ls_system_simulation and
+ * ls_solution_result. Every function that can fail returns an LsStatus. All
+ * memory comes from the LsAllocator given when a handle is created, or from
+ * malloc and free if it is NULL, except for GSL's O(N) eigensolver and FFT
+ * workspaces, which GSL always takes from malloc. Nothing is printed.
+ *
+ * Functions may be called concurrently from multiple threads as long as no
+ * handle is used by two threads at once while one of them modifies it.
+ *
+ * GSL's default error handler aborts the process. The first solve or
+ * ls_workspace_create therefore calls gsl_set_error_handler_off() once, for
+ * the whole process, and never restores the previous handler; GSL errors are
+ * reported as LS_ERR_SOLVER instead. A program that wants its own handler
+ * may install it after that, as long as the handler returns. */
+
+typedef enum ls_status
+{
+    LS_OK = 0,
+    LS_ERR_INVALID, /* Invalid argument or simulation parameters */
+    LS_ERR_NOMEM, /* The allocator returned NULL */
+    LS_ERR_IO, /* A file could not be opened, read or written */
+    LS_ERR_PARSE, /* The simulation parameter text is malformed */
+    LS_ERR_SOLVER /* A numerical routine failed */
+} LsStatus;
+
+typedef struct ls_allocator
+{
+    void *(*alloc)(size_t size, void *ctx); /* Returns NULL on failure */
+    void (*free)(void *ptr, void *ctx); /* Must accept NULL */
+    void *ctx; /* Passed to alloc and free */
+} LsAllocator;
+
+typedef struct ls_system LsSystem;
+typedef struct ls_solution LsSolution;
+typedef struct ls_workspace LsWorkspace;
+typedef struct ls_batch LsBatch;
+typedef struct ls_probe LsProbe;
+
+typedef enum ls_quantity
+{
+    LS_DISPLACEMENT, /* Displacement of the bead, in m */
+    LS_VELOCITY, /* Velocity of the bead, in m/s */
+    LS_ENERGY /* Kinetic energy of the bead plus half the potential energy of
+                 each connection it shares with another bead, and all of the
+                 potential energy of a connection to a wall, in J. Summed over
+                 all beads this is the total energy. */
+} LsQuantity;
+
+typedef struct ls_response_options
+{
+    const double *damping; /* Array of num_beads damping coefficients in
+                              kg/s, none negative; bead i feels a force
+                              -damping[i] v_i. NULL for no damping. */
+    int drive_bead; /* Zero indexed bead driven by the force F cos(w t) */
+    double force; /* Amplitude F of the driving force, in N */
+    int num_threads; /* Threads the frequencies are split between. 0 uses one
+                        per processor. */
+} LsResponseOptions;
+
+typedef struct ls_query
+{
+    int bead; /* Zero indexed */
+    double t; /* Time, in s */
+} LsQuery;
+
+/* Parts of a solution a caller needs, or'ed together. The coefficients are
+ * projections onto the eigenvectors, so asking for them asks for the
+ * eigenvectors too. */
+typedef enum ls_need
+{
+    LS_NEED_FREQUENCIES = 1,
+    LS_NEED_VECTORS = 2,
+    LS_NEED_COEFFICIENTS = 4,
+    LS_NEED_ALL = 7
+} LsNeed;
+
+/* Ways of solving a system */
+typedef enum ls_engine
+{
+    LS_ENGINE_DENSE, /* Dense symmetric eigensolver, any chain or ring */
+    LS_ENGINE_CLOSED_FORM, /* Sine modes of uniform chains */
+    LS_ENGINE_BLOCH, /* One block per wavenumber, for rings of repeated
+                        cells */
+    LS_ENGINE_TRIDIAGONAL, /* QL iteration and inverse iteration on the
+                              tridiagonal matrix of a chain, falling back to
+                              the dense solver if a vector fails its residual
+                              or orthogonality check */
+    LS_ENGINE_LANCZOS, /* Sparse solver for the lowest modes of membranes */
+    LS_NUM_ENGINES
+} LsEngine;
+
+typedef struct ls_plan
+{
+    LsEngine engine; /* Engine that will solve the system */
+    unsigned needs; /* LsNeed flags the solution will provide, at least
+                       those asked for */
+    bool mapped; /* True if the eigenvectors don't fit in the memory limit
+                    and will be written to a file and mapped */
+    double flops[LS_NUM_ENGINES]; /* Predicted floating point operations of
+                                     each engine, or -1 if it can't solve the
+                                     system */
+    double bytes[LS_NUM_ENGINES]; /* Predicted peak memory of each engine
+                                     solving in memory, in bytes, or of the
+                                     chosen engine if mapped */
+} LsPlan;
+
+/* Returns a description of status */
+const char *ls_strerror(LsStatus status);
+
+/* Parses length bytes of simulation parameters, in the format described in
+ * examplestringinput.txt, examplespringinput.txt or
+ * examplemembraneinput.txt, into a new system. */
+LsStatus ls_system_parse(const char *text, size_t length,
+        const LsAllocator *allocator, LsSystem **system);
+
+/* Reads the simulation parameter file filename into a new system. The
+ * Simulation's filename is set to filename without its extension. */
+LsStatus ls_system_load(const char *filename, const LsAllocator *allocator,
+        LsSystem **system);
+
+/* Returns the simulation parameters of system */
+const Simulation *ls_system_simulation(const LsSystem *system);
+
+/* Replaces bead number bead (zero indexed) of system */
+LsStatus ls_system_set_bead(LsSystem *system, int bead, Bead value);
+
+/* Replaces connection number connection (zero indexed, 0 is the left wall)
+ * of a string or spring system. In a ring, connection 0 joins the last bead
+ * back to the first, and num_beads names it too. */
+LsStatus ls_system_set_connection(LsSystem *system, int connection,
+        double value);
+
+/* Replaces the tension of a string system, or the tension along rows of a
+ * membrane */
+LsStatus ls_system_set_tension(LsSystem *system, double tension);
+
+/* Frees system and everything it owns. Accepts NULL. */
+void ls_system_free(LsSystem *system);
+
+/* Finds the normal modes of system and the coefficients that satisfy its
+ * initial conditions, with the cheapest engine ls_plan finds. Membranes are
+ * solved for their lowest num_modes modes with a sparse solver; their
+ * coefficients are the projection of the initial conditions onto those
+ * modes. */
+LsStatus ls_solve(const LsSystem *system, const LsAllocator *allocator,
+        LsSolution **solution);
+
+/* Solves system like ls_solve, for eigenvectors too large to keep in memory:
+ * they are written to the file path, created or truncated, and mapped
+ * read-only into the eigenvectors of the result, whose tile_rows says how many
+ * rows to read at a time. No more than ram_budget bytes are allocated while
+ * solving, including the O(N) rest of the result. Chains that aren't uniform
+ * are solved mode by mode from their tridiagonal dynamical matrix, which is
+ * slower than ls_solve for small systems; LS_ERR_NOMEM is returned if a
+ * cluster of close eigenvalues needs more vectors kept than the budget
+ * allows, and LS_ERR_SOLVER if a vector fails its residual or orthogonality
+ * check. Rings and membranes are not supported. The solution can't be
+ * updated with ls_update_bead or ls_update_connection. The file is left in
+ * place when the solution is freed. */
+LsStatus ls_solve_mapped(const LsSystem *system, const char *path,
+        size_t ram_budget, const LsAllocator *allocator,
+        LsSolution **solution);
+
+/* Predicts the cost of each engine that can solve system for the parts of
+ * the solution in needs, and picks the one with the fewest floating point
+ * operations among those that fit in memory_limit bytes (SIZE_MAX for no
+ * limit). Eigenfrequencies alone are found without eigenvectors by the
+ * closed form and tridiagonal engines. Eigenvectors without coefficients are
+ * left to ls_find_mode by the tridiagonal engine. If no engine fits but the
+ * eigenvectors of a chain could be written to a file, the plan is mapped
+ * instead. Returns LS_ERR_NOMEM if nothing fits. */
+LsStatus ls_plan(const LsSystem *system, unsigned needs, size_t memory_limit,
+        LsPlan *plan);
+
+/* Solves system as plan, from ls_plan for the same system, says. path names
+ * the file for the eigenvectors of a mapped plan, like ls_solve_mapped, and
+ * is ignored otherwise. If plan->needs lacks LS_NEED_VECTORS, the
+ * eigenvectors and coefficients of the result are NULL, and the solution
+ * can't be probed. If it has LS_NEED_VECTORS but not LS_NEED_COEFFICIENTS,
+ * the coefficients are NULL, the same goes for probes, and the eigenvectors
+ * may be found only as ls_find_mode asks for them. Updates of either solve
+ * the system again for the same needs. */
+LsStatus ls_solve_planned(const LsSystem *system, const LsPlan *plan,
+        const char *path, size_t memory_limit, const LsAllocator *allocator,
+        LsSolution **solution);
+
+/* Returns the name of engine */
+const char *ls_engine_name(LsEngine engine);
+
+/* Lets the operating system drop rows first to first + count - 1 of the
+ * eigenvectors of result from memory once they have been read. They are read
+ * back from the file if used again. Does nothing unless result->tile_rows is
+ * nonzero. */
+void ls_release_rows(const Result *result, int first, int count);
+
+/* Makes sure eigenvector mode (zero indexed) of result is in place, finding
+ * it by inverse iteration on the tridiagonal dynamical matrix, in O(N) time,
+ * if the solve left it out. It is written into the eigenvectors of result and
+ * kept for later calls, so result is usually a copy of the Result that
+ * ls_solution_result returns, sharing its eigenvectors. Returns LS_ERR_SOLVER
+ * if it isn't orthogonal to the modes found either side. Does nothing for
+ * results whose eigenvectors are all in place. Not safe to call for one
+ * result from two threads at once. */
+LsStatus ls_find_mode(Result *result, int mode);
+
+/* Returns the eigenfrequencies, eigenvectors and coefficients of solution */
+const Result *ls_solution_result(const LsSolution *solution);
+
+/* Frees solution and everything it owns. Accepts NULL. */
+void ls_solution_free(LsSolution *solution);
+
+/* Replaces bead number bead of system, like ls_system_set_bead, and updates
+ * solution, which must have been solved from system, to match. A new mass is
+ * a rank-one change of the eigenproblem: the eigenfrequencies are found from
+ * a secular equation, modes the change doesn't reach keep their eigenvectors,
+ * and the rest are found by inverse iteration on the new chain, in O(N^2)
+ * time. New initial conditions only recompute the coefficients. A solution
+ * without coefficients, planned for the eigenfrequencies alone or with
+ * eigenvectors left to ls_find_mode, is solved again for the same parts, so
+ * no eigenvectors are formed for it. If an updated mode fails its residual or
+ * orthogonality check, solution is solved again from scratch, as are
+ * membranes and rings. On failure the change is not applied to system;
+ * solution is unchanged unless the status is LS_ERR_NOMEM or LS_ERR_SOLVER,
+ * in which case it must be freed. */
+LsStatus ls_update_bead(LsSystem *system, LsSolution *solution, int bead,
+        Bead value);
+
+/* Replaces connection number connection of system, like
+ * ls_system_set_connection, and updates solution as ls_update_bead does. A
+ * new connection is also a rank-one change. */
+LsStatus ls_update_connection(LsSystem *system, LsSolution *solution,
+        int connection, double value);
+
+/* Creates a workspace holding all scratch and output buffers for solving
+ * systems of num_beads beads. Solving many systems of the same size through
+ * one workspace does no allocation after this. */
+LsStatus ls_workspace_create(int num_beads, const LsAllocator *allocator,
+        LsWorkspace **workspace);
+
+/* Solves system into workspace, which must be sized for its number of beads.
+ * *result points into the workspace and is valid until the next solve with
+ * it or until it is freed. Membranes are solved by ls_solve only. */
+LsStatus ls_workspace_solve(LsWorkspace *workspace, const LsSystem *system,
+        const Result **result);
+
+/* Frees workspace and everything it owns. Accepts NULL. */
+void ls_workspace_free(LsWorkspace *workspace);
+
+/* Creates a batch holding all scratch and output buffers for solving up to
+ * capacity string or spring systems of num_beads beads together, where
+ * num_beads is at most LS_BATCH_MAX_BEADS. */
+LsStatus ls_batch_create(int num_beads, int capacity,
+        const LsAllocator *allocator, LsBatch **batch);
+
+/* Solves the count systems in sims, each of the batch's number of beads, at
+ * once, without the per-system overhead of ls_solve: systems are taken eight
+ * at a time and diagonalized by a kernel compiled for their size and
+ * vectorized across them, implicit QL for chains and Jacobi rotations for
+ * rings. *results points to an array of count
+ * results, in the order of sims, valid until the next solve with batch or
+ * until it is freed. Degenerate modes may come out as a different basis of
+ * their eigenspace than ls_solve gives. */
+LsStatus ls_batch_solve(LsBatch *batch, const Simulation *sims, int count,
+        const Result **results);
+
+/* Frees batch and everything it owns. Accepts NULL. */
+void ls_batch_free(LsBatch *batch);
+
+/* Finds the steady-state response of the damped string or spring system,
+ * driven as described by opts, at each of count driving frequencies (in
+ * rad/s). Bead i then moves as Re(X e^(i w t)), where X solves
+ * (K - w^2 M + i w C) X = F e_drive_bead. The matrix is tridiagonal, so each
+ * frequency is one O(N) complex Thomas solve; no modes are needed. The real
+ * and imaginary parts of X for bead i at frequency k are stored in
+ * response[2 (k num_beads + i)] and the entry after it, the layout of an
+ * array of C99 double complex. Returns LS_ERR_INVALID if any damping is
+ * negative, and LS_ERR_SOLVER if the matrix is singular at some frequency,
+ * which needs an undamped resonance. Rings, whose matrix isn't tridiagonal,
+ * are not supported. */
+LsStatus ls_frequency_response(const LsSystem *system,
+        const LsResponseOptions *opts, const double *frequencies, size_t count,
+        const LsAllocator *allocator, double *response);
+
+/* Creates a probe that evaluates the motion of single beads of the solved
+ * system sim at arbitrary times, without synthesizing whole frames. Only the
+ * modes with a nonzero coefficient are kept, so a query costs time
+ * proportional to their number. The probe keeps no reference to sim or
+ * result, unless the eigenvectors of result are mapped from a file: then the
+ * rows each block of queries needs are read in place, so the solution must
+ * outlive the probe, and one probe can't be evaluated from two threads at
+ * once. */
+LsStatus ls_probe_create(const Simulation *sim, const Result *result,
+        const LsAllocator *allocator, LsProbe **probe);
+
+/* Evaluates quantity for each of count queries and stores it in values, an
+ * array of count doubles. Queries are evaluated in blocks so that large
+ * batches are cheaper per query than single calls. LS_ENERGY is not available
+ * for membranes. */
+LsStatus ls_probe_eval(const LsProbe *probe, LsQuantity quantity,
+        const LsQuery *queries, size_t count, double *values);
+
+/* Frees probe. Accepts NULL. */
+void ls_probe_free(LsProbe *probe);
+
+#endif
@@ -0,0 +1,116 @@
+/*----------------------------------------------------------------------------*/
+/* lod.c                                                                      */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lod.h"
+
+bool lod_needed(int num_points, int num_columns)
+{
+    return num_points > num_columns;
+}
+
+int lod_init(Lod *lod, const double *x, const double *sizes, int num_points,
+        int num_columns, int max_beads)
+{
+    double span;
+    int i, k, col, prev = -1, stride;
+
+    assert(lod != NULL);
+    assert(x != NULL);
+    assert(sizes != NULL);
+    assert(num_points > 0 && num_columns > 0 && max_beads > 0);
+
+    memset(lod, 0, sizeof(Lod));
+    lod->num_points = num_points;
+    lod->column_start = malloc((num_columns + 1) * sizeof(int));
+    lod->line_index = malloc(4 * (size_t)num_columns * sizeof(int));
+    lod->bead_index = malloc(max_beads * sizeof(int));
+    if (lod->column_start == NULL || lod->line_index == NULL
+            || lod->bead_index == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory.\n");
+        lod_free(lod);
+        return 1;
+    }
+
+    /* Points sharing a pixel column are contiguous, since x ascends */
+    span = x[num_points - 1] - x[0];
+    for (i = 0; i < num_points; i++)
+    {
+        col = span > 0 ? (int)((x[i] - x[0]) / span * num_columns) : 0;
+        if (col >= num_columns)
+            col = num_columns - 1;
+        if (col != prev)
+            lod->column_start[lod->num_columns++] = i;
+        prev = col;
+    }
+    lod->column_start[lod->num_columns] = num_points;
+
+    /* The largest bead of each run of stride points stands for the run.
+     * Points without a size, like the endpoints, are never markers. */
+    stride = (num_points + max_beads - 1) / max_beads;
+    for (i = 0; i < num_points; i += stride)
+    {
+        int best = i;
+
+        for (k = i + 1; k < i + stride && k < num_points; k++)
+            if (sizes[k] > sizes[best])
+                best = k;
+        if (sizes[best] > 0)
+            lod->bead_index[lod->num_beads++] = best;
+    }
+
+    return 0;
+}
+
+int lod_reduce(Lod *lod, const double *y)
+{
+    int c, i, k, count;
+
+    assert(lod != NULL);
+    assert(y != NULL);
+
+    lod->num_line = 0;
+    for (c = 0; c < lod->num_columns; c++)
+    {
+        int start = lod->column_start[c], end = lod->column_start[c + 1];
+        int keep[4], lo = start, hi = start;
+
+        for (i = start + 1; i < end; i++)
+        {
+            if (y[i] < y[lo])
+                lo = i;
+            if (y[i] > y[hi])
+                hi = i;
+        }
+
+        /* First, lowest, highest and last, in order and without repeats */
+        keep[0] = start;
+        keep[1] = lo < hi ? lo : hi;
+        keep[2] = lo < hi ? hi : lo;
+        keep[3] = end - 1;
+        for (k = 0, count = 0; k < 4; k++)
+            if (count == 0 || keep[k] != lod->line_index[lod->num_line
+                    + count - 1])
+                lod->line_index[lod->num_line + count++] = keep[k];
+        lod->num_line += count;
+    }
+
+    return lod->num_line;
+}
+
+void lod_free(Lod *lod)
+{
+    assert(lod != NULL);
+
+    free(lod->column_start);
+    free(lod->bead_index);
+    free(lod->line_index);
+    memset(lod, 0, sizeof(Lod));
+}
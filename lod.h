@@ -0,0 +1,50 @@
+/*----------------------------------------------------------------------------*/
+/* lod.h                                                                      */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef LOD_INCLUDED
+#define LOD_INCLUDED
+
+#include <stdbool.h>
+
+/* Reduces frames of a chain drawn as a line through its points to what a plot
+ * num_columns pixels wide can show. The points of each pixel column are
+ * replaced by the first, lowest, highest and last of them, in their original
+ * order, so the line still reaches every peak and enters and leaves each
+ * column where the full line does. Beads are drawn as markers for at most
+ * max_beads of the points, the largest of each run of neighbours. A reduced
+ * frame is then at most 4 num_columns line points and max_beads markers,
+ * however many points the chain has. The points must have ascending x, which
+ * stays fixed while their y changes from frame to frame. */
+typedef struct lod
+{
+    int num_points; /* Number of points in a full frame */
+    int num_columns; /* Number of pixel columns holding at least one point */
+    int *column_start; /* Array of num_columns + 1 indices: column c holds
+                          points column_start[c] to column_start[c + 1] - 1 */
+    int num_beads; /* Number of points drawn as markers */
+    int *bead_index; /* Array of num_beads indices of those points */
+    int num_line; /* Number of points in the last reduced line */
+    int *line_index; /* Array of up to 4 num_columns indices of the points
+                        on the last reduced line */
+} Lod;
+
+/* Returns true if frames of num_points points are worth reducing for a plot
+ * num_columns pixels wide: there are more points than columns */
+bool lod_needed(int num_points, int num_columns);
+
+/* Builds a Lod for frames of num_points points at positions x, ascending,
+ * with marker sizes sizes, for a plot num_columns pixels wide showing at most
+ * max_beads markers. Returns 1 if an error occured, 0 otherwise. */
+int lod_init(Lod *lod, const double *x, const double *sizes, int num_points,
+        int num_columns, int max_beads);
+
+/* Reduces the frame y, an array of num_points displacements, to the points of
+ * its line, stored in lod->line_index. Returns lod->num_line. */
+int lod_reduce(Lod *lod, const double *y);
+
+/* Frees all dynamically allocated parts of lod. */
+void lod_free(Lod *lod);
+
+#endif
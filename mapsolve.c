@@ -0,0 +1,642 @@
+/*----------------------------------------------------------------------------*/
+/* mapsolve.c                                                                 */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "mapsolve.h"
+#include "asolve.h"
+#include "tridiag.h"
+#include "alloc.h"
+
+/* What ls_find_mode needs to find the eigenvectors of a chain one at a time,
+ * in one block from the result's allocator */
+struct lazy_modes
+{
+    LsAllocator allocator;
+    int n;
+    double scale; /* Largest eigenvalue */
+    double *diag, *offdiag; /* Tridiagonal dynamical matrix */
+    double *eval; /* Eigenvalues, ascending */
+    double *mass, *sqrtm; /* Masses and their square roots */
+    double *work; /* 6 N doubles for tridiag_eigenvector */
+    bool *found; /* found[j] is true once eigenvector j is in place */
+};
+
+/* Writes size bytes of buf to fd at offset. Returns 1 if an error occured, 0
+ * otherwise. */
+static int write_at(int fd, const void *buf, size_t size, off_t offset)
+{
+    const char *pos = buf;
+
+    while (size > 0)
+    {
+        ssize_t done = pwrite(fd, pos, size, offset);
+
+        if (done < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        pos += done;
+        size -= done;
+        offset += done;
+    }
+
+    return 0;
+}
+
+/* Writes the eigenvectors of sim, a uniform chain, to fd tile rows at a time
+ * through buffer, and fills in the rest of result. sines holds 2 (N + 1)
+ * doubles. Same closed form as find_uniform_modes in asolve.c. Returns 1 if a
+ * write failed, 3 if memory ran out, 0 otherwise. */
+static int write_uniform(const Simulation *sim, int fd, int tile,
+        double *buffer, double *sines, Result *result)
+{
+    int n = sim->num_beads;
+    double scale;
+    int i, j, first;
+
+    scale = sqrt(2.0 / (n + 1));
+    for (i = 0; i < 2 * (n + 1); i++)
+        sines[i] = scale * sin(M_PI * i / (n + 1));
+
+    find_uniform_frequencies(sim, result->eigenfrequencies);
+
+    for (first = 0; first < n; first += tile)
+    {
+        int rows = n - first < tile ? n - first : tile;
+
+        for (i = first; i < first + rows; i++)
+        {
+            double *row = buffer + (size_t)(i - first) * n;
+
+            for (j = 0; j < n; j++)
+                row[j] = sines[(size_t)(i + 1) * (j + 1) % (2 * (n + 1))];
+        }
+
+        if (write_at(fd, buffer, (size_t)rows * n * sizeof(double),
+                    (off_t)first * n * sizeof(double)))
+            return 1;
+    }
+
+    result->sine_modes = true;
+
+    /* The table is done with, and becomes the transform's data */
+    return uniform_coefficients(sim, sines, NULL, NULL, result) ? 3 : 0;
+}
+
+/* Returns the dot product of the n entries of u and v */
+static double dot(const double *u, const double *v, int n)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        sum += u[i] * v[i];
+
+    return sum;
+}
+
+/* Fills diag and offdiag with the tridiagonal dynamical matrix of sim, a
+ * chain, and eval and frequencies, arrays of N doubles, with its eigenvalues
+ * and the eigenfrequencies. work holds N doubles. Returns 1 if QL iteration
+ * failed, 0 otherwise. */
+static int find_eigenvalues(const Simulation *sim, double *diag,
+        double *offdiag, double *work, double *eval, double *frequencies)
+{
+    int n = sim->num_beads;
+    double scale;
+    int j;
+
+    chain_tridiagonal(sim, diag, offdiag);
+    if (tridiag_eigenvalues(diag, offdiag, n, work, eval))
+        return 1;
+
+    /* Clamp rounding errors of 0 as asolve does, which leaves the largest
+     * eigenvalue last */
+    scale = fmax(fabs(eval[0]), fabs(eval[n - 1]));
+    for (j = 0; j < n; j++)
+    {
+        if (eval[j] < ZERO_EIGENVALUE_TOL * scale)
+            eval[j] = 0;
+        frequencies[j] = sqrt(eval[j]);
+    }
+
+    return 0;
+}
+
+/* Writes the eigenvectors of sim, a chain, to fd tile modes at a time, or
+ * straight into the eigenvectors of result if fd is negative, and fills in
+ * the rest of result. Each mode is found by inverse iteration on the
+ * tridiagonal dynamical matrix as a unit vector z, then scaled by M^-1/2,
+ * normalized and signed as fix_sign does into column jj of buffer, whose
+ * rows are written to the file as they are. The z of the tile are kept, with
+ * those of a cluster of close eigenvalues running off the end of the
+ * previous tile, so that clusters can be orthogonalized whole, and each z
+ * is checked to be orthogonal to the one before. They start with room for
+ * tile vectors, and are grown for long clusters up to max_vectors. buffer
+ * holds tile x N doubles and work 10 N doubles. Returns 1 if a write failed,
+ * 2 if the eigensolver failed or a check did, 3 if a cluster didn't fit in
+ * max_vectors or allocator ran out of memory, 0 otherwise. */
+static int write_general(const Simulation *sim, int fd, int tile,
+        double *buffer, int max_vectors, const LsAllocator *allocator,
+        double *work, Result *result)
+{
+    int n = sim->num_beads;
+    double *diag = work, *offdiag = work + n, *eval = work + 2 * n;
+    double *sqrtm = work + 3 * n, *iwork = work + 4 * n;
+    const double **cluster;
+    double *zbuf, scale;
+    int capacity = tile, carried = 0, modes, first, i, j, jj, c;
+
+    cluster = ls_alloc(allocator, (size_t)capacity
+            * (sizeof(double *) + n * sizeof(double)));
+    if (cluster == NULL)
+        return 3;
+    zbuf = (double *)(cluster + capacity);
+
+    if (find_eigenvalues(sim, diag, offdiag, iwork, eval,
+                result->eigenfrequencies))
+    {
+        ls_free(allocator, cluster);
+        return 2;
+    }
+    scale = eval[n - 1];
+
+    for (i = 0; i < n; i++)
+        sqrtm[i] = sqrt(sim->beads[i].mass);
+
+    for (first = 0; first < n; first += modes)
+    {
+        /* A cluster filling every kept vector needs room for more */
+        if (carried == capacity)
+        {
+            int grown = capacity > max_vectors / 2 ? max_vectors
+                : 2 * capacity;
+            const double **bigger;
+
+            if (grown <= capacity || (bigger = ls_alloc(allocator,
+                            (size_t)grown * (sizeof(double *)
+                                + n * sizeof(double)))) == NULL)
+            {
+                ls_free(allocator, cluster);
+                return 3;
+            }
+            memcpy(bigger + grown, zbuf, (size_t)carried * n
+                    * sizeof(double));
+            ls_free(allocator, cluster);
+            cluster = bigger;
+            zbuf = (double *)(cluster + grown);
+            capacity = grown;
+        }
+
+        modes = n - first;
+        if (modes > tile)
+            modes = tile;
+        if (modes > capacity - carried)
+            modes = capacity - carried;
+
+        for (jj = 0; jj < modes; jj++)
+        {
+            double *z = zbuf + (size_t)(carried + jj) * n;
+            double mag = 0, a = 0, b = 0;
+
+            j = first + jj;
+            c = cluster_size(eval, j - 1, carried + jj, eval[j], scale);
+            for (i = 0; i < c; i++)
+                cluster[i] = zbuf + (size_t)(carried + jj - c + i) * n;
+
+            if (tridiag_eigenvector(diag, offdiag, n, eval[j], scale,
+                        cluster, c, j, iwork, z)
+                    || (carried + jj > 0 && fabs(dot(z - n, z, n))
+                        > ORTHO_TOL))
+            {
+                ls_free(allocator, cluster);
+                return 2;
+            }
+
+            /* x = M^-1/2 z, normalized. Then the coefficients are
+             * (x . M x0) / (x . M x) = (z . M^1/2 x0) |x| */
+            for (i = 0; i < n; i++)
+                mag += z[i] * z[i] / sim->beads[i].mass;
+            mag = sqrt(mag);
+
+            for (i = 0; i < n; i++)
+            {
+                buffer[(size_t)i * modes + jj] = z[i] / sqrtm[i] / mag;
+                a += z[i] * sqrtm[i] * sim->beads[i].x0;
+                b += z[i] * sqrtm[i] * sim->beads[i].v0;
+            }
+            if (largest_sign(buffer + jj, n, modes) < 0)
+            {
+                for (i = 0; i < n; i++)
+                    buffer[(size_t)i * modes + jj] *= -1;
+                a = -a;
+                b = -b;
+            }
+
+            result->coefficients[j].a = a * mag;
+            result->coefficients[j].b = b * mag;
+            if (result->eigenfrequencies[j] > 0)
+                result->coefficients[j].b /= result->eigenfrequencies[j];
+        }
+
+        for (i = 0; i < n; i++)
+            if (fd < 0)
+                memcpy(result->eigenvectors[i] + first,
+                        buffer + (size_t)i * modes, modes * sizeof(double));
+            else if (write_at(fd, buffer + (size_t)i * modes,
+                        modes * sizeof(double),
+                        ((off_t)i * n + first) * sizeof(double)))
+            {
+                ls_free(allocator, cluster);
+                return 1;
+            }
+
+        /* Keep the whole of a cluster that the next tile continues, and at
+         * least the last vector, to check the next against */
+        if (first + modes < n)
+        {
+            c = cluster_size(eval, first + modes - 1, carried + modes,
+                    eval[first + modes], scale);
+            if (c == 0)
+                c = 1;
+            memmove(zbuf, zbuf + (size_t)(carried + modes - c) * n,
+                    (size_t)c * n * sizeof(double));
+            carried = c;
+        }
+    }
+
+    ls_free(allocator, cluster);
+
+    return 0;
+}
+
+/* Solves sim, a chain, for its eigenfrequencies, and lays out result so that
+ * ls_find_mode finds its eigenvectors as they are asked for. The
+ * coefficients are NULL, and the rows of modes not yet found hold whatever
+ * the allocator left there. */
+static LsStatus solve_lazy(const Simulation *sim,
+        const LsAllocator *allocator, Result *result)
+{
+    size_t n = sim->num_beads;
+    struct lazy_modes *lazy;
+    void *arena;
+    int i;
+
+    /* The eigenvector rows are left untouched until their modes are found,
+     * so a large arena costs little more than its row pointers */
+    arena = ls_alloc(allocator, result_size(n, n));
+    lazy = ls_alloc(allocator, sizeof(struct lazy_modes)
+            + 11 * n * sizeof(double) + n * sizeof(bool));
+    if (arena == NULL || lazy == NULL)
+    {
+        ls_free(allocator, arena);
+        ls_free(allocator, lazy);
+        return LS_ERR_NOMEM;
+    }
+
+    lazy->allocator = *allocator;
+    lazy->n = n;
+    lazy->diag = (double *)(lazy + 1);
+    lazy->offdiag = lazy->diag + n;
+    lazy->eval = lazy->offdiag + n;
+    lazy->mass = lazy->eval + n;
+    lazy->sqrtm = lazy->mass + n;
+    lazy->work = lazy->sqrtm + n;
+    lazy->found = (bool *)(lazy->work + 6 * n);
+
+    layout_result(arena, n, n, result);
+    result->coefficients = NULL;
+    if (find_eigenvalues(sim, lazy->diag, lazy->offdiag, lazy->work,
+                lazy->eval, result->eigenfrequencies))
+    {
+        ls_free(allocator, lazy);
+        free_result(result, allocator);
+        return LS_ERR_SOLVER;
+    }
+    lazy->scale = lazy->eval[n - 1];
+
+    for (i = 0; i < (int)n; i++)
+    {
+        lazy->mass[i] = sim->beads[i].mass;
+        lazy->sqrtm[i] = sqrt(lazy->mass[i]);
+        lazy->found[i] = false;
+    }
+    result->lazy = lazy;
+
+    return LS_OK;
+}
+
+LsStatus tdsolve(const Simulation *sim, unsigned needs,
+        const LsAllocator *allocator, Result *result)
+{
+    size_t n, tile;
+    void *arena;
+    double *work, *buffer;
+    int failed;
+
+    assert(sim != NULL);
+    assert(allocator != NULL);
+    assert(result != NULL);
+
+    if (sim->sim_type == MEMBRANE || sim->periodic)
+        return LS_ERR_INVALID;
+
+    n = sim->num_beads;
+    tile = n < TILE_MODES ? n : TILE_MODES;
+
+    /* The eigenvalues alone need no eigenvectors at all */
+    if (!(needs & (LS_NEED_VECTORS | LS_NEED_COEFFICIENTS)))
+    {
+        arena = ls_alloc(allocator, n * sizeof(double));
+        work = ls_alloc(allocator, 4 * n * sizeof(double));
+        if (arena == NULL || work == NULL)
+        {
+            ls_free(allocator, arena);
+            ls_free(allocator, work);
+            return LS_ERR_NOMEM;
+        }
+        layout_frequencies(arena, n, result);
+        failed = find_eigenvalues(sim, work, work + n, work + 2 * n,
+                work + 3 * n, result->eigenfrequencies);
+        ls_free(allocator, work);
+        if (failed)
+            free_result(result, allocator);
+        return failed ? LS_ERR_SOLVER : LS_OK;
+    }
+
+    if (!(needs & LS_NEED_COEFFICIENTS))
+        return solve_lazy(sim, allocator, result);
+
+    arena = ls_alloc(allocator, result_size(n, n));
+    work = ls_alloc(allocator, (10 + tile) * n * sizeof(double));
+    if (arena == NULL || work == NULL)
+    {
+        ls_free(allocator, arena);
+        ls_free(allocator, work);
+        return LS_ERR_NOMEM;
+    }
+    buffer = work + 10 * n;
+
+    /* The result already takes N^2, so clusters may grow to any size */
+    layout_result(arena, n, n, result);
+    failed = write_general(sim, -1, tile, buffer, n, allocator, work,
+            result);
+    ls_free(allocator, work);
+    if (failed)
+        free_result(result, allocator);
+
+    return failed == 3 ? LS_ERR_NOMEM : failed ? LS_ERR_SOLVER : LS_OK;
+}
+
+/* Returns the bytes of the O(N) part of a mapped result */
+static size_t mapped_result_size(size_t n)
+{
+    return n * (sizeof(double *) + sizeof(double) + sizeof(Coefficient));
+}
+
+size_t mapped_tile(int num_beads, size_t ram_budget)
+{
+    size_t n = num_beads;
+    size_t fixed = mapped_result_size(n) + 10 * n * sizeof(double);
+    size_t tile;
+
+    if (ram_budget < fixed)
+        return 0;
+
+    /* A row of the tile being written, and a vector kept for
+     * orthogonalization with its pointer */
+    tile = (ram_budget - fixed) / (2 * n * sizeof(double) + sizeof(double *));
+
+    return tile < n ? tile : n;
+}
+
+size_t mapped_size(int num_beads, size_t ram_budget)
+{
+    size_t n = num_beads;
+
+    return mapped_result_size(n) + 10 * n * sizeof(double)
+        + mapped_tile(num_beads, ram_budget)
+        * (2 * n * sizeof(double) + sizeof(double *));
+}
+
+LsStatus mapsolve(const Simulation *sim, const char *path, size_t ram_budget,
+        const LsAllocator *allocator, Result *result, Mapping *map)
+{
+    size_t n, row_size, size, tile;
+    char *arena;
+    void *base;
+    double *work, *buffer;
+    int fd, failed;
+    int i;
+
+    assert(sim != NULL);
+    assert(path != NULL);
+    assert(allocator != NULL);
+    assert(result != NULL);
+    assert(map != NULL);
+
+    if (sim->sim_type == MEMBRANE || sim->periodic)
+        return LS_ERR_INVALID;
+
+    n = sim->num_beads;
+    row_size = n * sizeof(double);
+    size = n * row_size;
+
+    tile = mapped_tile(n, ram_budget);
+    if (tile < 2 && tile < n)
+        return LS_ERR_INVALID;
+
+    /* Row pointers, eigenfrequencies and coefficients, then work and the
+     * tile being written. write_general adds the tile of vectors kept for
+     * orthogonalization. */
+    arena = ls_alloc(allocator, n * sizeof(double *) + n * sizeof(double)
+            + n * sizeof(Coefficient));
+    work = ls_alloc(allocator, (10 + tile) * row_size);
+    if (arena == NULL || work == NULL)
+    {
+        ls_free(allocator, arena);
+        ls_free(allocator, work);
+        return LS_ERR_NOMEM;
+    }
+    buffer = work + 10 * n;
+
+    result->num_beads = n;
+    result->num_modes = n;
+    result->eigenvectors = (double **)arena;
+    result->eigenfrequencies = (double *)(arena + n * sizeof(double *));
+    result->coefficients = (Coefficient *)(arena + n * sizeof(double *)
+            + n * sizeof(double));
+    result->sine_modes = false;
+    result->tile_rows = tile;
+    result->lazy = NULL;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0)
+        failed = 1;
+    else if (is_uniform(sim))
+        failed = write_uniform(sim, fd, tile, buffer, work, result);
+    else
+        failed = write_general(sim, fd, tile, buffer, tile, allocator, work,
+                result);
+    ls_free(allocator, work);
+
+    base = failed ? MAP_FAILED
+        : mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    if (base == MAP_FAILED)
+    {
+        ls_free(allocator, arena);
+        memset(result, 0, sizeof(Result));
+        return failed == 3 ? LS_ERR_NOMEM : failed == 2 ? LS_ERR_SOLVER
+            : LS_ERR_IO;
+    }
+
+    for (i = 0; i < (int)n; i++)
+        result->eigenvectors[i] = (double *)base + (size_t)i * n;
+
+    map->base = base;
+    map->size = size;
+
+    return LS_OK;
+}
+
+void free_mapped(Result *result, Mapping *map, const LsAllocator *allocator)
+{
+    assert(result != NULL);
+    assert(map != NULL);
+
+    if (map->base != NULL)
+        munmap(map->base, map->size);
+    memset(map, 0, sizeof(Mapping));
+
+    /* Everything else lives in the arena starting at the row pointers */
+    free_result(result, allocator);
+}
+
+void ls_release_rows(const Result *result, int first, int count)
+{
+    uintptr_t page, begin, end;
+
+    if (result == NULL || result->tile_rows == 0 || count <= 0)
+        return;
+    assert(first >= 0 && first + count <= result->num_beads);
+
+    /* The mapping starts on a page boundary, so rounding down stays in it */
+    page = sysconf(_SC_PAGESIZE);
+    begin = (uintptr_t)result->eigenvectors[first] / page * page;
+    end = (uintptr_t)(result->eigenvectors[first + count - 1]
+            + result->num_modes);
+    madvise((void *)begin, end - begin, MADV_DONTNEED);
+}
+
+/* Returns z_j . z_k for modes j and k of the lazy result, whose columns hold
+ * x = M^-1/2 z / |M^-1/2 z| */
+static double mode_overlap(const Result *result, int j, int k)
+{
+    const struct lazy_modes *lazy = result->lazy;
+    double sum = 0, mag_j = 0, mag_k = 0;
+    int i;
+
+    for (i = 0; i < lazy->n; i++)
+    {
+        double xj = result->eigenvectors[i][j], xk = result->eigenvectors[i][k];
+
+        sum += lazy->mass[i] * xj * xk;
+        mag_j += lazy->mass[i] * xj * xj;
+        mag_k += lazy->mass[i] * xk * xk;
+    }
+
+    return sum / sqrt(mag_j * mag_k);
+}
+
+LsStatus ls_find_mode(Result *result, int mode)
+{
+    struct lazy_modes *lazy;
+    const double **cluster;
+    double *zbuf, tol;
+    int n, first, last, i, j, c;
+
+    if (result == NULL || mode < 0 || mode >= result->num_modes
+            || result->eigenvectors == NULL)
+        return LS_ERR_INVALID;
+
+    lazy = result->lazy;
+    if (lazy == NULL || lazy->found[mode])
+        return LS_OK;
+
+    /* Modes of a cluster of close eigenvalues are orthogonalized against
+     * each other, so the whole cluster is found together, in the order
+     * tdsolve finds it */
+    n = lazy->n;
+    tol = CLUSTER_TOL * lazy->scale;
+    for (first = mode; first > 0
+            && lazy->eval[first] - lazy->eval[first - 1] <= tol; first--)
+        ;
+    for (last = mode; last < n - 1
+            && lazy->eval[last + 1] - lazy->eval[last] <= tol; last++)
+        ;
+
+    cluster = ls_alloc(&lazy->allocator, (last - first + 1)
+            * (sizeof(double *) + n * sizeof(double)));
+    if (cluster == NULL)
+        return LS_ERR_NOMEM;
+    zbuf = (double *)(cluster + (last - first + 1));
+
+    for (j = first; j <= last; j++)
+    {
+        double *z = zbuf + (size_t)(j - first) * n;
+        double mag = 0;
+
+        c = cluster_size(lazy->eval, j - 1, j - first, lazy->eval[j],
+                lazy->scale);
+        for (i = 0; i < c; i++)
+            cluster[i] = zbuf + (size_t)(j - first - c + i) * n;
+
+        if (tridiag_eigenvector(lazy->diag, lazy->offdiag, n, lazy->eval[j],
+                    lazy->scale, cluster, c, j, lazy->work, z)
+                || (j > first && fabs(dot(z - n, z, n)) > ORTHO_TOL))
+        {
+            ls_free(&lazy->allocator, cluster);
+            return LS_ERR_SOLVER;
+        }
+
+        /* x = M^-1/2 z, normalized and signed, as in write_general */
+        for (i = 0; i < n; i++)
+            mag += z[i] * z[i] / lazy->mass[i];
+        mag = sqrt(mag);
+        for (i = 0; i < n; i++)
+            result->eigenvectors[i][j] = z[i] / lazy->sqrtm[i] / mag;
+        fix_sign(result, j);
+    }
+
+    /* The modes either side, if found, must be orthogonal to the cluster */
+    if ((first > 0 && lazy->found[first - 1]
+                && fabs(mode_overlap(result, first - 1, first)) > ORTHO_TOL)
+            || (last < n - 1 && lazy->found[last + 1]
+                && fabs(mode_overlap(result, last, last + 1)) > ORTHO_TOL))
+    {
+        ls_free(&lazy->allocator, cluster);
+        return LS_ERR_SOLVER;
+    }
+
+    for (j = first; j <= last; j++)
+        lazy->found[j] = true;
+    ls_free(&lazy->allocator, cluster);
+
+    return LS_OK;
+}
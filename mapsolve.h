@@ -0,0 +1,64 @@
+/*----------------------------------------------------------------------------*/
+/* mapsolve.h                                                                 */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef MAPSOLVE_INCLUDED
+#define MAPSOLVE_INCLUDED
+
+#include <stddef.h>
+#include "types.h"
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. */
+
+#define TILE_MODES 64 /* Modes found together by tdsolve */
+
+/* A file mapped read-only into memory */
+typedef struct mapping
+{
+    void *base; /* NULL if nothing is mapped */
+    size_t size; /* Bytes mapped */
+} Mapping;
+
+/* Returns the number of rows or modes mapsolve makes at a time for a chain
+ * of num_beads beads within ram_budget bytes, at most num_beads; 0 if not
+ * even the O(N) part of the result fits */
+size_t mapped_tile(int num_beads, size_t ram_budget);
+
+/* Returns the bytes mapsolve takes from its allocator for a chain of
+ * num_beads beads within ram_budget bytes, which are at most ram_budget if
+ * mapped_tile is positive. Clusters of close eigenvalues longer than the
+ * tile can't be solved within that; mapsolve then fails. */
+size_t mapped_size(int num_beads, size_t ram_budget);
+
+/* Solves sim, a string or spring chain, like asolve, but writes the
+ * eigenvectors to the file path, created or truncated, and maps it read-only
+ * into result->eigenvectors, row by row as usual. Only the row pointers,
+ * eigenfrequencies and coefficients are kept in memory from allocator. The
+ * eigenvectors are made in tiles of result->tile_rows rows or modes, as many
+ * as mapped_tile allows in ram_budget, and written straight to the file:
+ * uniform chains row by row from their closed form, and other chains mode by
+ * mode from the tridiagonal dynamical matrix, whose eigenvalues are found by
+ * QL iteration and eigenvectors by inverse iteration, so no N x N matrix is
+ * ever held. Returns LS_ERR_INVALID for rings and membranes, or if ram_budget
+ * can't hold two rows, LS_ERR_NOMEM if a cluster of close eigenvalues is
+ * longer than the tile, and LS_ERR_IO if the file can't be written or
+ * mapped. On success, map holds the mapping; free both with free_mapped. */
+LsStatus mapsolve(const Simulation *sim, const char *path, size_t ram_budget,
+        const LsAllocator *allocator, Result *result, Mapping *map);
+
+/* Solves sim, a string or spring chain, in memory the way mapsolve solves
+ * chains that aren't uniform, in O(N^2) time. If needs asks for the
+ * eigenfrequencies alone, no eigenvectors are found and result is laid out by
+ * layout_frequencies. If it asks for eigenvectors but not coefficients, only
+ * the eigenfrequencies are found, and each eigenvector is found when
+ * ls_find_mode first asks for it. On failure nothing is left allocated. Caller
+ * responsible for freeing result with free_result. */
+LsStatus tdsolve(const Simulation *sim, unsigned needs,
+        const LsAllocator *allocator, Result *result);
+
+/* Unmaps map and frees the rest of result, from mapsolve */
+void free_mapped(Result *result, Mapping *map, const LsAllocator *allocator);
+
+#endif
@@ -0,0 +1,150 @@
+/*----------------------------------------------------------------------------*/
+/* msolve.c                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "msolve.h"
+#include "asolve.h"
+#include "sparse.h"
+#include "alloc.h"
+
+/* Fills d, allocated for 5 nonzeros per row, with the dynamical matrix
+ * M^-1/2 K M^-1/2 of the membrane in sim. Each bead is pulled towards its four
+ * neighbours, or the fixed frame at the edges, by tension / spacing. */
+static void create_d_csr(const Simulation *sim, Csr *d)
+{
+    double kx = sim->tension / sim->spacing_x;
+    double ky = sim->tension_y / sim->spacing_y;
+    int r, c, nnz = 0;
+
+    for (r = 0; r < sim->rows; r++)
+    {
+        for (c = 0; c < sim->cols; c++)
+        {
+            int i = r * sim->cols + c;
+            const Bead *b = sim->beads;
+            double mi = b[i].mass;
+
+            d->row_start[i] = nnz;
+
+            /* Columns in ascending order */
+            if (r > 0)
+            {
+                d->cols[nnz] = i - sim->cols;
+                d->values[nnz++] = -ky / sqrt(mi * b[i - sim->cols].mass);
+            }
+            if (c > 0)
+            {
+                d->cols[nnz] = i - 1;
+                d->values[nnz++] = -kx / sqrt(mi * b[i - 1].mass);
+            }
+            d->cols[nnz] = i;
+            d->values[nnz++] = (2 * kx + 2 * ky) / mi;
+            if (c < sim->cols - 1)
+            {
+                d->cols[nnz] = i + 1;
+                d->values[nnz++] = -kx / sqrt(mi * b[i + 1].mass);
+            }
+            if (r < sim->rows - 1)
+            {
+                d->cols[nnz] = i + sim->cols;
+                d->values[nnz++] = -ky / sqrt(mi * b[i + sim->cols].mass);
+            }
+        }
+    }
+    d->row_start[sim->num_beads] = nnz;
+}
+
+/* Translates the mass weighted eigenvectors in evec, num_modes rows of
+ * num_beads, back to displacements, normalizes them into result and projects
+ * the initial conditions of sim onto them. */
+static void fill_result(const Simulation *sim, const double *eval,
+        const double *evec, Result *result)
+{
+    int n = sim->num_beads;
+    int i, j;
+
+    for (j = 0; j < result->num_modes; j++)
+    {
+        const double *q = evec + (size_t)j * n;
+        double mag = 0, a = 0, b = 0;
+
+        /* Eigenfrequency = sqrt(eigenvalue) */
+        result->eigenfrequencies[j] = sqrt(fmax(eval[j], 0));
+
+        for (i = 0; i < n; i++)
+        {
+            double sqrtm = sqrt(sim->beads[i].mass);
+
+            result->eigenvectors[i][j] = q[i] / sqrtm;
+            mag += pow(result->eigenvectors[i][j], 2);
+
+            /* q is orthonormal, so the initial conditions in mass weighted
+             * coordinates project straight onto it */
+            a += q[i] * sqrtm * sim->beads[i].x0;
+            b += q[i] * sqrtm * sim->beads[i].v0;
+        }
+
+        mag = sqrt(mag);
+        for (i = 0; i < n; i++)
+            result->eigenvectors[i][j] /= mag;
+
+        result->coefficients[j].a = a * mag;
+        result->coefficients[j].b = b * mag / result->eigenfrequencies[j];
+        fix_sign(result, j);
+    }
+}
+
+LsStatus msolve(const Simulation *sim, const LsAllocator *allocator,
+        Result *result)
+{
+    size_t n = sim->num_beads;
+    size_t k = sim->num_modes;
+    Csr d;
+    double *eval, *evec;
+    void *arena;
+    LsStatus status;
+
+    assert(sim != NULL);
+    assert(sim->sim_type == MEMBRANE);
+    assert(allocator != NULL);
+    assert(result != NULL);
+
+    d.size = n;
+    d.row_start = ls_alloc(allocator, (n + 1) * sizeof(int));
+    d.cols = ls_alloc(allocator, 5 * n * sizeof(int));
+    d.values = ls_alloc(allocator, 5 * n * sizeof(double));
+    eval = ls_alloc(allocator, k * sizeof(double));
+    evec = ls_alloc(allocator, k * n * sizeof(double));
+    arena = ls_alloc(allocator, result_size(n, k));
+    if (d.row_start == NULL || d.cols == NULL || d.values == NULL
+            || eval == NULL || evec == NULL || arena == NULL)
+    {
+        status = LS_ERR_NOMEM;
+    }
+    else
+    {
+        create_d_csr(sim, &d);
+        status = lanczos_lowest(&d, k, allocator, eval, evec);
+    }
+
+    if (status == LS_OK)
+    {
+        layout_result(arena, n, k, result);
+        fill_result(sim, eval, evec, result);
+    }
+    else
+        ls_free(allocator, arena);
+
+    ls_free(allocator, d.row_start);
+    ls_free(allocator, d.cols);
+    ls_free(allocator, d.values);
+    ls_free(allocator, eval);
+    ls_free(allocator, evec);
+
+    return status;
+}
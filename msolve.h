@@ -0,0 +1,22 @@
+/*----------------------------------------------------------------------------*/
+/* msolve.h                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef MSOLVE_INCLUDED
+#define MSOLVE_INCLUDED
+
+#include "types.h"
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. */
+
+/* Given a membrane in sim, finds its lowest sim->num_modes eigenfrequencies and
+ * eigenvectors with a sparse solver, and the coefficients of the projection of
+ * the initial conditions onto them, and stores these in result. Memory use is
+ * proportional to num_modes x num_beads. On failure nothing is left allocated.
+ * Caller responsible for freeing result with free_result. */
+LsStatus msolve(const Simulation *sim, const LsAllocator *allocator,
+        Result *result);
+
+#endif
@@ -0,0 +1,143 @@
+/*----------------------------------------------------------------------------*/
+/* plan.c                                                                     */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <math.h>
+
+#include "plan.h"
+#include "asolve.h"
+#include "ring.h"
+#include "mapsolve.h"
+
+#define LANCZOS_RESTARTS 10 /* Typical restarts of the sparse solver */
+#define LANCZOS_EXTRA 40 /* Basis vectors beyond twice the wanted modes, as in
+                            sparse.c */
+
+/* Fills the flops and bytes of plan for each engine that can solve sim, with
+ * or without eigenvectors. If lazy, the tridiagonal engine leaves the
+ * eigenvectors to ls_find_mode. */
+static void estimate(const Simulation *sim, bool vectors, bool lazy,
+        LsPlan *plan)
+{
+    double n = sim->num_beads;
+    double result = result_size(sim->num_beads, sim->num_beads);
+    double tile = fmin(n, TILE_MODES);
+    int e;
+
+    for (e = 0; e < LS_NUM_ENGINES; e++)
+    {
+        plan->flops[e] = -1;
+        plan->bytes[e] = 0;
+    }
+
+    if (sim->sim_type == MEMBRANE)
+    {
+        double k = sim->num_modes;
+        double m = fmin(n, 2 * k + LANCZOS_EXTRA);
+
+        /* Each restart refills a basis of m vectors with products by a
+         * matrix of 5 nonzeros per row, fully reorthogonalized */
+        plan->flops[LS_ENGINE_LANCZOS] = LANCZOS_RESTARTS
+            * (10 * m * n + 4 * m * m * n);
+        plan->bytes[LS_ENGINE_LANCZOS] = (m * n + m * m) * sizeof(double)
+            + result_size(sim->num_beads, sim->num_modes);
+        return;
+    }
+
+    /* Forming D, tridiagonalizing it and QR iteration with eigenvectors, then
+     * an LU decomposition for the coefficients */
+    plan->flops[LS_ENGINE_DENSE] = 14 * n * n * n;
+    plan->bytes[LS_ENGINE_DENSE] = scratch_size(sim->num_beads) + result;
+
+    if (sim->periodic)
+    {
+        int period = ring_period(sim);
+        double l = period;
+
+        /* A complex eigensolve of one cell per wavenumber, FFTs of the
+         * initial conditions and N^2 entries of Bloch waves */
+        if (period < sim->num_beads)
+        {
+            plan->flops[LS_ENGINE_BLOCH] = 40 * n * l * l
+                + 10 * n * log2(n / l + 1) + 4 * n * n;
+            plan->bytes[LS_ENGINE_BLOCH] = result
+                + (6 * l * l + 8 * n) * sizeof(double);
+        }
+        return;
+    }
+
+    /* A sine per mode, a table lookup per entry of the eigenvectors, and two
+     * FFTs of 2 (N + 1) points for the coefficients */
+    if (is_uniform(sim))
+    {
+        plan->flops[LS_ENGINE_CLOSED_FORM] = vectors
+            ? n * n + 20 * n * log2(2 * n + 2) + 20 * n : 20 * n;
+        plan->bytes[LS_ENGINE_CLOSED_FORM] = vectors
+            ? result + 2 * (n + 1) * sizeof(double) : n * sizeof(double);
+    }
+
+    /* About two QL sweeps of 15 N per eigenvalue, then about three
+     * solves of 20 N per eigenvector, which is also scaled and projected.
+     * Lazy eigenvectors are paid for as they are asked for, and only the rows
+     * they are written to are ever touched. */
+    plan->flops[LS_ENGINE_TRIDIAGONAL] = 30 * n * n
+        + (vectors && !lazy ? 70 * n * n : 0);
+    if (lazy)
+        plan->bytes[LS_ENGINE_TRIDIAGONAL] = result + 11 * n * sizeof(double)
+            + n * sizeof(bool);
+    else
+        plan->bytes[LS_ENGINE_TRIDIAGONAL] = vectors
+            ? result + (2 * tile + 10) * n * sizeof(double)
+                + tile * sizeof(double *)
+            : 5 * n * sizeof(double);
+}
+
+LsStatus make_plan(const Simulation *sim, unsigned needs, size_t memory_limit,
+        LsPlan *plan)
+{
+    bool vectors = needs & (LS_NEED_VECTORS | LS_NEED_COEFFICIENTS);
+    bool lazy = !(needs & LS_NEED_COEFFICIENTS) && vectors;
+    int best = -1;
+    int e;
+
+    assert(sim != NULL);
+    assert(plan != NULL);
+
+    estimate(sim, vectors, lazy, plan);
+
+    for (e = 0; e < LS_NUM_ENGINES; e++)
+        if (plan->flops[e] >= 0 && plan->bytes[e] <= (double)memory_limit
+                && (best < 0 || plan->flops[e] < plan->flops[best]))
+            best = e;
+
+    plan->mapped = false;
+    if (best < 0)
+    {
+        /* The eigenvectors of a chain can still go to a file, if mapsolve
+         * can work on two of them at a time within the limit */
+        if (!vectors || sim->sim_type == MEMBRANE || sim->periodic
+                || mapped_tile(sim->num_beads, memory_limit)
+                < (sim->num_beads < 2 ? 1u : 2u))
+            return LS_ERR_NOMEM;
+
+        best = plan->flops[LS_ENGINE_CLOSED_FORM] >= 0
+            ? LS_ENGINE_CLOSED_FORM : LS_ENGINE_TRIDIAGONAL;
+        plan->bytes[best] = mapped_size(sim->num_beads, memory_limit);
+        plan->mapped = true;
+    }
+
+    plan->engine = best;
+
+    /* Only these engines can leave out the eigenvectors, and only the
+     * tridiagonal engine can find them one at a time */
+    if (best == LS_ENGINE_TRIDIAGONAL && lazy && !plan->mapped)
+        plan->needs = LS_NEED_FREQUENCIES | LS_NEED_VECTORS;
+    else
+        plan->needs = vectors || (best != LS_ENGINE_CLOSED_FORM
+                && best != LS_ENGINE_TRIDIAGONAL)
+            ? LS_NEED_ALL : LS_NEED_FREQUENCIES;
+
+    return LS_OK;
+}
@@ -0,0 +1,23 @@
+/*----------------------------------------------------------------------------*/
+/* plan.h                                                                     */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef PLAN_INCLUDED
+#define PLAN_INCLUDED
+
+#include <stddef.h>
+#include "types.h"
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. */
+
+/* Fills plan with the predicted cost of each engine that can solve sim for
+ * the parts of the solution in needs, and the cheapest of those that fit in
+ * memory_limit bytes, as ls_plan describes. The predictions are operation
+ * counts of the leading terms, good for comparing engines rather than for
+ * timing them. */
+LsStatus make_plan(const Simulation *sim, unsigned needs, size_t memory_limit,
+        LsPlan *plan);
+
+#endif
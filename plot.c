@@ -9,8 +9,13 @@
 #include <assert.h>
 #include <math.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "plot.h"
+#include "loadedstring.h"
+#include "synth.h"
+#include "publish.h"
+#include "lod.h"
 
 #define SIM_GRANULARITY 100 /* number of frames to generate in one period of the
                               highest frequency normal mode */
@@ -23,9 +28,16 @@
 #define MAX_POINTSIZE 5.0
 #define MIN_POINTSIZE 2.0
 
+#define COST_SMOOTHING 0.2 /* weight of the newest frame in the smoothed
+                            render cost */
+
 #define MAX_GIF_FRAMES 500 /* the max maximum is 999 due to file naming */
+#define MAX_ATLAS_THREADS 64 /* the most gnuplot processes drawing modes at
+                                once */
 #define PNG_X_SIZE 1920
 #define PNG_Y_SIZE 1080
+#define LOD_MAX_BEADS 256 /* most beads drawn as markers on a frame reduced to
+                             the PNG_X_SIZE pixel columns */
 
 /* Makes a gif out of the generated png files and removes the png files. delay
  * is in seconds. */
@@ -86,16 +98,135 @@ static void make_gif(const char *filename, double delay)
     return;
 }
 
-/* Calculates and returns an appropriate timestep for the simulation, depending
- * on the highest eigenfrequency of the system */
-static double calc_timestep(Result result)
+/* Keeps a live animation on the wall clock. Simulation step k is due at
+ * start + k * interval on the monotonic clock. When rendering can't keep up,
+ * steps are skipped rather than played late, and the number of steps
+ * advanced per rendered frame grows to match what gnuplot sustains. */
+typedef struct scheduler
+{
+    struct timespec start; /* Wall-clock time of step 0 */
+    struct timespec frame_start; /* When rendering of the current frame began */
+    double interval; /* Wall-clock seconds per simulation step */
+    long step; /* Simulation step currently being rendered */
+    long stride; /* Simulation steps advanced per rendered frame */
+    double render_cost; /* Smoothed seconds spent rendering one frame */
+    long rendered; /* Number of frames rendered */
+    long dropped; /* Number of simulation steps that were never rendered */
+} Scheduler;
+
+/* Returns b - a in seconds */
+static double elapsed(struct timespec a, struct timespec b)
+{
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+/* Returns t advanced by seconds */
+static struct timespec advance(struct timespec t, double seconds)
+{
+    long ns = (long)(seconds * 1e9);
+
+    t.tv_sec += ns / 1000000000L;
+    t.tv_nsec += ns % 1000000000L;
+    if (t.tv_nsec >= 1000000000L)
+    {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000L;
+    }
+
+    return t;
+}
+
+/* Starts the clock for an animation that shows one simulation step every
+ * interval seconds */
+static void sched_start(Scheduler *sched, double interval)
+{
+    clock_gettime(CLOCK_MONOTONIC, &sched->start);
+    sched->frame_start = sched->start;
+    sched->interval = interval;
+    sched->step = 0;
+    sched->stride = 1;
+    sched->render_cost = 0;
+    sched->rendered = 0;
+    sched->dropped = 0;
+}
+
+/* Called after a frame has been sent. Sleeps until the deadline of the next
+ * step to render and returns that step. */
+static long sched_next(Scheduler *sched)
+{
+    struct timespec now, deadline;
+    double cost;
+    long next;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sched->rendered++;
+
+    /* Render no more often than frames can be produced */
+    cost = elapsed(sched->frame_start, now);
+    if (sched->rendered == 1)
+        sched->render_cost = cost;
+    else
+        sched->render_cost = COST_SMOOTHING * cost
+            + (1 - COST_SMOOTHING) * sched->render_cost;
+    sched->stride = (long)ceil(sched->render_cost / sched->interval);
+    if (sched->stride < 1)
+        sched->stride = 1;
+
+    /* Skip any steps whose deadline has already passed */
+    next = sched->step + sched->stride;
+    if (elapsed(sched->start, now) > next * sched->interval)
+        next = (long)(elapsed(sched->start, now) / sched->interval) + 1;
+
+    sched->dropped += next - sched->step - 1;
+    sched->step = next;
+
+    deadline = advance(sched->start, next * sched->interval);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &sched->frame_start);
+
+    return next;
+}
+
+/* Prints the achieved frame rate and the number of dropped frames */
+static void sched_report(const Scheduler *sched)
+{
+    struct timespec now;
+    double wall;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wall = elapsed(sched->start, now);
+
+    printf("Played %ld frames in %.2lfs: %.1lf fps of %.1lf fps requested, "
+            "%ld frames dropped.\n", sched->rendered, wall,
+            wall > 0 ? sched->rendered / wall : 0.0, 1 / sched->interval,
+            sched->dropped);
+}
+
+double calc_timestep(Result result)
 {
     return (2 * M_PI) / (result.eigenfrequencies[result.num_modes - 1]
             * SIM_GRANULARITY);
 }
 
-/* Calculates and returns a pointsize relative to the mass of the bead */
-static double calc_pointsize(Simulation sim, int mass_index)
+double frame_timestep(Result result, AnimationOptions opts)
+{
+    if (opts.frame_rate > 0)
+        return opts.time_scale / opts.frame_rate;
+
+    return calc_timestep(result);
+}
+
+/* Returns the highest eigenfrequency frames timestep apart can show for opts,
+ * or 0 if every mode is to be shown */
+static double alias_limit(double timestep, AnimationOptions opts)
+{
+    return opts.frame_rate > 0 ? M_PI / timestep : 0;
+}
+
+/* Fills sizes, an array of num_beads + 2 doubles, with a pointsize for each
+ * bead of sim relative to its mass, between the two endpoints, which get
+ * none. The mass range is found once, so this is O(N). */
+static void calc_pointsizes(Simulation sim, double *sizes)
 {
     double pointsize;
     double max_mass, min_mass;
@@ -112,28 +243,72 @@ static double calc_pointsize(Simulation sim, int mass_index)
             min_mass = sim.beads[i].mass;
     }
 
-    if (max_mass != min_mass)
-        per = (sim.beads[mass_index].mass - min_mass) / (max_mass - min_mass);
-    else
-        per = 1.0;
+    sizes[0] = 0.0;
+    sizes[sim.num_beads + 1] = 0.0;
+    for (i = 0; i < sim.num_beads; i++)
+    {
+        if (max_mass != min_mass)
+            per = (sim.beads[i].mass - min_mass) / (max_mass - min_mass);
+        else
+            per = 1.0;
+
+        pointsize = MIN_POINTSIZE + (per * (MAX_POINTSIZE - MIN_POINTSIZE));
+
+        /* If there's a bunch of beads, we scale down the pointsize */
+        if (sim.num_beads > 100)
+            pointsize /= 2;
+
+        /* No size for massless beads */
+        if (sim.beads[i].mass == 0.0)
+            pointsize = 0.0;
+
+        sizes[i + 1] = pointsize;
+    }
+}
+
+FILE *open_gnuplot(void)
+{
+    FILE *gnuplot;
+
+    gnuplot = popen("gnuplot", "w");
+    if (!gnuplot) {
+        perror("popen");
+        exit(EXIT_FAILURE);
+    }
 
-    pointsize = MIN_POINTSIZE + (per * (MAX_POINTSIZE - MIN_POINTSIZE));
+    return gnuplot;
+}
 
-    /* If there's a bunch of beads, we scale down the pointsize */
-    if (sim.num_beads > 100)
-        pointsize /= 2;
+void print_setup(Simulation sim)
+{
+    if (sim.sim_type == MEMBRANE)
+    {
+        printf("Performing a sparse solution for the lowest %d modes of a "
+                "%d x %d membrane.\n\n", sim.num_modes, sim.rows, sim.cols);
+        return;
+    }
 
-    /* No size for massless beads */
-    if (sim.beads[mass_index].mass == 0.0)
-        pointsize = 0.0;
+    printf("Performing an analytical solution for a ");
+    if (sim.periodic)
+        printf("ring ");
+    if (sim.sim_type == STRING)
+        printf("string with ");
+    else if (sim.sim_type == SPRING)
+        printf("spring with ");
+    printf("%d beads.\n", sim.num_beads);
+    printf("\n");
 
-    return pointsize;
+    return;
 }
 
 void print_result(Result result)
 {
     int i, j;
 
+    /* A lazy result's rows are garbage until ls_find_mode fills them */
+    assert(result.lazy == NULL);
+    assert(result.eigenvectors != NULL && result.coefficients != NULL);
+
     /* Print eigenfrequencies */
     printf("Eigenfrequencies: ");
     for (i = 0; i < result.num_modes; i++)
@@ -145,7 +320,7 @@ void print_result(Result result)
     for (i = 0; i < result.num_modes; i++)
     {
         printf("Mode #%d:\n", i + 1);
-        for (j = 0; j < result.num_modes; j++)
+        for (j = 0; j < result.num_beads; j++)
             printf("%.2lf\t", result.eigenvectors[j][i]);
         printf("\n\n");
     }
@@ -160,75 +335,51 @@ void print_result(Result result)
     return;
 }
 
-void plot_eigenfrequencies(Result result)
+void draw_eigenfrequencies(FILE *gnuplot, Result result)
 {
-    int *modes;
     int i;
-    FILE *gnuplot;
 
+    assert(gnuplot != NULL);
     assert(result.eigenfrequencies != NULL);
 
-    modes = malloc(result.num_modes * sizeof(int));
-    /* Skipping error checking */
-
-    for (i = 0; i < result.num_modes; i++)
-        modes[i] = i + 1;
-
-    printf("Plotting eigenfrequencies.\n");
-
-    gnuplot = popen("gnuplot", "w");
-    if (!gnuplot) {
-        perror("popen");
-        exit(EXIT_FAILURE);
-    }
-
+    fprintf(gnuplot, "reset\n");
     fprintf(gnuplot, "set title 'Eigenfrequencies vs. Mode Number'\n");
     fprintf(gnuplot, "set xlabel 'Mode Number'\n");
     fprintf(gnuplot, "set ylabel 'Eigenfrequency (rad/s)'\n");
     fprintf(gnuplot, "plot '-' u 1:2 t 'Eigenfrequencies' w points pt 7 ps %f\n", DEFAULT_POINTSIZE);
     for (i = 0; i < result.num_modes; i++)
-        fprintf(gnuplot, "%d %lf\n", modes[i], result.eigenfrequencies[i]);
+        fprintf(gnuplot, "%d %lf\n", i + 1, result.eigenfrequencies[i]);
     fprintf(gnuplot, "e\n");
     fflush(gnuplot);
 
+    return;
+}
+
+void plot_eigenfrequencies(Result result)
+{
+    FILE *gnuplot;
+
+    printf("Plotting eigenfrequencies.\n");
+
+    gnuplot = open_gnuplot();
+    draw_eigenfrequencies(gnuplot, result);
+
     printf("Press Enter to continue.\n");
     while (getchar() != '\n') {}
 
     pclose(gnuplot);
-    free(modes);
 
     return;
 }
 
-void plot_mode_amplitudes(Result result)
+void draw_mode_amplitudes(FILE *gnuplot, Result result)
 {
-    int *modes;
-    double *amplitudes;
     int i;
-    FILE *gnuplot;
 
+    assert(gnuplot != NULL);
     assert(result.coefficients != NULL);
 
-    modes = malloc(result.num_modes * sizeof(int));
-    amplitudes = malloc(result.num_modes * sizeof(double));
-    /* Skipping error checking */
-
-    for (i = 0; i < result.num_modes; i++)
-    {
-        modes[i] = i + 1;
-        amplitudes[i] = sqrt(pow(result.coefficients[i].a, 2)
-                + pow(result.coefficients[i].b, 2));
-        /*printf("Mode #%d Amp %.2lf\n", modes[i], amplitudes[i]);*/
-    }
-
-    printf("Plotting mode amplitudes.\n");
-
-    gnuplot = popen("gnuplot", "w");
-    if (!gnuplot) {
-        perror("popen");
-        exit(EXIT_FAILURE);
-    }
-
+    fprintf(gnuplot, "reset\n");
     fprintf(gnuplot, "set title 'Mode Amplitudes'\n");
     fprintf(gnuplot, "set xlabel 'Mode Number'\n");
     fprintf(gnuplot, "set ylabel 'Amplitude (m)'\n");
@@ -236,68 +387,361 @@ void plot_mode_amplitudes(Result result)
     fprintf(gnuplot, "set boxwidth 0.75 relative\n");
     fprintf(gnuplot, "plot '-' u 1:2 t 'Amplitude' w boxes\n");
     for (i = 0; i < result.num_modes; i++)
-        fprintf(gnuplot, "%d %lf\n", modes[i], amplitudes[i]);
+        fprintf(gnuplot, "%d %lf\n", i + 1,
+                sqrt(pow(result.coefficients[i].a, 2)
+                    + pow(result.coefficients[i].b, 2)));
+    fprintf(gnuplot, "e\n");
+    fflush(gnuplot);
+
+    return;
+}
+
+void plot_mode_amplitudes(Result result)
+{
+    FILE *gnuplot;
+
+    printf("Plotting mode amplitudes.\n");
+
+    gnuplot = open_gnuplot();
+    draw_mode_amplitudes(gnuplot, result);
+
+    printf("Press Enter to continue.\n");
+    while (getchar() != '\n') {}
+
+    pclose(gnuplot);
+
+    return;
+}
+
+/* Sends the magnitude, or the phase in degrees if phase is true, of the
+ * response of bead against frequency to gnuplot as inline data */
+static void send_response(FILE *gnuplot, const double *frequencies,
+        const double *response, size_t count, int num_beads, int bead,
+        bool phase)
+{
+    size_t k;
+
+    for (k = 0; k < count; k++)
+    {
+        double re = response[2 * (k * num_beads + bead)];
+        double im = response[2 * (k * num_beads + bead) + 1];
+
+        fprintf(gnuplot, "%lf %g\n", frequencies[k],
+                phase ? atan2(im, re) * 180 / M_PI : sqrt(re * re + im * im));
+    }
     fprintf(gnuplot, "e\n");
+}
+
+void plot_response(const double *frequencies, const double *response,
+        size_t count, int num_beads, int drive_bead)
+{
+    FILE *gnuplot;
+    int last = num_beads - 1;
+    int plot;
+
+    assert(frequencies != NULL);
+    assert(response != NULL);
+
+    printf("Plotting frequency response.\n");
+
+    gnuplot = open_gnuplot();
+    fprintf(gnuplot, "set multiplot layout 2,1 title 'Frequency Response, "
+            "Bead %d Driven'\n", drive_bead + 1);
+    for (plot = 0; plot < 2; plot++)
+    {
+        fprintf(gnuplot, "set xlabel 'Driving Frequency (rad/s)'\n");
+        if (plot == 0)
+        {
+            fprintf(gnuplot, "set logscale y\n");
+            fprintf(gnuplot, "set ylabel 'Amplitude (m)'\n");
+        }
+        else
+        {
+            fprintf(gnuplot, "unset logscale y\n");
+            fprintf(gnuplot, "set ylabel 'Phase (degrees)'\n");
+            fprintf(gnuplot, "set yrange [-180:180]\n");
+        }
+
+        /* The driven bead, and the far end to show transmission */
+        fprintf(gnuplot, "plot '-' u 1:2 t 'Bead %d' w lines lw %f",
+                drive_bead + 1, LINEWIDTH);
+        if (last != drive_bead)
+            fprintf(gnuplot, ", '-' u 1:2 t 'Bead %d' w lines lw %f",
+                    last + 1, LINEWIDTH);
+        fprintf(gnuplot, "\n");
+        send_response(gnuplot, frequencies, response, count, num_beads,
+                drive_bead, plot == 1);
+        if (last != drive_bead)
+            send_response(gnuplot, frequencies, response, count, num_beads,
+                    last, plot == 1);
+    }
+    fprintf(gnuplot, "unset multiplot\n");
     fflush(gnuplot);
 
     printf("Press Enter to continue.\n");
     while (getchar() != '\n') {}
 
     pclose(gnuplot);
-    free(modes);
-    free(amplitudes);
 
     return;
 }
     
-void plot_normal_modes(Result result, Simulation sim)
+/* Allocates and fills x and sizes, arrays of num_beads + 2 positions and bead
+ * sizes used to draw normal modes, including the two fixed endpoints. Caller
+ * responsible for freeing both arrays. */
+static void mode_layout(Result result, Simulation sim, double **x,
+        double **sizes)
 {
-    double *x, *y, *sizes;
-    int modenum; /* one indexed */
     int i;
-    char str[MAX_INPUT_LENGTH];
-    FILE *gnuplot;
-
-    assert(result.eigenvectors != NULL);
-    assert(sim.connections != NULL);
 
     /* We add two more beads as endpoints */
-    x = malloc((result.num_modes + 2) * sizeof(double));
-    y = malloc((result.num_modes + 2) * sizeof(double));
-    sizes = malloc((result.num_modes + 2) * sizeof(double));
+    *x = malloc((result.num_beads + 2) * sizeof(double));
+    *sizes = malloc((result.num_beads + 2) * sizeof(double));
     /* Skipping error checking */
 
     /* Draw in the two fixed endpoints */
-    x[0] = 0;
-    y[0] = 0;
-    y[result.num_modes + 1] = 0;
-    sizes[0] = 0.0;
-    sizes[result.num_modes + 1] = 0.0;
+    (*x)[0] = 0;
 
     /* Strings have variable spacing */
     if (sim.sim_type == STRING)
-        for (i = 1; i <= result.num_modes + 1; i++)
-            x[i] = x[i - 1] + sim.connections[i - 1];
+        for (i = 1; i <= result.num_beads + 1; i++)
+            (*x)[i] = (*x)[i - 1] + sim.connections[i - 1];
 
     /* Springs have equal spacing */
     if (sim.sim_type == SPRING)
-        for (i = 1; i <= result.num_modes + 1; i++)
-            x[i] = x[i - 1] + 1;
+        for (i = 1; i <= result.num_beads + 1; i++)
+            (*x)[i] = (*x)[i - 1] + 1;
 
     /* Determine bead sizes */
-    for (i = 1; i <= result.num_modes; i++)
-        sizes[i] = calc_pointsize(sim, i - 1);
+    calc_pointsizes(sim, *sizes);
+}
 
-    gnuplot = popen("gnuplot", "w");
-    if (!gnuplot) {
-        perror("popen");
-        exit(EXIT_FAILURE);
+/* Sets the two endpoints of y, which holds the num_beads displacements of sim
+ * between them. They are the fixed walls, except in a ring, where they repeat
+ * the beads on the far side so that the ring is drawn cut open. */
+static void set_endpoints(Simulation sim, double *y)
+{
+    if (sim.periodic)
+    {
+        y[0] = y[sim.num_beads];
+        y[sim.num_beads + 1] = y[1];
+    }
+    else
+    {
+        y[0] = 0;
+        y[sim.num_beads + 1] = 0;
+    }
+}
+
+/* Sets up lod for a chain of num_points points at x with marker sizes
+ * sizes, if it has more points than the plots have pixel columns. Returns
+ * lod, or NULL if frames are drawn whole. */
+static Lod *chain_lod(Lod *lod, const double *x, const double *sizes,
+        int num_points)
+{
+    if (!lod_needed(num_points, PNG_X_SIZE)
+            || lod_init(lod, x, sizes, num_points, PNG_X_SIZE, LOD_MAX_BEADS))
+        return NULL;
+
+    return lod;
+}
+
+/* Sends the chain of num_points points at x, y with marker sizes sizes to
+ * gnuplot, titled title, as a line through its beads. If lod isn't NULL, the
+ * frame is reduced by it first, and the line and its beads are sent as two
+ * plots. */
+static void send_chain(FILE *gnuplot, Lod *lod, const char *title,
+        const double *x, const double *y, const double *sizes, int num_points)
+{
+    int i, k;
+
+    if (lod == NULL)
+    {
+        fprintf(gnuplot, "plot '-' u 1:2:3 t '%s' ", title);
+        fprintf(gnuplot, "w linespoints lw %f pt 7 ps variable\n", LINEWIDTH);
+        for (i = 0; i < num_points; i++)
+            fprintf(gnuplot, "%lf %lf %lf\n", x[i], y[i], sizes[i]);
+
+        fprintf(gnuplot, "e\n");
+        fflush(gnuplot);
+        return;
+    }
+
+    lod_reduce(lod, y);
+    fprintf(gnuplot, "plot '-' u 1:2 t '%s' w lines lw %f lc 1, ", title,
+            LINEWIDTH);
+    fprintf(gnuplot, "'-' u 1:2:3 notitle w points pt 7 ps variable lc 1\n");
+    for (k = 0; k < lod->num_line; k++)
+    {
+        i = lod->line_index[k];
+        fprintf(gnuplot, "%lf %lf\n", x[i], y[i]);
+    }
+    fprintf(gnuplot, "e\n");
+    for (k = 0; k < lod->num_beads; k++)
+    {
+        i = lod->bead_index[k];
+        fprintf(gnuplot, "%lf %lf %lf\n", x[i], y[i], sizes[i]);
+    }
+
+    fprintf(gnuplot, "e\n");
+    fflush(gnuplot);
+}
+
+/* Sends normal mode modenum (one indexed) to gnuplot, using the positions and
+ * sizes from mode_layout, reduced by lod unless it is NULL. y is scratch of
+ * num_beads + 2 doubles. */
+static void send_normal_mode(FILE *gnuplot, Result result, Simulation sim,
+        const double *x, double *y, const double *sizes, Lod *lod,
+        int modenum)
+{
+    char title[32];
+    LsStatus status;
+    int i;
+
+    /* A solve for the eigenvectors alone may have left this one out */
+    if ((status = ls_find_mode(&result, modenum - 1)) != LS_OK)
+    {
+        fprintf(stderr, "Failed to find mode %d: %s.\n", modenum,
+                ls_strerror(status));
+        return;
     }
 
+    for (i = 0; i < result.num_beads; i++)
+        y[i + 1] = result.eigenvectors[i][modenum - 1];
+    set_endpoints(sim, y);
+
+    sprintf(title, "Mode #%d", modenum);
+    send_chain(gnuplot, lod, title, x, y, sizes, result.num_beads + 2);
+}
+
+/* Sets up titles and ranges for normal mode plots */
+static void setup_normal_modes(FILE *gnuplot)
+{
+    fprintf(gnuplot, "reset\n");
     fprintf(gnuplot, "set title 'Normal Modes'\n");
     fprintf(gnuplot, "set xlabel 'x (m)'\n");
     fprintf(gnuplot, "set ylabel 'y (m)'\n");
     fprintf(gnuplot, "set yrange [-1:1]\n");
+}
+
+/* Sets up titles and ranges for 3D plots of the membrane in sim. The z range
+ * is -zrange to zrange, or automatic if zrange is 0. */
+static void setup_membrane(FILE *gnuplot, Simulation sim, const char *title,
+        double zrange)
+{
+    fprintf(gnuplot, "reset\n");
+    fprintf(gnuplot, "set title '%s'\n", title);
+    fprintf(gnuplot, "set xlabel 'x (m)'\n");
+    fprintf(gnuplot, "set ylabel 'y (m)'\n");
+    fprintf(gnuplot, "set zlabel 'z (m)'\n");
+    fprintf(gnuplot, "set xrange [0:%lf]\n", (sim.cols + 1) * sim.spacing_x);
+    fprintf(gnuplot, "set yrange [0:%lf]\n", (sim.rows + 1) * sim.spacing_y);
+    if (zrange > 0)
+        fprintf(gnuplot, "set zrange [%lf:%lf]\n", -1 * zrange, zrange);
+    fprintf(gnuplot, "set hidden3d\n");
+}
+
+/* Sends the displacements z of the beads of membrane sim as a grid for splot,
+ * surrounded by the fixed frame */
+static void send_membrane(FILE *gnuplot, Simulation sim, const double *z)
+{
+    int r, c;
+
+    for (r = -1; r <= sim.rows; r++)
+    {
+        for (c = -1; c <= sim.cols; c++)
+        {
+            bool inside = r >= 0 && r < sim.rows && c >= 0 && c < sim.cols;
+
+            fprintf(gnuplot, "%lf %lf %lf\n", (c + 1) * sim.spacing_x,
+                    (r + 1) * sim.spacing_y,
+                    inside ? z[r * sim.cols + c] : 0.0);
+        }
+        fprintf(gnuplot, "\n");
+    }
+
+    fprintf(gnuplot, "e\n");
+    fflush(gnuplot);
+}
+
+/* Sends normal mode modenum (one indexed) of membrane sim to gnuplot */
+static void send_membrane_mode(FILE *gnuplot, Result result, Simulation sim,
+        int modenum)
+{
+    double *z;
+    int i;
+
+    z = malloc(result.num_beads * sizeof(double));
+    /* Skipping error checking */
+
+    for (i = 0; i < result.num_beads; i++)
+        z[i] = result.eigenvectors[i][modenum - 1];
+
+    fprintf(gnuplot, "splot '-' t 'Mode #%d' w lines lw %f\n", modenum,
+            LINEWIDTH);
+    send_membrane(gnuplot, sim, z);
+
+    free(z);
+}
+
+void draw_normal_mode(FILE *gnuplot, Result result, Simulation sim,
+        int modenum)
+{
+    double *x, *y, *sizes;
+    Lod lod, *reduce;
+
+    assert(gnuplot != NULL);
+    assert(result.eigenvectors != NULL);
+    assert(modenum >= 1 && modenum <= result.num_modes);
+
+    if (sim.sim_type == MEMBRANE)
+    {
+        setup_membrane(gnuplot, sim, "Normal Modes", 0);
+        send_membrane_mode(gnuplot, result, sim, modenum);
+        return;
+    }
+
+    assert(sim.connections != NULL);
+
+    mode_layout(result, sim, &x, &sizes);
+    y = malloc((result.num_beads + 2) * sizeof(double));
+    /* Skipping error checking */
+
+    reduce = chain_lod(&lod, x, sizes, result.num_beads + 2);
+    setup_normal_modes(gnuplot);
+    send_normal_mode(gnuplot, result, sim, x, y, sizes, reduce, modenum);
+
+    if (reduce != NULL)
+        lod_free(reduce);
+    free(x);
+    free(y);
+    free(sizes);
+}
+
+void plot_normal_modes(Result result, Simulation sim)
+{
+    double *x, *y, *sizes;
+    int modenum = 0; /* one indexed */
+    char str[MAX_INPUT_LENGTH];
+    FILE *gnuplot;
+    Lod lod, *reduce = NULL;
+
+    assert(result.eigenvectors != NULL);
+    assert(sim.connections != NULL || sim.sim_type == MEMBRANE);
+
+    x = y = sizes = NULL;
+    gnuplot = open_gnuplot();
+    if (sim.sim_type == MEMBRANE)
+        setup_membrane(gnuplot, sim, "Normal Modes", 0);
+    else
+    {
+        mode_layout(result, sim, &x, &sizes);
+        y = malloc((result.num_beads + 2) * sizeof(double));
+        /* Skipping error checking */
+
+        reduce = chain_lod(&lod, x, sizes, result.num_beads + 2);
+        setup_normal_modes(gnuplot);
+    }
 
     strcpy(str, "1");
     do
@@ -311,58 +755,262 @@ void plot_normal_modes(Result result, Simulation sim)
         if (modenum > result.num_modes || modenum <= 0)
             break;
 
-        for (i = 0; i < result.num_modes; i++)
-            y[i + 1] = result.eigenvectors[i][modenum - 1];
-
-        fprintf(gnuplot, "plot '-' u 1:2:3 t 'Mode #%d' ", modenum);
-        fprintf(gnuplot, "w linespoints lw %f pt 7 ps variable\n", LINEWIDTH);
-        for (i = 0; i < result.num_modes + 2; i++)
-            fprintf(gnuplot, "%lf %lf %lf\n", x[i], y[i], sizes[i]);
-
-        fprintf(gnuplot, "e\n");
-        fflush(gnuplot);
+        if (sim.sim_type == MEMBRANE)
+            send_membrane_mode(gnuplot, result, sim, modenum);
+        else
+            send_normal_mode(gnuplot, result, sim, x, y, sizes, reduce,
+                    modenum);
 
         printf("Press ENTER to go to next normal mode. Enter number 1-%d to display that mode. Enter 'q' to quit: ", result.num_modes);
     }
     while (strcmp(fgets(str, MAX_INPUT_LENGTH, stdin), "q\n"));
 
     pclose(gnuplot);
+    if (reduce != NULL)
+        lod_free(reduce);
     free(x);
     free(y);
     free(sizes);
 }
 
-static void animate_string(Result result, Simulation sim, double time_scale,
-        bool save_gif)
+/* Writes one block of the mode atlas file fp for mode j (zero indexed) of
+ * result: num_beads + 2 records (x, y, size) along a chain, using the
+ * positions and sizes from mode_layout, or (rows + 2) x (cols + 2) records
+ * (x, y, z) over a membrane and its frame. rec is scratch of 3 records per
+ * point. Returns 1 if an error occured, 0 otherwise. */
+static int write_atlas_mode(FILE *fp, Result result, Simulation sim,
+        const double *x, const double *sizes, double *rec, int j)
+{
+    size_t count = 0;
+    int i, r, c;
+
+    if (sim.sim_type == MEMBRANE)
+    {
+        for (r = -1; r <= sim.rows; r++)
+            for (c = -1; c <= sim.cols; c++)
+            {
+                bool inside = r >= 0 && r < sim.rows && c >= 0
+                    && c < sim.cols;
+
+                rec[count++] = (c + 1) * sim.spacing_x;
+                rec[count++] = (r + 1) * sim.spacing_y;
+                rec[count++] = inside
+                    ? result.eigenvectors[r * sim.cols + c][j] : 0.0;
+            }
+    }
+    else
+    {
+        for (i = 0; i < result.num_beads + 2; i++)
+        {
+            rec[count++] = x[i];
+            rec[count++] = 0.0;
+            rec[count++] = sizes[i];
+        }
+        for (i = 0; i < result.num_beads; i++)
+            rec[3 * (i + 1) + 1] = result.eigenvectors[i][j];
+        if (sim.periodic)
+        {
+            rec[1] = rec[3 * result.num_beads + 1];
+            rec[3 * (result.num_beads + 1) + 1] = rec[4];
+        }
+    }
+
+    return fwrite(rec, sizeof(double), count, fp) != count;
+}
+
+/* Sends gnuplot the plot of mode j (zero indexed) from the atlas file
+ * data_name, whose blocks are block_size bytes */
+static void send_atlas_mode(FILE *gnuplot, Simulation sim,
+        const char *data_name, size_t block_size, int j)
+{
+    if (sim.sim_type == MEMBRANE)
+    {
+        fprintf(gnuplot, "splot \"%s\" binary skip=%zu record=%dx%d "
+                "format=\"%%float64%%float64%%float64\" u 1:2:3 "
+                "t 'Mode #%d' w lines lw %f\n", data_name,
+                (size_t)j * block_size, sim.cols + 2, sim.rows + 2, j + 1,
+                LINEWIDTH);
+    }
+    else
+    {
+        fprintf(gnuplot, "plot \"%s\" binary skip=%zu record=%d "
+                "format=\"%%float64%%float64%%float64\" u 1:2:3 "
+                "t 'Mode #%d' ", data_name, (size_t)j * block_size,
+                sim.num_beads + 2, j + 1);
+        fprintf(gnuplot, "w linespoints lw %f pt 7 ps variable\n",
+                LINEWIDTH);
+    }
+}
+
+int export_mode_atlas(Result result, Simulation sim, AtlasOptions opts)
+{
+    FILE *gnuplot[MAX_ATLAS_THREADS];
+    char data_name[NAME_MAX + 8], name[NAME_MAX + 24];
+    double *x = NULL, *sizes = NULL, *rec;
+    size_t points, block_size;
+    int num_modes, num_threads, j, k, error = 0;
+    LsStatus status;
+    FILE *fp;
+
+    assert(result.eigenvectors != NULL);
+    assert(sim.connections != NULL || sim.sim_type == MEMBRANE);
+
+    num_modes = opts.num_modes;
+    if (num_modes <= 0 || num_modes > result.num_modes)
+        num_modes = result.num_modes;
+
+    num_threads = opts.num_threads;
+    if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1 || opts.multipage)
+        num_threads = 1;
+    if (num_threads > MAX_ATLAS_THREADS)
+        num_threads = MAX_ATLAS_THREADS;
+    if (num_threads > num_modes)
+        num_threads = num_modes;
+
+    /* Every shape goes into one file up front, in blocks gnuplot can seek to,
+     * so that no mode is sent as text */
+    points = sim.sim_type == MEMBRANE
+        ? (size_t)(sim.rows + 2) * (sim.cols + 2) : (size_t)sim.num_beads + 2;
+    block_size = 3 * points * sizeof(double);
+    sprintf(data_name, "%s.modes", sim.filename);
+
+    if (sim.sim_type != MEMBRANE)
+        mode_layout(result, sim, &x, &sizes);
+    rec = malloc(block_size);
+    if ((fp = fopen(data_name, "wb")) == NULL || rec == NULL
+            || (sim.sim_type != MEMBRANE && (x == NULL || sizes == NULL)))
+    {
+        fprintf(stderr, "Failed to write %s.\n", data_name);
+        if (fp != NULL)
+            fclose(fp);
+        free(x);
+        free(sizes);
+        free(rec);
+        return 1;
+    }
+
+    for (j = 0; j < num_modes && !error; j++)
+    {
+        /* A solve for the eigenvectors alone may have left this one out */
+        if ((status = ls_find_mode(&result, j)) != LS_OK)
+        {
+            fprintf(stderr, "Failed to find mode %d: %s.\n", j + 1,
+                    ls_strerror(status));
+            error = 1;
+        }
+        else if (write_atlas_mode(fp, result, sim, x, sizes, rec, j))
+        {
+            fprintf(stderr, "Failed to write %s.\n", data_name);
+            error = 1;
+        }
+    }
+    if (fclose(fp) != 0 && !error)
+    {
+        fprintf(stderr, "Failed to write %s.\n", data_name);
+        error = 1;
+    }
+    free(x);
+    free(sizes);
+    free(rec);
+    if (error)
+    {
+        remove(data_name);
+        return 1;
+    }
+
+    for (k = 0; k < num_threads; k++)
+    {
+        gnuplot[k] = open_gnuplot();
+        if (sim.sim_type == MEMBRANE)
+            setup_membrane(gnuplot[k], sim, "Normal Modes", 0);
+        else
+            setup_normal_modes(gnuplot[k]);
+
+        if (opts.multipage)
+        {
+            fprintf(gnuplot[k], "set term pdfcairo size %f,%f\n",
+                    PNG_X_SIZE / 120.0, PNG_Y_SIZE / 120.0);
+            fprintf(gnuplot[k], "set output \"%s_modes.pdf\"\n",
+                    sim.filename);
+        }
+        else
+            fprintf(gnuplot[k], "set term pngcairo size %d,%d\n",
+                    PNG_X_SIZE, PNG_Y_SIZE);
+    }
+
+    /* Modes are dealt out in turn, so that every gnuplot has work while the
+     * pipe of another is full */
+    for (j = 0; j < num_modes; j++)
+    {
+        FILE *g = gnuplot[j % num_threads];
+
+        if (!opts.multipage)
+        {
+            sprintf(name, "%s_mode%04d.png", sim.filename, j + 1);
+            fprintf(g, "set output \"%s\"\n", name);
+        }
+        send_atlas_mode(g, sim, data_name, block_size, j);
+    }
+
+    for (k = 0; k < num_threads; k++)
+    {
+        fprintf(gnuplot[k], "set output\n");
+        if (pclose(gnuplot[k]) != 0)
+            error = 1;
+    }
+    remove(data_name);
+
+    if (error)
+        fprintf(stderr, "gnuplot failed to draw every mode.\n");
+    else if (opts.multipage)
+        printf("Drew %d modes to %s_modes.pdf\n", num_modes, sim.filename);
+    else
+        printf("Drew %d modes to %s_mode%04d.png to %s_mode%04d.png with %d "
+                "gnuplot process%s\n", num_modes, sim.filename, 1,
+                sim.filename, num_modes, num_threads,
+                num_threads > 1 ? "es" : "");
+
+    return error;
+}
+
+static void animate_string(FILE *gnuplot, Result result, Simulation sim,
+        AnimationOptions opts)
 {
     double *x, *y, *sizes;
     double t = 0; /* time */
-    int i, j;
+    long step = 0; /* simulation step being drawn; t = step * timestep */
+    int i;
     int frame = 1; /* used for gif */
     double yrange = 0;
     double timestep;
-    FILE *gnuplot;
+    Synth synth;
+    Scheduler sched;
+    Publisher pub;
+    Lod lod, *reduce;
+    char title[32];
+
+    timestep = frame_timestep(result, opts);
+    if (synth_init(&synth, result, opts.single_precision,
+                opts.energy_fraction, alias_limit(timestep, opts)))
+        return;
 
     /* We add two more beads as endpoints */
-    x = malloc((result.num_modes + 2) * sizeof(double));
-    y = malloc((result.num_modes + 2) * sizeof(double));
-    sizes = malloc((result.num_modes + 2) * sizeof(double));
+    x = malloc((result.num_beads + 2) * sizeof(double));
+    y = malloc((result.num_beads + 2) * sizeof(double));
+    sizes = malloc((result.num_beads + 2) * sizeof(double));
     /* Skipping error checking */
 
-    /* Draw in the two fixed endpoints */
+    /* Draw in the two endpoints */
     x[0] = 0;
-    y[0] = 0;
-    y[result.num_modes + 1] = 0;
 
     /* Strings have variable spacing */
-    for (i = 1; i <= result.num_modes + 1; i++)
+    for (i = 1; i <= result.num_beads + 1; i++)
         x[i] = x[i - 1] + sim.connections[i - 1];
 
     /* Determine bead sizes */
-    sizes[0] = 0.0;
-    sizes[result.num_modes + 1] = 0.0;
-    for (i = 1; i <= result.num_modes; i++)
-        sizes[i] = calc_pointsize(sim, i - 1);
+    calc_pointsizes(sim, sizes);
 
     /* The max displacement cannot be larger than the sum of the coefficients;
      * so use the sum of coefficients as lower and upper y range */
@@ -379,79 +1027,89 @@ static void animate_string(Result result, Simulation sim, double time_scale,
 
     /* TODO: potential solution is dynamically scaling y range */
 
-    timestep = calc_timestep(result);
+    reduce = chain_lod(&lod, x, sizes, result.num_beads + 2);
+    if (reduce != NULL)
+        printf("Drawing %d points as %d pixel columns and %d beads.\n",
+                result.num_beads + 2, lod.num_columns, lod.num_beads);
 
-    gnuplot = popen("gnuplot", "w");
-    if (!gnuplot) {
-        perror("popen");
-        exit(EXIT_FAILURE);
-    }
+    memset(&pub, 0, sizeof(Publisher));
+    if (opts.publish_name != NULL)
+        publish_open(&pub, opts.publish_name, result.num_beads + 2, x, sizes,
+                timestep, false);
 
+    fprintf(gnuplot, "reset\n");
     fprintf(gnuplot, "set title 'String Animation'\n");
     fprintf(gnuplot, "set xlabel 'x (m)'\n");
     fprintf(gnuplot, "set ylabel 'y (m)'\n");
     fprintf(gnuplot, "set yrange [%lf:%lf]\n", -1 * yrange, yrange);
 
-    if (save_gif)
+    if (opts.save_gif)
         fprintf(gnuplot, "set term pngcairo size %d,%d\n", PNG_X_SIZE, PNG_Y_SIZE);
 
     printf("Press CTRL-c to stop simulation.\n");
+    if (!opts.save_gif)
+        sched_start(&sched, timestep / opts.time_scale);
     while (t < RUNTIME && frame <= MAX_GIF_FRAMES)
     {
-        /* i is bead number, j is mode number */
-        for (i = 0; i < result.num_modes; i++)
-        {
-            y[i + 1] = 0;
-            /* Add contributions from each normal mode */
-            for (j = 0; j < result.num_modes; j++)
-            {
-                y[i + 1] += result.coefficients[j].a * result.eigenvectors[i][j]
-                    * cos(result.eigenfrequencies[j] * t);
-                y[i + 1] += result.coefficients[j].b * result.eigenvectors[i][j]
-                    * sin(result.eigenfrequencies[j] * t);
-            }
-        }
+        /* Bead displacements go between the two endpoints */
+        synth_frame(&synth, t, y + 1);
+        set_endpoints(sim, y);
+        if (pub.header != NULL)
+            publish_frame(&pub, t, y);
 
-        if (save_gif)
+        if (opts.save_gif)
             fprintf(gnuplot, "set output \"%s%03d.png\"\n", sim.filename, frame++);
 
-        fprintf(gnuplot, "plot '-' u 1:2:3 t 'Time: %.2lfs' w linespoints lw %f pt 7 ps variable\n", t, LINEWIDTH);
-        for (i = 0; i < result.num_modes + 2; i++)
-            fprintf(gnuplot, "%lf %lf %lf\n", x[i], y[i], sizes[i]);
-
-        fprintf(gnuplot, "e\n");
-        fflush(gnuplot);
+        sprintf(title, "Time: %.2lfs", t);
+        send_chain(gnuplot, reduce, title, x, y, sizes, result.num_beads + 2);
 
-        if (!save_gif)
-            usleep(1000000 * timestep / time_scale);
-        t += timestep;
+        if (!opts.save_gif)
+            step = sched_next(&sched);
+        else
+            step++;
+        t = step * timestep;
     }
 
-    pclose(gnuplot);
+    if (!opts.save_gif)
+        sched_report(&sched);
+
+    publish_close(&pub);
+    if (reduce != NULL)
+        lod_free(reduce);
     free(x);
     free(y);
     free(sizes);
-
-    if (save_gif)
-        make_gif(sim.filename, timestep / time_scale);
+    synth_free(&synth);
 
     return;
 }
 
-static void animate_spring(Result result, Simulation sim, double time_scale,
-        bool save_gif)
+static void animate_spring(FILE *gnuplot, Result result, Simulation sim,
+        AnimationOptions opts)
 {
-    double *x, *sizes;
+    double *x, *dx, *sizes;
+    double *rest, *disp; /* Rest positions and displacements published */
     double t = 0; /* time */
-    int i, j;
+    long step = 0; /* simulation step being drawn; t = step * timestep */
+    int i;
     int frame = 1;
     double spacing = 0;
     double timestep;
-    FILE *gnuplot;
+    Synth synth;
+    Scheduler sched;
+    Publisher pub;
+
+    timestep = frame_timestep(result, opts);
+    if (synth_init(&synth, result, opts.single_precision,
+                opts.energy_fraction, alias_limit(timestep, opts)))
+        return;
 
     /* We add two more beads as endpoints */
-    x = malloc((result.num_modes + 2) * sizeof(double));
-    sizes = malloc((result.num_modes + 2) * sizeof(double));
+    x = malloc((result.num_beads + 2) * sizeof(double));
+    dx = malloc(result.num_beads * sizeof(double));
+    sizes = malloc((result.num_beads + 2) * sizeof(double));
+    rest = malloc((result.num_beads + 2) * sizeof(double));
+    disp = malloc((result.num_beads + 2) * sizeof(double));
     /* Skipping error checking */
 
     /* Calculate spacing needed */
@@ -463,86 +1121,211 @@ static void animate_spring(Result result, Simulation sim, double time_scale,
     spacing *= 1.5; /* leave extra spacing between beads */
 
     /* Springs have equal spacing between beads */
-    for (i = 0; i < result.num_modes + 2; i++)
+    for (i = 0; i < result.num_beads + 2; i++)
         x[i] = i * spacing;
 
     /* Determine bead sizes */
-    sizes[0] = 0.0;
-    sizes[result.num_modes + 1] = 0.0;
-    for (i = 1; i <= result.num_modes; i++)
-        sizes[i] = calc_pointsize(sim, i - 1);
+    calc_pointsizes(sim, sizes);
 
-    timestep = calc_timestep(result);
-
-    gnuplot = popen("gnuplot", "w");
-    if (!gnuplot) {
-        perror("popen");
-        exit(EXIT_FAILURE);
-    }
+    memset(&pub, 0, sizeof(Publisher));
+    for (i = 0; i < result.num_beads + 2; i++)
+        rest[i] = i * spacing;
+    if (opts.publish_name != NULL)
+        publish_open(&pub, opts.publish_name, result.num_beads + 2, rest,
+                sizes, timestep, true);
 
+    fprintf(gnuplot, "reset\n");
     fprintf(gnuplot, "set title 'Spring Animation'\n");
     fprintf(gnuplot, "set xlabel 'x (m)'\n");
     fprintf(gnuplot, "set yrange [-1:1]\n");
 
-    if (save_gif)
+    if (opts.save_gif)
         fprintf(gnuplot, "set term pngcairo size %d,%d\n", PNG_X_SIZE, PNG_Y_SIZE);
 
     printf("Press CTRL-c to stop simulation.\n");
+    if (!opts.save_gif)
+        sched_start(&sched, timestep / opts.time_scale);
     while (t < RUNTIME && frame <= MAX_GIF_FRAMES)
     {
-        /* i is bead number, j is mode number */
-        for (i = 0; i < result.num_modes; i++)
+        synth_frame(&synth, t, dx);
+
+        /* Displacements are added to the equilibrium positions */
+        for (i = 0; i < result.num_beads; i++)
+            x[i + 1] = (i + 1) * spacing + dx[i];
+
+        /* The ends of a ring repeat the beads on the far side */
+        if (sim.periodic)
         {
-            /* Equilibrium position */
-            x[i + 1] = (i + 1) * spacing;
+            x[0] = dx[result.num_beads - 1];
+            x[result.num_beads + 1] = (result.num_beads + 1) * spacing + dx[0];
+        }
 
-            /* Add contributions from each normal mode */
-            for (j = 0; j < result.num_modes; j++)
-            {
-                x[i + 1] += result.coefficients[j].a * result.eigenvectors[i][j]
-                    * cos(result.eigenfrequencies[j] * t);
-                x[i + 1] += result.coefficients[j].b * result.eigenvectors[i][j]
-                    * sin(result.eigenfrequencies[j] * t);
-            }
+        if (pub.header != NULL)
+        {
+            for (i = 0; i < result.num_beads + 2; i++)
+                disp[i] = x[i] - rest[i];
+            publish_frame(&pub, t, disp);
         }
 
-        if (save_gif)
+        if (opts.save_gif)
             fprintf(gnuplot, "set output \"%s%03d.png\"\n", sim.filename, frame++);
 
         fprintf(gnuplot, "plot '-' u 1:2:3 t 'Time: %.2lfs' w linespoints lw %f pt 7 ps variable\n", t, LINEWIDTH);
-        for (i = 0; i < result.num_modes + 2; i++)
+        for (i = 0; i < result.num_beads + 2; i++)
             fprintf(gnuplot, "%lf 0.0 %lf\n", x[i], sizes[i]);
 
         fprintf(gnuplot, "e\n");
         fflush(gnuplot);
 
-        if (!save_gif)
-            usleep(1000000 * timestep / time_scale);
-        t += timestep;
+        if (!opts.save_gif)
+            step = sched_next(&sched);
+        else
+            step++;
+        t = step * timestep;
     }
 
-    pclose(gnuplot);
+    if (!opts.save_gif)
+        sched_report(&sched);
+
+    publish_close(&pub);
     free(x);
+    free(dx);
     free(sizes);
+    free(rest);
+    free(disp);
+    synth_free(&synth);
 
-    if (save_gif)
-        make_gif(sim.filename, timestep / time_scale);
+    return;
+}
+
+static void animate_membrane(FILE *gnuplot, Result result, Simulation sim,
+        AnimationOptions opts)
+{
+    double *z;
+    double t = 0; /* time */
+    long step = 0; /* simulation step being drawn; t = step * timestep */
+    int i, j;
+    int frame = 1;
+    double zrange = 0;
+    double timestep;
+    Synth synth;
+    Scheduler sched;
+
+    timestep = frame_timestep(result, opts);
+    if (synth_init(&synth, result, opts.single_precision,
+                opts.energy_fraction, alias_limit(timestep, opts)))
+        return;
+
+    z = malloc(result.num_beads * sizeof(double));
+    /* Skipping error checking */
+
+    /* Same guess as for strings, with each amplitude scaled by the largest
+     * component of its mode, but at least the initial displacement */
+    for (j = 0; j < result.num_modes; j++)
+    {
+        double max_component = 0;
+        for (i = 0; i < result.num_beads; i++)
+            max_component = fmax(max_component,
+                    fabs(result.eigenvectors[i][j]));
+        zrange += max_component * sqrt(pow(result.coefficients[j].a, 2)
+                + pow(result.coefficients[j].b, 2));
+    }
+    zrange /= sqrt(result.num_modes);
+    for (i = 0; i < sim.num_beads; i++)
+        zrange = fmax(zrange, fabs(sim.beads[i].x0));
+
+    setup_membrane(gnuplot, sim, "Membrane Animation", zrange);
+
+    if (opts.publish_name != NULL)
+        fprintf(stderr, "Frame rings are published for strings and springs "
+                "only.\n");
+
+    if (opts.save_gif)
+        fprintf(gnuplot, "set term pngcairo size %d,%d\n", PNG_X_SIZE, PNG_Y_SIZE);
+
+    printf("Press CTRL-c to stop simulation.\n");
+    if (!opts.save_gif)
+        sched_start(&sched, timestep / opts.time_scale);
+    while (t < RUNTIME && frame <= MAX_GIF_FRAMES)
+    {
+        synth_frame(&synth, t, z);
+
+        if (opts.save_gif)
+            fprintf(gnuplot, "set output \"%s%03d.png\"\n", sim.filename, frame++);
+
+        fprintf(gnuplot, "splot '-' t 'Time: %.2lfs' w lines lw %f\n", t,
+                LINEWIDTH);
+        send_membrane(gnuplot, sim, z);
+
+        if (!opts.save_gif)
+            step = sched_next(&sched);
+        else
+            step++;
+        t = step * timestep;
+    }
+
+    if (!opts.save_gif)
+        sched_report(&sched);
+
+    free(z);
+    synth_free(&synth);
 
     return;
 }
 
-void animate(Result result, Simulation sim, double time_scale, bool save_gif)
+void animate(Result result, Simulation sim, AnimationOptions opts)
 {
+    FILE *gnuplot;
+
     assert(result.eigenfrequencies != NULL);
     assert(result.eigenvectors != NULL);
     assert(result.coefficients != NULL);
-    assert(sim.connections != NULL);
+    assert(sim.connections != NULL || sim.sim_type == MEMBRANE);
+
+    gnuplot = open_gnuplot();
+
+    if (sim.sim_type == STRING)
+        animate_string(gnuplot, result, sim, opts);
+
+    if (sim.sim_type == SPRING)
+        animate_spring(gnuplot, result, sim, opts);
+
+    if (sim.sim_type == MEMBRANE)
+        animate_membrane(gnuplot, result, sim, opts);
+
+    /* gnuplot only finishes writing the last png once it exits */
+    pclose(gnuplot);
+
+    if (opts.save_gif)
+        make_gif(sim.filename, frame_timestep(result, opts) / opts.time_scale);
+
+    return;
+}
+
+void animate_with(FILE *gnuplot, Result result, Simulation sim,
+        AnimationOptions opts)
+{
+    assert(gnuplot != NULL);
+    assert(result.eigenfrequencies != NULL);
+    assert(result.eigenvectors != NULL);
+    assert(result.coefficients != NULL);
+    assert(sim.connections != NULL || sim.sim_type == MEMBRANE);
+
+    /* GIFs need a gnuplot of their own, see animate() */
+    if (opts.save_gif)
+    {
+        animate(result, sim, opts);
+        return;
+    }
 
     if (sim.sim_type == STRING)
-        animate_string(result, sim, time_scale, save_gif);
+        animate_string(gnuplot, result, sim, opts);
 
     if (sim.sim_type == SPRING)
-        animate_spring(result, sim, time_scale, save_gif);
+        animate_spring(gnuplot, result, sim, opts);
+
+    if (sim.sim_type == MEMBRANE)
+        animate_membrane(gnuplot, result, sim, opts);
 
     return;
-} 
+}
@@ -6,25 +6,99 @@
 #ifndef PLOT_INCLUDED
 #define PLOT_INCLUDED
 
+#include <stdio.h>
 #include <stdbool.h>
 #include "types.h"
 
-/* Prints eigenfrequencies, eigenvectors, and coefficients of the simulation */
+typedef struct animation_options
+{
+    double time_scale; /* Speed up/down factor. 1.0 plays at real speed. */
+    bool save_gif; /* Save the animation as a GIF instead of playing it */
+    bool single_precision; /* Synthesize frames with the float32 kernel */
+    double energy_fraction; /* Fraction of the mode energy kept in frames.
+                               1.0 keeps every mode. */
+    double frame_rate; /* Frames per second of output. 0 steps time by
+                          calc_timestep instead, resolving every mode. */
+    const char *publish_name; /* Shared memory frame ring (see publish.h)
+                                 strings and springs also publish their
+                                 frames to. NULL for none. */
+} AnimationOptions;
+
+typedef struct atlas_options
+{
+    int num_modes; /* Number of lowest modes drawn. 0 draws every mode. */
+    bool multipage; /* Draw every mode as a page of one PDF instead of a PNG
+                       each */
+    int num_threads; /* gnuplot processes the PNGs are split between. 0 uses
+                        one per processor. */
+} AtlasOptions;
+
+/* Opens a gnuplot process to send plots to. Exits if gnuplot can't be
+ * started. Caller responsible for closing it with pclose. */
+FILE *open_gnuplot(void);
+
+/* Calculates and returns an appropriate timestep for the simulation, depending
+ * on the highest eigenfrequency of the system */
+double calc_timestep(Result result);
+
+/* Returns the simulated time between frames of an animation with opts:
+ * time_scale / frame_rate if a frame rate is set, so that the whole run takes
+ * RUNTIME x frame_rate / time_scale frames however fast the modes are, and
+ * calc_timestep otherwise */
+double frame_timestep(Result result, AnimationOptions opts);
+
+/* Prints the kind of solution about to be performed for sim */
+void print_setup(Simulation sim);
+
+/* Prints eigenfrequencies, eigenvectors, and coefficients of the simulation.
+ * result must hold all of them, as a solve for LS_NEED_ALL leaves it. */
 void print_result(Result result);
 
 /* Plots a scatterplot of eigenfrequencies vs. mode number */
 void plot_eigenfrequencies(Result result);
 
+/* Same as plot_eigenfrequencies, but draws on an already open gnuplot and
+ * returns without waiting for the user */
+void draw_eigenfrequencies(FILE *gnuplot, Result result);
+
 /* Plots a bar graph of amplitudes of all normal modes */
 void plot_mode_amplitudes(Result result);
 
+/* Same as plot_mode_amplitudes, but draws on an already open gnuplot and
+ * returns without waiting for the user */
+void draw_mode_amplitudes(FILE *gnuplot, Result result);
+
+/* Plots the magnitude and phase of the steady-state response of the driven
+ * bead and of the last bead against driving frequency. response holds count
+ * x num_beads complex amplitudes laid out as by ls_frequency_response. */
+void plot_response(const double *frequencies, const double *response,
+        size_t count, int num_beads, int drive_bead);
+
 /* Plots normal modes of system. User can select which mode to display. Spring
  * simulations are plotted as if they were a string simulation. */
 void plot_normal_modes(Result result, Simulation sim);
 
-/* Animates the simulation, sped up/down by factor time_scale. If time_scale =
- * 1.0, the simulation plays at real speed. If save_gif is true, saves animation
- * as a GIF. */
-void animate(Result result, Simulation sim, double time_scale, bool save_gif);
+/* Draws the lowest opts.num_modes normal modes of sim without waiting for
+ * the user. Their shapes, along with the bead positions and sizes, are first
+ * written together to the binary file FILE.modes, which gnuplot then reads
+ * each mode from in place: to FILE_mode0001.png and on, split between
+ * opts.num_threads gnuplot processes drawing at once, or to the pages of
+ * FILE_modes.pdf. FILE.modes is removed afterwards. Returns 1 if an error
+ * occured, 0 otherwise. */
+int export_mode_atlas(Result result, Simulation sim, AtlasOptions opts);
+
+/* Draws normal mode modenum (one indexed) on an already open gnuplot */
+void draw_normal_mode(FILE *gnuplot, Result result, Simulation sim,
+        int modenum);
+
+/* Animates the simulation, sped up/down by factor opts.time_scale. If
+ * time_scale = 1.0, the simulation plays at real speed. If opts.save_gif is
+ * true, saves animation as a GIF. */
+void animate(Result result, Simulation sim, AnimationOptions opts);
+
+/* Same as animate, but plays on an already open gnuplot. GIFs are still
+ * rendered by a gnuplot of their own. */
+void animate_with(FILE *gnuplot, Result result, Simulation sim,
+        AnimationOptions opts);
 
 #endif
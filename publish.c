@@ -0,0 +1,119 @@
+/*----------------------------------------------------------------------------*/
+/* publish.c                                                                  */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "publish.h"
+
+size_t ring_size(int num_points)
+{
+    return RING_HEADER_SIZE + 2 * (size_t)num_points * sizeof(double)
+        + RING_SLOTS * (2 + (size_t)num_points) * sizeof(uint64_t);
+}
+
+int publish_open(Publisher *pub, const char *name, int num_points,
+        const double *x, const double *sizes, double timestep,
+        bool longitudinal)
+{
+    double *rest;
+    void *base;
+    int fd;
+
+    assert(pub != NULL);
+    assert(name != NULL);
+
+    memset(pub, 0, sizeof(Publisher));
+
+    /* Shared memory names are one path component after a slash */
+    if (snprintf(pub->name, sizeof(pub->name), "%s%s",
+                name[0] == '/' ? "" : "/", name) >= (int)sizeof(pub->name)
+            || strchr(pub->name + 1, '/') != NULL)
+    {
+        fprintf(stderr, "Invalid frame ring name %s.\n", name);
+        return 1;
+    }
+
+    /* A new object, so that readers of an old ring aren't handed frames of
+     * a different size */
+    shm_unlink(pub->name);
+    pub->size = ring_size(num_points);
+    if ((fd = shm_open(pub->name, O_CREAT | O_EXCL | O_RDWR, 0644)) < 0
+            || ftruncate(fd, pub->size) < 0
+            || (base = mmap(NULL, pub->size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to create frame ring %s: %s.\n", pub->name,
+                strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(pub->name);
+        }
+        return 1;
+    }
+    close(fd);
+
+    /* ftruncate zeroed everything, so every stamp starts out as 0 */
+    pub->header = base;
+    pub->num_points = num_points;
+    rest = (double *)((char *)base + RING_HEADER_SIZE);
+    memcpy(rest, x, num_points * sizeof(double));
+    memcpy(rest + num_points, sizes, num_points * sizeof(double));
+    pub->slots = (uint64_t *)(rest + 2 * num_points);
+
+    pub->header->version = RING_VERSION;
+    pub->header->flags = longitudinal ? RING_LONGITUDINAL : 0;
+    pub->header->num_points = num_points;
+    pub->header->num_slots = RING_SLOTS;
+    pub->header->timestep = timestep;
+
+    /* Readers check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(pub->header->magic, "LSRING\0\0", 8);
+
+    printf("Publishing frames to shared memory %s.\n", pub->name);
+
+    return 0;
+}
+
+void publish_frame(Publisher *pub, double t, const double *displacements)
+{
+    uint64_t n;
+    uint64_t *slot;
+
+    assert(pub != NULL);
+    assert(pub->header != NULL);
+
+    n = pub->header->sequence;
+    slot = pub->slots + (n % RING_SLOTS) * (2 + (size_t)pub->num_points);
+
+    /* An odd stamp tells readers the slot is being written */
+    __atomic_store_n(&slot[0], 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(slot + 1, &t, sizeof(double));
+    memcpy(slot + 2, displacements, pub->num_points * sizeof(double));
+    __atomic_store_n(&slot[0], 2 * n + 2, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&pub->header->sequence, n + 1, __ATOMIC_RELEASE);
+}
+
+void publish_close(Publisher *pub)
+{
+    assert(pub != NULL);
+
+    if (pub->header == NULL)
+        return;
+
+    __atomic_or_fetch(&pub->header->flags, RING_FINISHED, __ATOMIC_RELEASE);
+    munmap(pub->header, pub->size);
+    shm_unlink(pub->name);
+    pub->header = NULL;
+}
@@ -0,0 +1,93 @@
+/*----------------------------------------------------------------------------*/
+/* publish.h                                                                  */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef PUBLISH_INCLUDED
+#define PUBLISH_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Frame rings are POSIX shared memory objects an animation publishes its
+ * frames to, for other processes to map read-only and watch. A frame holds
+ * the displacement of every drawn point, the two endpoints included, from its
+ * rest position: across the string for strings, along it for springs.
+ * Everything is in native byte order.
+ *
+ * Header, 64 bytes at offset 0:
+ *     char     magic[8]      "LSRING\0\0"
+ *     uint32   version       RING_VERSION
+ *     uint32   flags         RING_LONGITUDINAL if displacements are along x;
+ *                            RING_FINISHED once the animation has ended
+ *     uint32   num_points    beads plus the two endpoints
+ *     uint32   num_slots     frames the ring holds
+ *     uint64   sequence      frames published so far; frame n is in slot
+ *                            n % num_slots
+ *     float64  timestep      simulated time between frames, in s
+ *     (zero padding)
+ *
+ * Then num_points float64 rest positions x, in m, and num_points float64
+ * point sizes, as drawn by gnuplot.
+ *
+ * Then num_slots slots of 8 (2 + num_points) bytes:
+ *     uint64   stamp         2 n + 1 while frame n is written, 2 n + 2 once
+ *                            it is complete
+ *     float64  time          in s
+ *     float64  displacement[num_points]
+ *
+ * The producer never waits for readers. A reader wanting the latest frame
+ * loads sequence, reads slot (sequence - 1) % num_slots in place between two
+ * loads of its stamp, and keeps what it read only if both loads gave
+ * 2 sequence. Otherwise the slot was overwritten meanwhile and the reader
+ * tries again. sequence and stamp are written with release ordering, and
+ * should be loaded with acquire ordering. */
+
+#define RING_VERSION 1
+#define RING_LONGITUDINAL 0x1
+#define RING_FINISHED 0x2
+#define RING_HEADER_SIZE 64
+#define RING_SLOTS 64
+
+typedef struct ring_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t num_points;
+    uint32_t num_slots;
+    uint64_t sequence;
+    double timestep;
+    char padding[RING_HEADER_SIZE - 40];
+} RingHeader;
+
+/* An open frame ring */
+typedef struct publisher
+{
+    char name[256]; /* Shared memory object name, starting with '/' */
+    RingHeader *header; /* The mapped ring. NULL if none is open. */
+    size_t size; /* Bytes mapped */
+    uint64_t *slots; /* Start of the first slot */
+    int num_points;
+} Publisher;
+
+/* Returns the bytes a ring of num_points points takes */
+size_t ring_size(int num_points);
+
+/* Creates the frame ring name, replacing any old ring of that name, for
+ * frames of num_points points at rest positions x with the given sizes,
+ * timestep apart. Returns 1 if an error occured, 0 otherwise. */
+int publish_open(Publisher *pub, const char *name, int num_points,
+        const double *x, const double *sizes, double timestep,
+        bool longitudinal);
+
+/* Publishes the displacements of every point at time t, overwriting the
+ * oldest frame. Never blocks. */
+void publish_frame(Publisher *pub, double t, const double *displacements);
+
+/* Marks the ring finished, unmaps it and removes its name. Readers that have
+ * it mapped keep it until they unmap it. Accepts a closed pub. */
+void publish_close(Publisher *pub);
+
+#endif
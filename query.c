@@ -0,0 +1,258 @@
+/*----------------------------------------------------------------------------*/
+/* query.c                                                                    */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "loadedstring.h"
+#include "asolve.h"
+#include "alloc.h"
+
+#define QUERY_BLOCK 16 /* Queries evaluated together */
+
+struct ls_probe
+{
+    LsAllocator allocator; /* Everything below comes from here */
+    int num_beads;
+    int num_active; /* Modes with a nonzero coefficient */
+    bool chain; /* False for membranes, which have no per-bead energy */
+    bool periodic; /* True for rings, whose first and last beads are
+                      neighbors */
+    double *frequencies; /* Array of num_active eigenfrequencies */
+    double *a, *b; /* Arrays of num_active coefficients */
+    double *vectors; /* num_beads x num_active eigenvector entries, one row
+                        of active modes per bead. NULL for mapped
+                        eigenvectors. */
+    Result mapped; /* The Result, if its eigenvectors are mapped from a file
+                      and read in place. Zeroed otherwise. */
+    int *modes; /* Array of num_active indices of the active modes in mapped */
+    double *gathered; /* QUERY_BLOCK x 3 rows of active modes gathered from
+                         mapped for one block of queries */
+    double *masses; /* Array of num_beads masses */
+    double *stiffness; /* Array of num_beads + 1 spring constants, one per
+                          connection */
+};
+
+LsStatus ls_probe_create(const Simulation *sim, const Result *result,
+        const LsAllocator *allocator, LsProbe **probe)
+{
+    LsAllocator al = ls_allocator_or_default(allocator);
+    LsProbe *p;
+    int n, active, rows;
+    int i, j, k;
+
+    if (sim == NULL || result == NULL || probe == NULL
+            || sim->num_beads != result->num_beads || sim->num_beads <= 0
+            || result->coefficients == NULL)
+        return LS_ERR_INVALID;
+
+    n = sim->num_beads;
+    for (j = 0, active = 0; j < result->num_modes; j++)
+        if (result->coefficients[j].a != 0 || result->coefficients[j].b != 0)
+            active++;
+
+    /* Mapped eigenvectors are too large to copy, so only the rows a block of
+     * queries needs are gathered */
+    rows = result->tile_rows > 0 ? 3 * QUERY_BLOCK : n;
+    p = ls_alloc(&al, sizeof(LsProbe) + ((size_t)rows * active + 3 * active
+                + 2 * n + 1) * sizeof(double) + active * sizeof(int));
+    if (p == NULL)
+        return LS_ERR_NOMEM;
+
+    p->allocator = al;
+    p->num_beads = n;
+    p->num_active = active;
+    p->chain = sim->sim_type != MEMBRANE;
+    p->periodic = sim->periodic;
+    p->frequencies = (double *)(p + 1);
+    p->a = p->frequencies + active;
+    p->b = p->a + active;
+    p->masses = p->b + active;
+    p->stiffness = p->masses + n;
+    p->vectors = p->stiffness + n + 1;
+    p->modes = (int *)(p->vectors + (size_t)rows * active);
+    memset(&p->mapped, 0, sizeof(Result));
+    p->gathered = NULL;
+    if (result->tile_rows > 0)
+    {
+        p->mapped = *result;
+        p->gathered = p->vectors;
+        p->vectors = NULL;
+    }
+
+    for (j = 0, k = 0; j < result->num_modes; j++)
+    {
+        if (result->coefficients[j].a == 0 && result->coefficients[j].b == 0)
+            continue;
+
+        p->frequencies[k] = result->eigenfrequencies[j];
+        p->a[k] = result->coefficients[j].a;
+        p->b[k] = result->coefficients[j].b;
+        p->modes[k] = j;
+        if (p->vectors != NULL)
+            for (i = 0; i < n; i++)
+                p->vectors[(size_t)i * active + k] =
+                    result->eigenvectors[i][j];
+        k++;
+    }
+
+    for (i = 0; i < n; i++)
+        p->masses[i] = sim->beads[i].mass;
+
+    for (i = 0; i <= n; i++)
+        p->stiffness[i] = p->chain
+            ? spring_constant(sim, sim->connections[i]) : 0;
+
+    *probe = p;
+
+    return LS_OK;
+}
+
+/* Copies the active modes of row bead of the mapped eigenvectors of p into
+ * slot of the gathered rows, releases the row, and returns the copy */
+static const double *gather_row(const LsProbe *p, int bead, int slot)
+{
+    double *dst = p->gathered + (size_t)slot * p->num_active;
+    const double *row = p->mapped.eigenvectors[bead];
+    int k;
+
+    for (k = 0; k < p->num_active; k++)
+        dst[k] = row[p->modes[k]];
+    ls_release_rows(&p->mapped, bead, 1);
+
+    return dst;
+}
+
+/* Evaluates up to QUERY_BLOCK queries together. For query q, x[q][1] and v[q]
+ * are the displacement and velocity of its bead; if neighbors is true,
+ * x[q][0] and x[q][2] are the displacements of the beads on either side, 0 at
+ * the walls, wrapping around a ring. Modes are the outer loop so that the
+ * trigonometry of a mode is done for the whole block in one pass over the
+ * queries. */
+static void eval_block(const LsProbe *p, const LsQuery *queries, int count,
+        bool neighbors, double x[][3], double *v)
+{
+    const double *rows[QUERY_BLOCK][3];
+    double c[QUERY_BLOCK], s[QUERY_BLOCK];
+    int q, k, d;
+
+    for (q = 0; q < count; q++)
+    {
+        for (d = 0; d < 3; d++)
+        {
+            int bead = queries[q].bead + d - 1;
+
+            if (p->periodic)
+                bead = (bead + p->num_beads) % p->num_beads;
+
+            x[q][d] = 0;
+            rows[q][d] = NULL;
+            if ((d == 1 || neighbors) && bead >= 0 && bead < p->num_beads)
+                rows[q][d] = p->vectors != NULL
+                    ? p->vectors + (size_t)bead * p->num_active
+                    : gather_row(p, bead, 3 * q + d);
+        }
+        v[q] = 0;
+    }
+
+    for (k = 0; k < p->num_active; k++)
+    {
+        double w = p->frequencies[k];
+
+        for (q = 0; q < count; q++)
+        {
+            c[q] = cos(w * queries[q].t);
+            s[q] = sin(w * queries[q].t);
+        }
+
+        for (q = 0; q < count; q++)
+        {
+            double wx = p->a[k] * c[q] + p->b[k] * s[q];
+            double wv = w * (p->b[k] * c[q] - p->a[k] * s[q]);
+
+            /* A mode of zero frequency drifts at velocity b */
+            if (w == 0)
+            {
+                wx = p->a[k] + p->b[k] * queries[q].t;
+                wv = p->b[k];
+            }
+
+            x[q][1] += rows[q][1][k] * wx;
+            v[q] += rows[q][1][k] * wv;
+            for (d = 0; d < 3; d += 2)
+                if (rows[q][d] != NULL)
+                    x[q][d] += rows[q][d][k] * wx;
+        }
+    }
+}
+
+LsStatus ls_probe_eval(const LsProbe *probe, LsQuantity quantity,
+        const LsQuery *queries, size_t count, double *values)
+{
+    double x[QUERY_BLOCK][3];
+    double v[QUERY_BLOCK];
+    size_t start;
+    int q;
+
+    if (probe == NULL || (queries == NULL && count > 0)
+            || (values == NULL && count > 0)
+            || (quantity != LS_DISPLACEMENT && quantity != LS_VELOCITY
+                && quantity != LS_ENERGY)
+            || (quantity == LS_ENERGY && !probe->chain))
+        return LS_ERR_INVALID;
+
+    for (start = 0; start < count; start++)
+        if (queries[start].bead < 0 || queries[start].bead >= probe->num_beads)
+            return LS_ERR_INVALID;
+
+    for (start = 0; start < count; start += QUERY_BLOCK)
+    {
+        int n = count - start < QUERY_BLOCK ? count - start : QUERY_BLOCK;
+        const LsQuery *block = queries + start;
+
+        eval_block(probe, block, n, quantity == LS_ENERGY, x, v);
+
+        for (q = 0; q < n; q++)
+        {
+            int i = block[q].bead;
+            double left, right;
+
+            if (quantity == LS_DISPLACEMENT)
+            {
+                values[start + q] = x[q][1];
+                continue;
+            }
+            if (quantity == LS_VELOCITY)
+            {
+                values[start + q] = v[q];
+                continue;
+            }
+
+            /* Each connection's energy is split between the beads it joins;
+             * the walls take no share, and a ring has none */
+            left = 0.5 * probe->stiffness[i] * pow(x[q][1] - x[q][0], 2);
+            right = 0.5 * probe->stiffness[i + 1] * pow(x[q][2] - x[q][1], 2);
+            values[start + q] = 0.5 * probe->masses[i] * v[q] * v[q]
+                + (i == 0 && !probe->periodic ? left : 0.5 * left)
+                + (i == probe->num_beads - 1 && !probe->periodic
+                        ? right : 0.5 * right);
+        }
+    }
+
+    return LS_OK;
+}
+
+void ls_probe_free(LsProbe *probe)
+{
+    LsAllocator a;
+
+    if (probe == NULL)
+        return;
+
+    a = probe->allocator;
+    ls_free(&a, probe);
+}
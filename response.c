@@ -0,0 +1,169 @@
+/*----------------------------------------------------------------------------*/
+/* response.c                                                                 */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <complex.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "loadedstring.h"
+#include "asolve.h"
+#include "alloc.h"
+
+#define MAX_THREADS 64
+
+/* The frequencies one thread is responsible for */
+typedef struct sweep
+{
+    const Simulation *sim;
+    const LsResponseOptions *opts;
+    const double *stiffness; /* Array of num_beads + 1 spring constants */
+    const double *frequencies;
+    size_t begin, end; /* Frequencies begin to end - 1 */
+    double complex *response; /* Output for all frequencies */
+    double complex *scratch; /* Array of num_beads elimination factors */
+    LsStatus status;
+} Sweep;
+
+/* Solves (K - w^2 M + i w C) x = F e_drive for the frequency w by Thomas
+ * elimination: the subdiagonal is cancelled going down, then x is found going
+ * up. scratch holds num_beads complex numbers. Returns 1 if a pivot is zero,
+ * 0 otherwise. Each pivot is diag - k^2 / (previous pivot), so positive
+ * damping keeps every pivot in the upper half plane and no pivoting is
+ * needed. */
+static int thomas_solve(const Simulation *sim, const LsResponseOptions *opts,
+        const double *k, double w, double complex *scratch,
+        double complex *x)
+{
+    int n = sim->num_beads;
+    double complex pivot;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        double c = opts->damping != NULL ? opts->damping[i] : 0;
+        double complex rhs = i == opts->drive_bead ? opts->force : 0;
+
+        /* Row i is -k[i] x[i - 1] + diag x[i] - k[i + 1] x[i + 1] */
+        pivot = k[i] + k[i + 1] - w * w * sim->beads[i].mass + I * w * c;
+        if (i > 0)
+        {
+            pivot -= k[i] * scratch[i - 1];
+            rhs += k[i] * x[i - 1];
+        }
+        if (pivot == 0)
+            return 1;
+
+        scratch[i] = k[i + 1] / pivot;
+        x[i] = rhs / pivot;
+    }
+
+    for (i = n - 2; i >= 0; i--)
+        x[i] += scratch[i] * x[i + 1];
+
+    return 0;
+}
+
+static void *run_sweep(void *arg)
+{
+    Sweep *sweep = arg;
+    size_t f;
+
+    for (f = sweep->begin; f < sweep->end; f++)
+        if (thomas_solve(sweep->sim, sweep->opts, sweep->stiffness,
+                    sweep->frequencies[f], sweep->scratch,
+                    sweep->response + f * sweep->sim->num_beads))
+            sweep->status = LS_ERR_SOLVER;
+
+    return NULL;
+}
+
+LsStatus ls_frequency_response(const LsSystem *system,
+        const LsResponseOptions *opts, const double *frequencies, size_t count,
+        const LsAllocator *allocator, double *response)
+{
+    LsAllocator al = ls_allocator_or_default(allocator);
+    const Simulation *sim;
+    Sweep sweeps[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    bool started[MAX_THREADS];
+    double *stiffness;
+    double complex *scratch;
+    LsStatus status = LS_OK;
+    int n, num_threads, t, i;
+
+    if (system == NULL || opts == NULL
+            || (count > 0 && (frequencies == NULL || response == NULL)))
+        return LS_ERR_INVALID;
+
+    sim = ls_system_simulation(system);
+    n = sim->num_beads;
+    if (sim->sim_type == MEMBRANE || sim->periodic || opts->drive_bead < 0
+            || opts->drive_bead >= n || opts->num_threads < 0)
+        return LS_ERR_INVALID;
+    /* Negative damping can zero a pivot; the test also rejects NaN */
+    if (opts->damping != NULL)
+        for (i = 0; i < n; i++)
+            if (!(opts->damping[i] >= 0))
+                return LS_ERR_INVALID;
+    if (count == 0)
+        return LS_OK;
+
+    num_threads = opts->num_threads;
+    if (num_threads == 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > MAX_THREADS)
+        num_threads = MAX_THREADS;
+    if ((size_t)num_threads > count)
+        num_threads = count;
+
+    /* The spring constants, then one elimination buffer per thread */
+    stiffness = ls_alloc(&al, (n + 1) * sizeof(double)
+            + (size_t)num_threads * n * sizeof(double complex));
+    if (stiffness == NULL)
+        return LS_ERR_NOMEM;
+    scratch = (double complex *)(stiffness + n + 1);
+
+    for (i = 0; i <= n; i++)
+        stiffness[i] = spring_constant(sim, sim->connections[i]);
+
+    /* Each thread takes a contiguous block of frequencies, so threads write
+     * to separate parts of response */
+    for (t = 0; t < num_threads; t++)
+    {
+        sweeps[t].sim = sim;
+        sweeps[t].opts = opts;
+        sweeps[t].stiffness = stiffness;
+        sweeps[t].frequencies = frequencies;
+        sweeps[t].begin = count * t / num_threads;
+        sweeps[t].end = count * (t + 1) / num_threads;
+        sweeps[t].response = (double complex *)response;
+        sweeps[t].scratch = scratch + (size_t)t * n;
+        sweeps[t].status = LS_OK;
+
+        /* The calling thread takes the first block */
+        started[t] = t > 0 && !pthread_create(&threads[t], NULL, run_sweep,
+                &sweeps[t]);
+    }
+
+    /* Blocks whose thread could not be started are done here */
+    for (t = 0; t < num_threads; t++)
+        if (!started[t])
+            run_sweep(&sweeps[t]);
+
+    for (t = 0; t < num_threads; t++)
+    {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        if (sweeps[t].status != LS_OK)
+            status = sweeps[t].status;
+    }
+
+    ls_free(&al, stiffness);
+
+    return status;
+}
@@ -0,0 +1,459 @@
+/*----------------------------------------------------------------------------*/
+/* ring.c                                                                     */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <math.h>
+
+#include <gsl/gsl_complex.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_eigen.h>
+#include <gsl/gsl_fft_real.h>
+
+#include "ring.h"
+#include "asolve.h"
+#include "alloc.h"
+
+/* One normal mode of a ring. A Bloch wave of wavenumber q = 2 pi p / cells
+ * is complex unless q is 0 or pi; its real and imaginary parts are two real
+ * modes of the same frequency. */
+typedef struct ring_mode
+{
+    double lambda; /* Squared eigenfrequency */
+    int p; /* Wavenumber index, 0 to cells / 2 */
+    int band; /* Eigenvector of the Bloch matrix of p */
+    int part; /* 0 for the real part of the Bloch wave, 1 for the imaginary
+                 part */
+} RingMode;
+
+/* State of one solve */
+typedef struct bloch
+{
+    const Simulation *sim;
+    int period; /* Beads per cell */
+    int cells; /* Number of cells */
+    double *evals; /* period squared eigenfrequencies per wavenumber, in
+                      ascending order */
+    double *vectors; /* period x period complex entries per wavenumber. Entry
+                        (s, band) is the amplitude of the band on bead s of
+                        every cell. */
+    double *xhat, *vhat; /* cells halfcomplex entries per sublattice: the real
+                            FFTs of sqrt(m) x0 and sqrt(m) v0 over the
+                            cells */
+    double *cosines, *sines; /* cos and sin of 2 pi k / cells */
+    gsl_matrix_complex_view h, hvec; /* Bloch matrix and its eigenvectors */
+    gsl_matrix_view r, rvec; /* The same for real wavenumbers */
+    gsl_vector_view eval;
+    gsl_eigen_hermv_workspace *herm;
+    gsl_eigen_symmv_workspace *symm;
+    gsl_fft_real_wavetable *wavetable;
+    gsl_fft_real_workspace *fft_workspace;
+} Bloch;
+
+int ring_period(const Simulation *sim)
+{
+    int n = sim->num_beads;
+    int l, i;
+
+    assert(sim->periodic);
+
+    for (l = 1; l < n; l++)
+    {
+        if (n % l != 0)
+            continue;
+
+        for (i = l; i < n; i++)
+            if (sim->beads[i].mass != sim->beads[i - l].mass
+                    || sim->connections[i] != sim->connections[i - l])
+                break;
+        if (i == n)
+            return l;
+    }
+
+    return n;
+}
+
+/* Returns true if the Bloch waves of wavenumber p are real, which they are
+ * for q = 0 and q = pi */
+static bool is_real(const Bloch *b, int p)
+{
+    return p == 0 || 2 * p == b->cells;
+}
+
+/* Adds re + i im to entry (i, j) of h */
+static void add_entry(gsl_matrix_complex *h, int i, int j, double re,
+        double im)
+{
+    gsl_complex z = gsl_matrix_complex_get(h, i, j);
+
+    GSL_SET_COMPLEX(&z, GSL_REAL(z) + re, GSL_IMAG(z) + im);
+    gsl_matrix_complex_set(h, i, j, z);
+}
+
+/* Fills the Hermitian Bloch matrix of b for wavenumber p: the dynamical
+ * matrix of one cell, where the connection leaving the cell returns to its
+ * first bead with a phase of e^iq. Entries add, so cells of one or two beads
+ * come out right. */
+static void fill_bloch_matrix(Bloch *b, int p)
+{
+    gsl_matrix_complex *h = &b->h.matrix;
+    const Simulation *sim = b->sim;
+    const Bead *beads = sim->beads;
+    int l = b->period;
+    double corner;
+    int s;
+
+    gsl_matrix_complex_set_zero(h);
+
+    for (s = 0; s < l; s++)
+        add_entry(h, s, s, (spring_constant(sim, sim->connections[s])
+                    + spring_constant(sim, sim->connections[s + 1]))
+                / beads[s].mass, 0);
+
+    for (s = 0; s + 1 < l; s++)
+    {
+        double k = -spring_constant(sim, sim->connections[s + 1])
+            / sqrt(beads[s].mass * beads[s + 1].mass);
+
+        add_entry(h, s, s + 1, k, 0);
+        add_entry(h, s + 1, s, k, 0);
+    }
+
+    /* Connection 0 of each cell joins its first bead to the last bead of the
+     * cell before, which lags by a phase of e^-iq */
+    corner = -spring_constant(sim, sim->connections[0])
+        / sqrt(beads[0].mass * beads[l - 1].mass);
+    add_entry(h, 0, l - 1, corner * b->cosines[p], -corner * b->sines[p]);
+    add_entry(h, l - 1, 0, corner * b->cosines[p], corner * b->sines[p]);
+}
+
+/* Finds the bands of wavenumber p, storing them in b. Real wavenumbers are
+ * solved as real symmetric matrices, so that each band is a real wave even
+ * when bands are degenerate. Returns 1 if an error occured, 0 otherwise. */
+static int solve_bands(Bloch *b, int p)
+{
+    int l = b->period;
+    double *evals = b->evals + (size_t)p * l;
+    double *u = b->vectors + 2 * (size_t)p * l * l;
+    int i, j;
+
+    fill_bloch_matrix(b, p);
+
+    if (is_real(b, p))
+    {
+        for (i = 0; i < l; i++)
+            for (j = 0; j < l; j++)
+                gsl_matrix_set(&b->r.matrix, i, j,
+                        GSL_REAL(gsl_matrix_complex_get(&b->h.matrix, i, j)));
+
+        if (gsl_eigen_symmv(&b->r.matrix, &b->eval.vector, &b->rvec.matrix,
+                    b->symm))
+            return 1;
+        gsl_eigen_symmv_sort(&b->eval.vector, &b->rvec.matrix,
+                GSL_EIGEN_SORT_VAL_ASC);
+
+        for (i = 0; i < l; i++)
+            for (j = 0; j < l; j++)
+            {
+                u[2 * (i * l + j)] = gsl_matrix_get(&b->rvec.matrix, i, j);
+                u[2 * (i * l + j) + 1] = 0;
+            }
+    }
+    else
+    {
+        if (gsl_eigen_hermv(&b->h.matrix, &b->eval.vector, &b->hvec.matrix,
+                    b->herm))
+            return 1;
+        gsl_eigen_hermv_sort(&b->eval.vector, &b->hvec.matrix,
+                GSL_EIGEN_SORT_VAL_ASC);
+
+        for (i = 0; i < l; i++)
+            for (j = 0; j < l; j++)
+            {
+                gsl_complex z = gsl_matrix_complex_get(&b->hvec.matrix, i, j);
+
+                u[2 * (i * l + j)] = GSL_REAL(z);
+                u[2 * (i * l + j) + 1] = GSL_IMAG(z);
+            }
+    }
+
+    for (j = 0; j < l; j++)
+        evals[j] = gsl_vector_get(&b->eval.vector, j);
+
+    return 0;
+}
+
+/* Fills hat with the real FFTs over the cells of the mass weighted initial
+ * displacements, or velocities if velocity is true, of each sublattice.
+ * Returns 1 if an error occured, 0 otherwise. */
+static int transform_ics(Bloch *b, bool velocity, double *hat)
+{
+    const Bead *beads = b->sim->beads;
+    int s, c;
+
+    for (s = 0; s < b->period; s++)
+    {
+        double *column = hat + (size_t)s * b->cells;
+        double sqrtm = sqrt(beads[s].mass);
+
+        for (c = 0; c < b->cells; c++)
+        {
+            const Bead *bead = &beads[(size_t)c * b->period + s];
+
+            column[c] = sqrtm * (velocity ? bead->v0 : bead->x0);
+        }
+
+        if (gsl_fft_real_transform(column, 1, b->cells, b->wavetable,
+                    b->fft_workspace))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Returns the projection of the mass weighted initial conditions, whose
+ * transforms are in hat, onto mode. With psi the unit Bloch wave, the
+ * projection onto sqrt(2) Re psi is sqrt(2) Re(psi^H y), and onto
+ * sqrt(2) Im psi is -sqrt(2) Im(psi^H y). */
+static double project(const Bloch *b, const double *hat, const RingMode *m)
+{
+    int l = b->period;
+    const double *u = b->vectors + 2 * (size_t)m->p * l * l;
+    double re = 0, im = 0;
+    int s;
+
+    for (s = 0; s < l; s++)
+    {
+        const double *column = hat + (size_t)s * b->cells;
+        double ur = u[2 * (s * l + m->band)];
+        double ui = u[2 * (s * l + m->band) + 1];
+        double xr, xi = 0;
+
+        /* Halfcomplex order: the real part of output p is at 2p - 1 and its
+         * imaginary part at 2p, except at 0 and cells / 2, which are real */
+        if (m->p == 0)
+            xr = column[0];
+        else if (2 * m->p == b->cells)
+            xr = column[b->cells - 1];
+        else
+        {
+            xr = column[2 * m->p - 1];
+            xi = column[2 * m->p];
+        }
+
+        re += ur * xr + ui * xi;
+        im += ur * xi - ui * xr;
+    }
+
+    re /= sqrt(b->cells);
+    im /= sqrt(b->cells);
+
+    if (is_real(b, m->p))
+        return re;
+
+    return m->part == 0 ? M_SQRT2 * re : -M_SQRT2 * im;
+}
+
+/* Writes mode, translated back to displacements and normalized, into column j
+ * of the eigenvectors of result. Returns the length of the translated mode
+ * before normalization. */
+static double fill_mode(const Bloch *b, const RingMode *m, int j,
+        Result *result)
+{
+    int l = b->period;
+    const double *u = b->vectors + 2 * (size_t)m->p * l * l;
+    double weight = (is_real(b, m->p) ? 1 : M_SQRT2) / sqrt(b->cells);
+    double mag = 0;
+    int c, s;
+
+    for (c = 0; c < b->cells; c++)
+    {
+        size_t k = (size_t)m->p * c % b->cells;
+
+        for (s = 0; s < l; s++)
+        {
+            double ur = u[2 * (s * l + m->band)];
+            double ui = u[2 * (s * l + m->band) + 1];
+            double re = ur * b->cosines[k] - ui * b->sines[k];
+            double im = ur * b->sines[k] + ui * b->cosines[k];
+            double v = weight * (m->part == 0 ? re : im)
+                / sqrt(b->sim->beads[s].mass);
+
+            result->eigenvectors[(size_t)c * l + s][j] = v;
+            mag += v * v;
+        }
+    }
+
+    mag = sqrt(mag);
+    for (c = 0; c < b->sim->num_beads; c++)
+        result->eigenvectors[c][j] /= mag;
+
+    return mag;
+}
+
+static int compare_mode(const void *p, const void *q)
+{
+    const RingMode *a = p, *b = q;
+
+    if (a->lambda != b->lambda)
+        return a->lambda < b->lambda ? -1 : 1;
+    if (a->p != b->p)
+        return a->p - b->p;
+    if (a->band != b->band)
+        return a->band - b->band;
+    return a->part - b->part;
+}
+
+/* Solves every wavenumber of b and fills result, already laid out, with the
+ * modes in order of frequency. modes holds num_beads entries. */
+static LsStatus find_ring_modes(Bloch *b, RingMode *modes, Result *result)
+{
+    int l = b->period;
+    double max_lambda = 0;
+    int p, band, part, j, count = 0;
+
+    for (p = 0; 2 * p <= b->cells; p++)
+    {
+        if (solve_bands(b, p))
+            return LS_ERR_SOLVER;
+
+        for (band = 0; band < l; band++)
+            for (part = 0; part < (is_real(b, p) ? 1 : 2); part++)
+            {
+                modes[count].lambda = b->evals[(size_t)p * l + band];
+                modes[count].p = p;
+                modes[count].band = band;
+                modes[count].part = part;
+                max_lambda = fmax(max_lambda, modes[count].lambda);
+                count++;
+            }
+    }
+    assert(count == b->sim->num_beads);
+
+    if (transform_ics(b, false, b->xhat) || transform_ics(b, true, b->vhat))
+        return LS_ERR_SOLVER;
+
+    /* The ring can move rigidly; its mode comes out within rounding of 0 */
+    for (j = 0; j < count; j++)
+        if (modes[j].lambda < ZERO_EIGENVALUE_TOL * max_lambda)
+            modes[j].lambda = 0;
+    qsort(modes, count, sizeof(RingMode), compare_mode);
+
+    for (j = 0; j < count; j++)
+    {
+        double mag = fill_mode(b, &modes[j], j, result);
+
+        /* Eigenfrequency = sqrt(eigenvalue) */
+        result->eigenfrequencies[j] = sqrt(modes[j].lambda);
+        result->coefficients[j].a = project(b, b->xhat, &modes[j]) * mag;
+        result->coefficients[j].b = project(b, b->vhat, &modes[j]) * mag;
+
+        /* For velocity terms, we divide by the eigenfrequency since we took
+         * a derivative */
+        if (result->eigenfrequencies[j] > 0)
+            result->coefficients[j].b /= result->eigenfrequencies[j];
+        fix_sign(result, j);
+    }
+
+    return LS_OK;
+}
+
+LsStatus ring_solve(const Simulation *sim, int period,
+        const LsAllocator *allocator, Result *result)
+{
+    Bloch b;
+    RingMode *modes;
+    double *block, *pos;
+    void *arena;
+    size_t n, l, num_p, size;
+    int k;
+    LsStatus status;
+
+    assert(sim != NULL);
+    assert(sim->periodic);
+    assert(period > 0 && period < sim->num_beads);
+    assert(sim->num_beads % period == 0);
+    assert(allocator != NULL);
+    assert(result != NULL);
+
+    n = sim->num_beads;
+    l = period;
+    memset(&b, 0, sizeof(Bloch));
+    b.sim = sim;
+    b.period = period;
+    b.cells = n / l;
+    num_p = b.cells / 2 + 1;
+
+    /* Bands and their vectors for every wavenumber, the transforms, the
+     * trigonometric tables and the Bloch matrices */
+    size = num_p * (l + 2 * l * l) + 2 * n + 2 * b.cells + 6 * l * l + l;
+    block = ls_alloc(allocator, size * sizeof(double));
+    modes = ls_alloc(allocator, n * sizeof(RingMode));
+    arena = ls_alloc(allocator, result_size(n, n));
+
+    /* The FFT tables and eigen workspaces can only use malloc */
+    b.wavetable = gsl_fft_real_wavetable_alloc(b.cells);
+    b.fft_workspace = gsl_fft_real_workspace_alloc(b.cells);
+    b.herm = gsl_eigen_hermv_alloc(l);
+    b.symm = gsl_eigen_symmv_alloc(l);
+
+    if (block == NULL || modes == NULL || arena == NULL
+            || b.wavetable == NULL || b.fft_workspace == NULL
+            || b.herm == NULL || b.symm == NULL)
+    {
+        status = LS_ERR_NOMEM;
+    }
+    else
+    {
+        pos = block;
+        b.evals = pos;
+        pos += num_p * l;
+        b.vectors = pos;
+        pos += 2 * num_p * l * l;
+        b.xhat = pos;
+        pos += n;
+        b.vhat = pos;
+        pos += n;
+        b.cosines = pos;
+        pos += b.cells;
+        b.sines = pos;
+        pos += b.cells;
+        b.h = gsl_matrix_complex_view_array(pos, l, l);
+        pos += 2 * l * l;
+        b.hvec = gsl_matrix_complex_view_array(pos, l, l);
+        pos += 2 * l * l;
+        b.r = gsl_matrix_view_array(pos, l, l);
+        pos += l * l;
+        b.rvec = gsl_matrix_view_array(pos, l, l);
+        pos += l * l;
+        b.eval = gsl_vector_view_array(pos, l);
+        pos += l;
+
+        for (k = 0; k < b.cells; k++)
+        {
+            b.cosines[k] = cos(2 * M_PI * k / b.cells);
+            b.sines[k] = sin(2 * M_PI * k / b.cells);
+        }
+
+        layout_result(arena, n, n, result);
+        status = find_ring_modes(&b, modes, result);
+    }
+
+    if (status != LS_OK)
+        ls_free(allocator, arena);
+    ls_free(allocator, block);
+    ls_free(allocator, modes);
+    gsl_fft_real_wavetable_free(b.wavetable);
+    gsl_fft_real_workspace_free(b.fft_workspace);
+    if (b.herm != NULL)
+        gsl_eigen_hermv_free(b.herm);
+    if (b.symm != NULL)
+        gsl_eigen_symmv_free(b.symm);
+
+    return status;
+}
@@ -0,0 +1,29 @@
+/*----------------------------------------------------------------------------*/
+/* ring.h                                                                     */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef RING_INCLUDED
+#define RING_INCLUDED
+
+#include "types.h"
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. */
+
+/* Returns the smallest number of beads L dividing sim->num_beads such that
+ * the masses and connections of sim, a ring, repeat every L beads. Returns
+ * sim->num_beads if the ring has no shorter period. */
+int ring_period(const Simulation *sim);
+
+/* Solves sim, a ring made of cells of period beads repeated
+ * sim->num_beads / period times, with period < sim->num_beads. Translating
+ * the ring by one cell commutes with its dynamical matrix, so in the basis of
+ * Bloch waves the matrix splits into one period x period block per
+ * wavenumber, and the initial conditions are carried into that basis by a
+ * real FFT over the cells of each sublattice. Allocates the Result arena from
+ * allocator; caller responsible for freeing result with free_result. */
+LsStatus ring_solve(const Simulation *sim, int period,
+        const LsAllocator *allocator, Result *result);
+
+#endif
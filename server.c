@@ -0,0 +1,838 @@
+/*----------------------------------------------------------------------------*/
+/* server.c                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "types.h"
+#include "loadedstring.h"
+
+#define MAX_CONNECTIONS 256
+#define MAX_WORKERS 64
+#define MAX_BATCH 64 /* Requests a worker takes from the queue at once */
+#define MAX_HEADER 32 /* Longest header line */
+#define READ_CHUNK 65536
+#define LATENCY_BUCKETS 128 /* Quarter octaves of microseconds */
+#define MAX_OUTPUT (4 << 20) /* Unsent bytes above which a connection's
+                                requests aren't read */
+#define FLUSH_TIMEOUT_MS 5000 /* Time given to send the last replies when
+                                 stopping */
+
+/* A client connection. It is freed by whichever of the main loop and the
+ * workers lets go of it last. Replies are never sent blocking: what the
+ * socket doesn't take at once waits in out until the main loop sees the
+ * client ready for it, so a client that stops reading holds up nobody. */
+typedef struct connection
+{
+    int fd;
+    pthread_mutex_t lock; /* Serializes writes to fd and guards refs, out
+                             and closed */
+    int refs; /* One for the main loop while the client is connected, and
+                 one per request not yet answered */
+    char *out; /* Bytes of replies not yet sent */
+    size_t out_used, out_size;
+    bool closed; /* The main loop has let go; replies are dropped */
+    char *buf; /* Bytes read but not yet taken as requests */
+    size_t used, size;
+    long next_id; /* Number of the next request */
+} Connection;
+
+/* A queued request */
+typedef struct job
+{
+    Connection *conn;
+    long id;
+    char *text; /* Simulation parameters, length bytes */
+    size_t length;
+    struct timespec received;
+    struct job *next;
+} Job;
+
+typedef struct server
+{
+    int wake[2]; /* Pipe written to when a reply is left waiting, to wake
+                    the main loop */
+    pthread_mutex_t lock; /* Guards everything below */
+    pthread_cond_t ready; /* Signalled when a job is queued or on stopping */
+    Job *head, *tail; /* Queue of requests not yet taken by a worker */
+    int depth; /* Jobs in the queue */
+    int in_progress; /* Jobs taken by workers and not yet answered */
+    bool stopping; /* Workers leave once the queue is empty */
+    int connections;
+    unsigned long requests; /* Requests answered */
+    unsigned long batches; /* Times a worker took jobs from the queue */
+    unsigned long batched; /* Requests solved by ls_batch_solve */
+    unsigned long latency[LATENCY_BUCKETS]; /* Requests answered within each
+                                               quarter octave of
+                                               microseconds of arriving */
+} Server;
+
+typedef struct worker
+{
+    Server *server;
+    pthread_t thread;
+    LsBatch *batches[LS_BATCH_MAX_BEADS + 1]; /* Made on first use, one per
+                                                 number of beads */
+} Worker;
+
+/* A growing string */
+typedef struct text
+{
+    char *data;
+    size_t length, size;
+} Text;
+
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int signum)
+{
+    (void)signum;
+    stop_requested = 1;
+}
+
+/* Appends printf-style output to t. Returns 1 if out of memory, 0
+ * otherwise. */
+static int append(Text *t, const char *format, ...)
+{
+    va_list args;
+    int n;
+
+    for (;;)
+    {
+        va_start(args, format);
+        n = vsnprintf(t->data + t->length, t->size - t->length, format, args);
+        va_end(args);
+        if (n < 0)
+            return 1;
+        if ((size_t)n < t->size - t->length)
+        {
+            t->length += n;
+            return 0;
+        }
+
+        /* Too long: grow and print again */
+        {
+            size_t size = 2 * t->size + n + 1;
+            char *data = realloc(t->data, size);
+
+            if (data == NULL)
+                return 1;
+            t->data = data;
+            t->size = size;
+        }
+    }
+}
+
+/* Returns the time from start to end in microseconds */
+static double elapsed_us(struct timespec start, struct timespec end)
+{
+    return (end.tv_sec - start.tv_sec) * 1e6
+        + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+/* Sends as much of the waiting output of conn as its socket takes without
+ * blocking. Output to a client that has gone away is dropped. Call with
+ * conn->lock held. */
+static void flush_locked(Connection *conn)
+{
+    size_t sent = 0;
+
+    while (sent < conn->out_used)
+    {
+        ssize_t n = send(conn->fd, conn->out + sent, conn->out_used - sent,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            sent = conn->out_used;
+            break;
+        }
+        sent += n;
+    }
+
+    conn->out_used -= sent;
+    memmove(conn->out, conn->out + sent, conn->out_used);
+}
+
+/* Sends the waiting output of conn as far as it goes without blocking */
+static void flush_output(Connection *conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    flush_locked(conn);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/* Returns the number of bytes of output waiting on conn */
+static size_t waiting_output(Connection *conn)
+{
+    size_t used;
+
+    pthread_mutex_lock(&conn->lock);
+    used = conn->out_used;
+    pthread_mutex_unlock(&conn->lock);
+
+    return used;
+}
+
+/* Sends length bytes of data to conn, leaving what its socket doesn't take
+ * at once for the main loop of server to send. If that can't be kept, the
+ * connection is shut down, so that the client sees it end rather than wait
+ * forever. */
+static void send_reply(Server *server, Connection *conn, const char *data,
+        size_t length)
+{
+    bool was_empty, waiting;
+
+    pthread_mutex_lock(&conn->lock);
+    if (conn->closed)
+    {
+        pthread_mutex_unlock(&conn->lock);
+        return;
+    }
+
+    was_empty = conn->out_used == 0;
+    if (conn->out_used + length > conn->out_size)
+    {
+        size_t size = 2 * conn->out_size + length;
+        char *out = realloc(conn->out, size);
+
+        if (out == NULL)
+        {
+            shutdown(conn->fd, SHUT_RDWR);
+            pthread_mutex_unlock(&conn->lock);
+            return;
+        }
+        conn->out = out;
+        conn->out_size = size;
+    }
+    memcpy(conn->out + conn->out_used, data, length);
+    conn->out_used += length;
+    if (was_empty)
+        flush_locked(conn);
+    waiting = conn->out_used > 0;
+    pthread_mutex_unlock(&conn->lock);
+
+    /* The main loop only watches for the client being ready to read while
+     * output is waiting. If the pipe is full, it is waking anyway. */
+    if (was_empty && waiting)
+    {
+        ssize_t n = write(server->wake[1], "", 1);
+
+        (void)n;
+    }
+}
+
+/* Lets go of one reference to conn, freeing it if it was the last */
+static void release(Connection *conn)
+{
+    int refs;
+
+    pthread_mutex_lock(&conn->lock);
+    refs = --conn->refs;
+    pthread_mutex_unlock(&conn->lock);
+
+    if (refs > 0)
+        return;
+
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn->buf);
+    free(conn->out);
+    free(conn);
+}
+
+/* Returns the upper edge, in microseconds, of the latency bucket below which
+ * fraction of the answered requests of server fall. Call with the lock
+ * held. */
+static double latency_percentile(const Server *server, double fraction)
+{
+    unsigned long total = 0, seen = 0;
+    int k;
+
+    for (k = 0; k < LATENCY_BUCKETS; k++)
+        total += server->latency[k];
+    if (total == 0)
+        return 0;
+
+    for (k = 0; k < LATENCY_BUCKETS; k++)
+    {
+        seen += server->latency[k];
+        if (seen >= fraction * total)
+            break;
+    }
+
+    return pow(2, (k + 1) / 4.0);
+}
+
+/* Answers the stats request id on conn with the counters of server */
+static void send_stats(Server *server, Connection *conn, long id)
+{
+    char line[512];
+    int n;
+
+    pthread_mutex_lock(&server->lock);
+    n = snprintf(line, sizeof(line), "{\"id\":%ld,\"status\":\"ok\","
+            "\"queue_depth\":%d,\"in_progress\":%d,\"connections\":%d,"
+            "\"requests\":%lu,\"batches\":%lu,\"batched\":%lu,"
+            "\"latency_us\":{\"p50\":%.0f,\"p90\":%.0f,\"p99\":%.0f}}\n",
+            id, server->depth, server->in_progress, server->connections,
+            server->requests, server->batches, server->batched,
+            latency_percentile(server, 0.50),
+            latency_percentile(server, 0.90),
+            latency_percentile(server, 0.99));
+    pthread_mutex_unlock(&server->lock);
+
+    send_reply(server, conn, line, n);
+}
+
+/* Appends the array of count values to t as JSON. Returns 1 if out of
+ * memory, 0 otherwise. */
+static int append_array(Text *t, const char *name, const double *values,
+        const Coefficient *coefficients, int which, int count)
+{
+    int j;
+
+    if (append(t, ",\"%s\":[", name))
+        return 1;
+    for (j = 0; j < count; j++)
+    {
+        double v = values != NULL ? values[j]
+            : which == 0 ? coefficients[j].a : coefficients[j].b;
+
+        if (append(t, j > 0 ? ",%.17g" : "%.17g", v))
+            return 1;
+    }
+
+    return append(t, "]");
+}
+
+/* Answers job with result, or with status if result is NULL, records its
+ * latency in server and frees it */
+static void answer(Server *server, Job *job, LsStatus status,
+        const Result *result)
+{
+    Text t = {NULL, 0, 0};
+    struct timespec now;
+    double us;
+    int k;
+
+    if (result == NULL)
+        append(&t, "{\"id\":%ld,\"status\":\"error\",\"error\":\"%s\"}\n",
+                job->id, ls_strerror(status));
+    else if (append(&t, "{\"id\":%ld,\"status\":\"ok\",\"num_modes\":%d",
+                job->id, result->num_modes)
+            || append_array(&t, "frequencies", result->eigenfrequencies,
+                NULL, 0, result->num_modes)
+            || append_array(&t, "a", NULL, result->coefficients, 0,
+                result->num_modes)
+            || append_array(&t, "b", NULL, result->coefficients, 1,
+                result->num_modes)
+            || append(&t, "}\n"))
+    {
+        t.length = 0;
+        append(&t, "{\"id\":%ld,\"status\":\"error\",\"error\":\"%s\"}\n",
+                job->id, ls_strerror(LS_ERR_NOMEM));
+    }
+
+    if (t.data != NULL)
+        send_reply(server, job->conn, t.data, t.length);
+    free(t.data);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = elapsed_us(job->received, now);
+    k = us < 1 ? 0 : (int)(4 * log2(us));
+    if (k >= LATENCY_BUCKETS)
+        k = LATENCY_BUCKETS - 1;
+
+    pthread_mutex_lock(&server->lock);
+    server->latency[k]++;
+    server->requests++;
+    server->in_progress--;
+    pthread_mutex_unlock(&server->lock);
+
+    release(job->conn);
+    free(job->text);
+    free(job);
+}
+
+/* Parses and solves count jobs taken together by w, and answers them.
+ * Strings and springs of the same small size are solved by one batch; the
+ * rest one by one. */
+static void solve_jobs(Worker *w, Job **jobs, int count)
+{
+    LsSystem *systems[MAX_BATCH];
+    Simulation sims[MAX_BATCH];
+    int members[MAX_BATCH];
+    const Result *results;
+    LsSolution *solution;
+    LsStatus status;
+    int n, k, m, num_members;
+
+    for (k = 0; k < count; k++)
+        if ((status = ls_system_parse(jobs[k]->text, jobs[k]->length, NULL,
+                        &systems[k])) != LS_OK)
+        {
+            systems[k] = NULL;
+            answer(w->server, jobs[k], status, NULL);
+            jobs[k] = NULL;
+        }
+
+    for (n = 1; n <= LS_BATCH_MAX_BEADS; n++)
+    {
+        for (k = 0, num_members = 0; k < count; k++)
+            if (jobs[k] != NULL
+                    && ls_system_simulation(systems[k])->num_beads == n
+                    && ls_system_simulation(systems[k])->sim_type != MEMBRANE)
+            {
+                sims[num_members] = *ls_system_simulation(systems[k]);
+                members[num_members++] = k;
+            }
+        if (num_members == 0)
+            continue;
+
+        /* A batch that can't be made or solved leaves its jobs to be
+         * solved one by one */
+        if (w->batches[n] == NULL
+                && ls_batch_create(n, MAX_BATCH, NULL, &w->batches[n])
+                != LS_OK)
+            continue;
+        if (ls_batch_solve(w->batches[n], sims, num_members, &results)
+                != LS_OK)
+            continue;
+
+        for (m = 0; m < num_members; m++)
+        {
+            k = members[m];
+            answer(w->server, jobs[k], LS_OK, &results[m]);
+            jobs[k] = NULL;
+        }
+
+        pthread_mutex_lock(&w->server->lock);
+        w->server->batched += num_members;
+        pthread_mutex_unlock(&w->server->lock);
+    }
+
+    for (k = 0; k < count; k++)
+    {
+        if (jobs[k] != NULL)
+        {
+            if ((status = ls_solve(systems[k], NULL, &solution)) != LS_OK)
+                answer(w->server, jobs[k], status, NULL);
+            else
+            {
+                answer(w->server, jobs[k], LS_OK,
+                        ls_solution_result(solution));
+                ls_solution_free(solution);
+            }
+        }
+        ls_system_free(systems[k]);
+    }
+}
+
+/* Takes every queued job, up to MAX_BATCH at a time, and solves them, until
+ * the server stops and the queue is empty */
+static void *run_worker(void *arg)
+{
+    Worker *w = arg;
+    Server *server = w->server;
+    Job *jobs[MAX_BATCH];
+    int count;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while (server->head == NULL && !server->stopping)
+            pthread_cond_wait(&server->ready, &server->lock);
+        if (server->head == NULL)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+
+        for (count = 0; count < MAX_BATCH && server->head != NULL; count++)
+        {
+            jobs[count] = server->head;
+            server->head = server->head->next;
+        }
+        if (server->head == NULL)
+            server->tail = NULL;
+        server->depth -= count;
+        server->in_progress += count;
+        server->batches++;
+        pthread_mutex_unlock(&server->lock);
+
+        solve_jobs(w, jobs, count);
+    }
+
+    return NULL;
+}
+
+/* Queues a request of length bytes of text from conn. Returns 1 if out of
+ * memory, 0 otherwise. */
+static int enqueue(Server *server, Connection *conn, const char *text,
+        size_t length)
+{
+    Job *job = malloc(sizeof(Job));
+
+    if (job == NULL || (job->text = malloc(length + 1)) == NULL)
+    {
+        free(job);
+        return 1;
+    }
+
+    memcpy(job->text, text, length);
+    job->length = length;
+    job->conn = conn;
+    job->id = conn->next_id++;
+    job->next = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &job->received);
+
+    pthread_mutex_lock(&conn->lock);
+    conn->refs++;
+    pthread_mutex_unlock(&conn->lock);
+
+    pthread_mutex_lock(&server->lock);
+    if (server->tail != NULL)
+        server->tail->next = job;
+    else
+        server->head = job;
+    server->tail = job;
+    server->depth++;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+
+    return 0;
+}
+
+/* Reads what conn has sent and queues every whole request in it. Returns 1
+ * if the connection should be closed: the client has hung up or sent a
+ * malformed header. */
+static int read_requests(Server *server, Connection *conn)
+{
+    ssize_t n;
+
+    if (conn->size - conn->used < READ_CHUNK)
+    {
+        size_t size = 2 * conn->size + READ_CHUNK;
+        char *buf = realloc(conn->buf, size);
+
+        if (buf == NULL)
+            return 1;
+        conn->buf = buf;
+        conn->size = size;
+    }
+
+    n = read(conn->fd, conn->buf + conn->used, conn->size - conn->used);
+    if (n < 0 && errno == EINTR)
+        return 0;
+    if (n <= 0)
+        return 1;
+    conn->used += n;
+
+    for (;;)
+    {
+        char *newline = memchr(conn->buf, '\n', conn->used);
+        size_t header, length;
+        char *end;
+
+        if (newline == NULL)
+            return conn->used > MAX_HEADER;
+        header = newline - conn->buf + 1;
+        *newline = '\0';
+
+        if (!strcmp(conn->buf, "stats"))
+        {
+            send_stats(server, conn, conn->next_id++);
+            length = 0;
+        }
+        else
+        {
+            length = strtoul(conn->buf, &end, 10);
+            if (end == conn->buf || *end != '\0'
+                    || length > SERVER_MAX_PAYLOAD)
+                return 1;
+
+            /* Wait for the rest of the payload */
+            if (conn->used < header + length)
+            {
+                *newline = '\n';
+                return 0;
+            }
+
+            if (enqueue(server, conn, conn->buf + header, length))
+                return 1;
+        }
+
+        conn->used -= header + length;
+        memmove(conn->buf, conn->buf + header + length, conn->used);
+    }
+}
+
+/* Opens a listening socket at path, replacing a stale socket there. Returns
+ * its descriptor, or -1 on failure. */
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path %s is too long.\n", path);
+        return -1;
+    }
+
+    /* Only a socket is replaced, never another kind of file */
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+            || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(fd, SOMAXCONN) < 0)
+    {
+        fprintf(stderr, "Failed to listen on %s: %s.\n", path,
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Accepts a client on listener into conns, which holds *num_conns
+ * connections */
+static void accept_client(Server *server, int listener, Connection **conns,
+        int *num_conns)
+{
+    Connection *conn;
+    int fd;
+
+    if ((fd = accept(listener, NULL, NULL)) < 0)
+        return;
+    if (*num_conns == MAX_CONNECTIONS
+            || (conn = calloc(1, sizeof(Connection))) == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    conn->fd = fd;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->lock, NULL);
+    conns[(*num_conns)++] = conn;
+
+    pthread_mutex_lock(&server->lock);
+    server->connections++;
+    pthread_mutex_unlock(&server->lock);
+}
+
+/* Stops reading from conn. It stays open until its last request is
+ * answered, but replies to it are dropped. */
+static void disconnect(Server *server, Connection *conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    conn->closed = true;
+    pthread_mutex_unlock(&conn->lock);
+
+    pthread_mutex_lock(&server->lock);
+    server->connections--;
+    pthread_mutex_unlock(&server->lock);
+
+    release(conn);
+}
+
+/* Sends what output is left on the num_conns connections conns, waiting at
+ * most FLUSH_TIMEOUT_MS for clients to take it */
+static void flush_all(Connection **conns, int num_conns)
+{
+    static struct pollfd fds[MAX_CONNECTIONS];
+    static Connection *waiting[MAX_CONNECTIONS];
+    struct timespec start, now;
+    int i, k, left;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        for (i = 0, k = 0; i < num_conns; i++)
+            if (waiting_output(conns[i]) > 0)
+            {
+                waiting[k] = conns[i];
+                fds[k].fd = conns[i]->fd;
+                fds[k++].events = POLLOUT;
+            }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = FLUSH_TIMEOUT_MS - elapsed_us(start, now) / 1e3;
+        if (k == 0 || left <= 0 || poll(fds, k, left) < 0)
+            return;
+
+        for (i = 0; i < k; i++)
+            if (fds[i].revents)
+                flush_output(waiting[i]);
+    }
+}
+
+int run_server(const char *socket_path)
+{
+    static Connection *conns[MAX_CONNECTIONS];
+    static struct pollfd fds[MAX_CONNECTIONS + 2];
+    static Worker workers[MAX_WORKERS];
+    Server server;
+    struct sigaction action;
+    int listener, num_conns = 0, num_workers, started = 0;
+    int i, n;
+    char drain[256];
+
+    if ((listener = open_socket(socket_path)) < 0)
+        return 1;
+
+    memset(&server, 0, sizeof(server));
+    if (pipe(server.wake) < 0
+            || fcntl(server.wake[0], F_SETFL, O_NONBLOCK) < 0
+            || fcntl(server.wake[1], F_SETFL, O_NONBLOCK) < 0)
+    {
+        fprintf(stderr, "Failed to make a pipe: %s.\n", strerror(errno));
+        close(listener);
+        unlink(socket_path);
+        return 1;
+    }
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+
+    /* No SA_RESTART, so that a signal wakes up poll */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 1)
+        num_workers = 1;
+    if (num_workers > MAX_WORKERS)
+        num_workers = MAX_WORKERS;
+    for (i = 0; i < num_workers; i++)
+    {
+        memset(&workers[i], 0, sizeof(Worker));
+        workers[i].server = &server;
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]))
+            break;
+        started++;
+    }
+    if (started == 0)
+    {
+        fprintf(stderr, "Failed to start any workers.\n");
+        close(server.wake[0]);
+        close(server.wake[1]);
+        close(listener);
+        unlink(socket_path);
+        return 1;
+    }
+
+    printf("Serving on %s with %d workers\n", socket_path, started);
+    fflush(stdout);
+
+    while (!stop_requested)
+    {
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        fds[1].fd = server.wake[0];
+        fds[1].events = POLLIN;
+        for (i = 0; i < num_conns; i++)
+        {
+            size_t waiting = waiting_output(conns[i]);
+
+            /* A client that doesn't take its replies has its requests left
+             * unread until it does */
+            fds[i + 2].fd = conns[i]->fd;
+            fds[i + 2].events = (waiting < MAX_OUTPUT ? POLLIN : 0)
+                | (waiting > 0 ? POLLOUT : 0);
+        }
+
+        if ((n = poll(fds, num_conns + 2, -1)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to poll: %s.\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+            while (read(server.wake[0], drain, sizeof(drain)) > 0)
+                ;
+
+        /* Backwards, so that a closed connection can be replaced by the
+         * last */
+        for (i = num_conns - 1; i >= 0; i--)
+        {
+            if (fds[i + 2].revents & POLLOUT)
+                flush_output(conns[i]);
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)
+                    && read_requests(&server, conns[i]))
+            {
+                disconnect(&server, conns[i]);
+                conns[i] = conns[--num_conns];
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+            accept_client(&server, listener, conns, &num_conns);
+    }
+
+    printf("Stopping: answering queued requests\n");
+
+    close(listener);
+    unlink(socket_path);
+
+    pthread_mutex_lock(&server.lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.ready);
+    pthread_mutex_unlock(&server.lock);
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        for (n = 0; n <= LS_BATCH_MAX_BEADS; n++)
+            ls_batch_free(workers[i].batches[n]);
+    }
+
+    flush_all(conns, num_conns);
+    for (i = 0; i < num_conns; i++)
+        disconnect(&server, conns[i]);
+    close(server.wake[0]);
+    close(server.wake[1]);
+
+    printf("Answered %lu requests in %lu batches\n", server.requests,
+            server.batches);
+
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.lock);
+
+    return 0;
+}
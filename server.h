@@ -0,0 +1,43 @@
+/*----------------------------------------------------------------------------*/
+/* server.h                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SERVER_INCLUDED
+#define SERVER_INCLUDED
+
+/* The solver server listens on a Unix domain stream socket. A client sends
+ * any number of requests on one connection without waiting for replies. Each
+ * request is a header line followed by its payload:
+ *
+ *     LENGTH\n       then LENGTH bytes of simulation parameters, in the format
+ *                    of the files in examples/
+ *     stats\n        no payload; asks for the server's counters
+ *
+ * Requests are numbered from 0 on each connection. Every request is answered
+ * by one line of JSON carrying its number, though not necessarily in order:
+ *
+ *     {"id":0,"status":"ok","num_modes":N,"frequencies":[...],"a":[...],
+ *      "b":[...]}
+ *     {"id":1,"status":"error","error":"..."}
+ *     {"id":2,"status":"ok","queue_depth":Q,"in_progress":P,
+ *      "connections":C,"requests":R,"batches":B,"batched":S,
+ *      "latency_us":{"p50":...,"p90":...,"p99":...}}
+ *
+ * frequencies are the eigenfrequencies in rad/s and a and b the cosine and
+ * sine coefficients of each mode, as ./simulate -p prints them. A malformed
+ * header closes the connection. Replies are sent without blocking; a client
+ * that stops reading them has its further requests left unread until it
+ * catches up, and holds up no other client. */
+
+#define SERVER_MAX_PAYLOAD (64 << 20) /* Longest request payload, in bytes */
+
+/* Serves solves on a new socket at socket_path, replacing a stale socket left
+ * there, until SIGINT or SIGTERM. Requests from every connection go on one
+ * queue, drained by one worker thread per CPU; a worker takes every queued
+ * request at once, up to a batch, so that requests arriving together are
+ * solved together, strings and springs of the same small size by one
+ * ls_batch_solve. Returns 1 if an error occured, 0 otherwise. */
+int run_server(const char *socket_path);
+
+#endif
@@ -0,0 +1,361 @@
+/*----------------------------------------------------------------------------*/
+/* session.c                                                                  */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <limits.h>
+
+#include "session.h"
+#include "types.h"
+#include "loadedstring.h"
+#include "plot.h"
+
+#define MAX_INPUT_LENGTH 255
+#define MAX_ARGS 4
+
+/* Everything that stays resident between commands */
+typedef struct session
+{
+    char path[PATH_MAX]; /* Simulation parameter file, as given */
+    LsSystem *system;
+    LsSolution *solution;
+    AnimationOptions opts; /* Options used by the animate command */
+    char publish_name[MAX_INPUT_LENGTH + 1]; /* Frame ring name
+                                                opts.publish_name points to */
+    FILE *gnuplot; /* The one gnuplot process all plots go to */
+} Session;
+
+static void print_help(void)
+{
+    printf("Commands:\n");
+    printf("  print                      print eigenfrequencies, eigenvectors "
+            "and coefficients\n");
+    printf("  eigenfrequencies           plot eigenfrequencies\n");
+    printf("  amplitudes                 plot mode amplitudes\n");
+    printf("  modes N                    plot normal mode N\n");
+    printf("  animate [TIME_SCALE] [gif] animate the simulation\n");
+    printf("  float on|off               single precision animation frames\n");
+    printf("  keep FRACTION              animate only modes carrying FRACTION "
+            "of the mode energy\n");
+    printf("  rate FPS                   animate at FPS frames per second, "
+            "filtering out faster modes; 0 resolves every mode\n");
+    printf("  publish NAME|off           also publish animation frames to "
+            "the shared memory ring NAME\n");
+    printf("  set mass|x0|v0 I VALUE     change bead I and update the "
+            "solution\n");
+    printf("  set connection I VALUE     change connection I (1 is the left "
+            "wall) and update the solution\n");
+    printf("  set tension VALUE          change the string tension and "
+            "re-solve\n");
+    printf("  reload                     re-import the file and re-solve\n");
+    printf("  quit                       leave the session\n");
+}
+
+/* Imports the parameter file path into system. Returns 1 if an error
+ * occured, 0 otherwise. */
+static int load(const char *path, LsSystem **system)
+{
+    LsStatus status;
+
+    if ((status = ls_system_load(path, NULL, system)) != LS_OK)
+    {
+        fprintf(stderr, "Failed to import data: %s.\n", ls_strerror(status));
+        return 1;
+    }
+
+    printf("Finished importing data from %s\n\n",
+            ls_system_simulation(*system)->filename);
+
+    return 0;
+}
+
+/* Solves system into solution. Returns 1 if an error occured, 0 otherwise. */
+static int solve_system(const LsSystem *system, LsSolution **solution)
+{
+    LsStatus status;
+
+    print_setup(*ls_system_simulation(system));
+    if ((status = ls_solve(system, NULL, solution)) != LS_OK)
+    {
+        fprintf(stderr, "Failed to solve: %s.\n", ls_strerror(status));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Solves the system of session again, replacing its solution. The old
+ * solution is kept if the solve fails. Returns 1 if an error occured, 0
+ * otherwise. */
+static int solve(Session *session)
+{
+    LsSolution *solution;
+
+    if (solve_system(session->system, &solution))
+        return 1;
+
+    ls_solution_free(session->solution);
+    session->solution = solution;
+
+    return 0;
+}
+
+/* Imports the parameter file of session again and solves it, replacing both
+ * the system and the solution of session only if both succeed, so the two
+ * always have the same beads. Returns 1 if an error occured, 0 otherwise. */
+static int reload(Session *session)
+{
+    LsSystem *system;
+    LsSolution *solution;
+
+    if (load(session->path, &system))
+        return 1;
+    if (solve_system(system, &solution))
+    {
+        ls_system_free(system);
+        return 1;
+    }
+
+    ls_solution_free(session->solution);
+    ls_system_free(session->system);
+    session->system = system;
+    session->solution = solution;
+
+    return 0;
+}
+
+/* Handles status, returned by an update of the solution of session. The
+ * solution is solved again if the update failed after the value was accepted,
+ * and freed if that fails too, leaving the session without a solution until
+ * the next reload. Returns 1 if the value was rejected, 0 otherwise. */
+static int check_update(Session *session, LsStatus status)
+{
+    if (status == LS_OK)
+        return 0;
+    if (status == LS_ERR_INVALID)
+        return 1;
+
+    fprintf(stderr, "Failed to update: %s.\n", ls_strerror(status));
+    if (solve(session))
+    {
+        ls_solution_free(session->solution);
+        session->solution = NULL;
+        fprintf(stderr, "No solution left; 'reload' to solve again.\n");
+    }
+
+    return 0;
+}
+
+/* Applies "set FIELD [I] VALUE" to the system of session and brings its
+ * solution up to date. A change to one bead or connection updates the
+ * solution in place; a new tension solves again. Returns 1 if the command was
+ * malformed or the value rejected, 0 otherwise. */
+static int set_field(Session *session, char **args, int num_args)
+{
+    const Simulation *sim = ls_system_simulation(session->system);
+    Bead bead;
+    int index;
+    double value;
+
+    if (num_args == 3 && !strcasecmp(args[1], "tension"))
+    {
+        if (ls_system_set_tension(session->system, atof(args[2])) != LS_OK)
+            return 1;
+        solve(session);
+        return 0;
+    }
+
+    if (num_args != 4)
+        return 1;
+
+    index = atoi(args[2]);
+    value = atof(args[3]);
+
+    if (!strcasecmp(args[1], "connection"))
+    {
+        if (index < 1 || index > sim->num_beads + 1)
+        {
+            fprintf(stderr, "Connection must be 1-%d.\n", sim->num_beads + 1);
+            return 1;
+        }
+        return check_update(session, ls_update_connection(session->system,
+                    session->solution, index - 1, value));
+    }
+
+    if (index < 1 || index > sim->num_beads)
+    {
+        fprintf(stderr, "Bead must be 1-%d.\n", sim->num_beads);
+        return 1;
+    }
+
+    bead = sim->beads[index - 1];
+    if (!strcasecmp(args[1], "mass"))
+        bead.mass = value;
+    else if (!strcasecmp(args[1], "x0"))
+        bead.x0 = value;
+    else if (!strcasecmp(args[1], "v0"))
+        bead.v0 = value;
+    else
+        return 1;
+
+    return check_update(session, ls_update_bead(session->system,
+                session->solution, index - 1, bead));
+}
+
+/* Runs one command. Returns 1 if the session should end, 0 otherwise. */
+static int run_command(Session *session, char **args, int num_args)
+{
+    const char *cmd = args[0];
+    Simulation sim = *ls_system_simulation(session->system);
+    Result result;
+
+    /* Only these commands can run while a failed update has left the session
+     * without a solution */
+    if (session->solution == NULL && strcasecmp(cmd, "quit")
+            && strcasecmp(cmd, "q") && strcasecmp(cmd, "help")
+            && strcasecmp(cmd, "reload"))
+    {
+        fprintf(stderr, "No solution; 'reload' to solve again.\n");
+        return 0;
+    }
+    if (session->solution != NULL)
+        result = *ls_solution_result(session->solution);
+
+    if (!strcasecmp(cmd, "quit") || !strcasecmp(cmd, "q"))
+        return 1;
+    else if (!strcasecmp(cmd, "help"))
+        print_help();
+    else if (!strcasecmp(cmd, "print") || !strcasecmp(cmd, "p"))
+        print_result(result);
+    else if (!strcasecmp(cmd, "eigenfrequencies") || !strcasecmp(cmd, "e"))
+        draw_eigenfrequencies(session->gnuplot, result);
+    else if (!strcasecmp(cmd, "amplitudes") || !strcasecmp(cmd, "a"))
+        draw_mode_amplitudes(session->gnuplot, result);
+    else if (!strcasecmp(cmd, "modes") || !strcasecmp(cmd, "m"))
+    {
+        int modenum = num_args > 1 ? atoi(args[1]) : 1;
+
+        if (modenum < 1 || modenum > result.num_modes)
+            fprintf(stderr, "Mode must be 1-%d.\n", result.num_modes);
+        else
+            draw_normal_mode(session->gnuplot, result, sim, modenum);
+    }
+    else if (!strcasecmp(cmd, "animate") || !strcasecmp(cmd, "s"))
+    {
+        int argnum;
+
+        session->opts.time_scale = 1.0;
+        session->opts.save_gif = false;
+        for (argnum = 1; argnum < num_args; argnum++)
+        {
+            if (!strcasecmp(args[argnum], "gif"))
+                session->opts.save_gif = true;
+            else if (atof(args[argnum]) > 0)
+                session->opts.time_scale = atof(args[argnum]);
+        }
+
+        animate_with(session->gnuplot, result, sim, session->opts);
+    }
+    else if (!strcasecmp(cmd, "float") && num_args == 2)
+        session->opts.single_precision = !strcasecmp(args[1], "on");
+    else if (!strcasecmp(cmd, "keep") && num_args == 2)
+    {
+        double fraction = atof(args[1]);
+
+        if (fraction > 0 && fraction <= 1)
+            session->opts.energy_fraction = fraction;
+        else
+            fprintf(stderr, "Energy fraction must be in (0, 1].\n");
+    }
+    else if (!strcasecmp(cmd, "publish") && num_args == 2)
+    {
+        if (!strcasecmp(args[1], "off"))
+            session->opts.publish_name = NULL;
+        else
+        {
+            strcpy(session->publish_name, args[1]);
+            session->opts.publish_name = session->publish_name;
+        }
+    }
+    else if (!strcasecmp(cmd, "rate") && num_args == 2)
+    {
+        double rate = atof(args[1]);
+
+        if (rate >= 0)
+            session->opts.frame_rate = rate;
+        else
+            fprintf(stderr, "Frame rate must not be negative.\n");
+    }
+    else if (!strcasecmp(cmd, "set"))
+    {
+        if (set_field(session, args, num_args))
+            fprintf(stderr, "Usage: set mass|x0|v0|connection I VALUE, "
+                    "set tension VALUE. Values must keep the system "
+                    "solvable.\n");
+    }
+    else if (!strcasecmp(cmd, "reload"))
+    {
+        if (reload(session))
+            fprintf(stderr, "Failed to reload %s, keeping the old setup.\n",
+                    session->path);
+    }
+    else
+        fprintf(stderr, "Unknown command. Type 'help' for a list.\n");
+
+    return 0;
+}
+
+int run_session(const char *filename)
+{
+    Session session;
+    char line[MAX_INPUT_LENGTH];
+    char *args[MAX_ARGS + 1];
+    int num_args;
+
+    assert(filename != NULL);
+
+    if (strlen(filename) >= PATH_MAX)
+    {
+        fprintf(stderr, "File name too long.\n");
+        return 1;
+    }
+
+    memset(&session, 0, sizeof(Session));
+    strcpy(session.path, filename);
+    session.opts.time_scale = 1.0;
+    session.opts.energy_fraction = 1.0;
+
+    if (load(session.path, &session.system))
+        return 1;
+    if (solve(&session))
+    {
+        ls_system_free(session.system);
+        return 1;
+    }
+    session.gnuplot = open_gnuplot();
+
+    printf("Type 'help' for a list of commands.\n");
+    while (printf("> "), fflush(stdout), fgets(line, MAX_INPUT_LENGTH, stdin))
+    {
+        num_args = 0;
+        args[num_args] = strtok(line, " \t\n");
+        while (args[num_args] != NULL && num_args < MAX_ARGS)
+            args[++num_args] = strtok(NULL, " \t\n");
+
+        if (num_args == 0)
+            continue;
+        if (run_command(&session, args, num_args))
+            break;
+    }
+
+    pclose(session.gnuplot);
+    ls_solution_free(session.solution);
+    ls_system_free(session.system);
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*----------------------------------------------------------------------------*/
+/* session.h                                                                  */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SESSION_INCLUDED
+#define SESSION_INCLUDED
+
+/* Runs an interactive session on the simulation parameter file filename. The
+ * system is imported and solved once, and a single gnuplot process is kept
+ * open for every plot. Commands are read from stdin until "quit" or EOF; type
+ * "help" for a list. Returns 1 if an error occured, 0 otherwise. */
+int run_session(const char *filename);
+
+#endif
@@ -0,0 +1,181 @@
+/*----------------------------------------------------------------------------*/
+/* shmview.c                                                                  */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "publish.h"
+
+#define POLL_INTERVAL_NS 10000000 /* 10 ms between looks at the ring */
+#define MAX_RETRIES 16 /* Torn reads of one frame before skipping it */
+
+/* Opens the frame ring name read-only, waiting for it to appear. Returns the
+ * mapped header and sets *size, or returns NULL on failure. */
+static const RingHeader *open_ring(const char *name, size_t *size)
+{
+    struct timespec pause = {0, POLL_INTERVAL_NS};
+    const RingHeader *header;
+    struct stat st;
+    int fd;
+
+    while ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+    {
+        if (errno != ENOENT)
+            return NULL;
+        nanosleep(&pause, NULL);
+    }
+
+    /* The producer sizes the object just after creating it */
+    while (fstat(fd, &st) == 0 && (size_t)st.st_size < RING_HEADER_SIZE)
+        nanosleep(&pause, NULL);
+    if ((size_t)st.st_size < RING_HEADER_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+        return NULL;
+
+    /* The magic is written last */
+    while (memcmp(header->magic, "LSRING\0\0", 8))
+        nanosleep(&pause, NULL);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (header->version != RING_VERSION
+            || ring_size(header->num_points) > (size_t)st.st_size)
+    {
+        munmap((void *)header, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+
+    return header;
+}
+
+/* Copies frame n of the ring into t and displacements if it is still there
+ * and complete. Returns 1 if it was overwritten or torn, 0 otherwise. */
+static int read_frame(const RingHeader *header, const uint64_t *slots,
+        uint64_t n, double *t, double *displacements)
+{
+    const uint64_t *slot = slots + (n % header->num_slots)
+        * (2 + (size_t)header->num_points);
+    uint64_t before, after;
+
+    before = __atomic_load_n(&slot[0], __ATOMIC_ACQUIRE);
+    if (before != 2 * n + 2)
+        return 1;
+    memcpy(t, slot + 1, sizeof(double));
+    memcpy(displacements, slot + 2, header->num_points * sizeof(double));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&slot[0], __ATOMIC_RELAXED);
+
+    return before != after;
+}
+
+/* Watches the frame ring NAME published by ./simulate -w NAME, printing one
+ * line per frame read: its number, time, the largest displacement and where
+ * it is. Frames overwritten before they could be read are counted as
+ * skipped. Reading never holds up the animation. Exits once the animation
+ * has finished.
+ *
+ * Usage:
+ * ./shmview NAME
+ */
+int main(int argc, char *argv[])
+{
+    struct timespec pause = {0, POLL_INTERVAL_NS};
+    const RingHeader *header;
+    const double *rest;
+    const uint64_t *slots;
+    double *displacements, t;
+    char name[256];
+    uint64_t next = 0, latest, skipped = 0, shown = 0;
+    size_t size;
+    int i, retries;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s NAME\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    snprintf(name, sizeof(name), "%s%s", argv[1][0] == '/' ? "" : "/",
+            argv[1]);
+
+    if ((header = open_ring(name, &size)) == NULL)
+    {
+        fprintf(stderr, "Failed to open frame ring %s.\n", name);
+        return EXIT_FAILURE;
+    }
+    rest = (const double *)((const char *)header + RING_HEADER_SIZE);
+    slots = (const uint64_t *)(rest + 2 * header->num_points);
+    if ((displacements = malloc(header->num_points * sizeof(double))) == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%u points, %s displacements, %.6g s between frames\n",
+            header->num_points, header->flags & RING_LONGITUDINAL
+            ? "longitudinal" : "transverse", header->timestep);
+
+    for (;;)
+    {
+        latest = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+
+        /* Frames older than the ring holds are gone */
+        if (latest > next + header->num_slots)
+        {
+            skipped += latest - header->num_slots - next;
+            next = latest - header->num_slots;
+        }
+
+        for (; next < latest; next++)
+        {
+            int peak = 0;
+
+            for (retries = 0; retries < MAX_RETRIES; retries++)
+                if (!read_frame(header, slots, next, &t, displacements))
+                    break;
+            if (retries == MAX_RETRIES)
+            {
+                skipped++;
+                continue;
+            }
+
+            for (i = 1; i < (int)header->num_points; i++)
+                if (fabs(displacements[i]) > fabs(displacements[peak]))
+                    peak = i;
+            printf("frame %llu  t %.4f s  peak %.4g m at x = %.4g m\n",
+                    (unsigned long long)next, t, displacements[peak],
+                    rest[peak]);
+            shown++;
+        }
+
+        if (__atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) & RING_FINISHED
+                && __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE)
+                == next)
+            break;
+        nanosleep(&pause, NULL);
+    }
+
+    printf("Read %llu frames, skipped %llu.\n", (unsigned long long)shown,
+            (unsigned long long)skipped);
+
+    munmap((void *)header, size);
+    free(displacements);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,355 @@
+/*----------------------------------------------------------------------------*/
+/* simclient.c                                                                */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+#define MAX_CLIENTS 256
+#define WINDOW 32 /* Requests a connection sends ahead of their replies */
+
+/* One connection's share of the load */
+typedef struct client
+{
+    const char *socket_path;
+    const char *payload;
+    size_t length;
+    long num_requests;
+    struct timespec *sent; /* Array of num_requests send times */
+    double *latency; /* Array of num_requests round trips, in us */
+    long failures; /* Replies without "status":"ok" */
+    int error; /* 1 if the connection failed */
+    pthread_t thread;
+} Client;
+
+/* Returns the time from start to end in microseconds */
+static double elapsed_us(struct timespec start, struct timespec end)
+{
+    return (end.tv_sec - start.tv_sec) * 1e6
+        + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+/* Connects to the server at path. Returns the descriptor, or -1 on
+ * failure. */
+static int connect_to(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Writes length bytes of data to fd, whole. Returns 1 if an error occured, 0
+ * otherwise. */
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        data += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+/* Reads one line from fd into *line, growing it as needed, through the
+ * buffered bytes in buf. Returns 1 on EOF or error, 0 otherwise. */
+static int read_line(int fd, char **buf, size_t *used, size_t *size,
+        char **line, size_t *line_size)
+{
+    for (;;)
+    {
+        char *newline = memchr(*buf, '\n', *used);
+        ssize_t n;
+
+        if (newline != NULL)
+        {
+            size_t length = newline - *buf;
+
+            if (length + 1 > *line_size)
+            {
+                char *grown = realloc(*line, length + 1);
+
+                if (grown == NULL)
+                    return 1;
+                *line = grown;
+                *line_size = length + 1;
+            }
+            memcpy(*line, *buf, length);
+            (*line)[length] = '\0';
+            *used -= length + 1;
+            memmove(*buf, newline + 1, *used);
+            return 0;
+        }
+
+        if (*size - *used < 4096)
+        {
+            char *grown = realloc(*buf, 2 * *size + 4096);
+
+            if (grown == NULL)
+                return 1;
+            *buf = grown;
+            *size = 2 * *size + 4096;
+        }
+        if ((n = read(fd, *buf + *used, *size - *used)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        *used += n;
+    }
+}
+
+/* Sends c->num_requests copies of the payload, keeping up to WINDOW of them
+ * in flight, and times each reply */
+static void *run_client(void *arg)
+{
+    Client *c = arg;
+    char header[32];
+    char *buf = NULL, *line = NULL;
+    size_t used = 0, size = 0, line_size = 0;
+    long sent = 0, received = 0, id;
+    struct timespec now;
+    int fd, header_length;
+
+    if ((fd = connect_to(c->socket_path)) < 0)
+    {
+        c->error = 1;
+        return NULL;
+    }
+    header_length = sprintf(header, "%zu\n", c->length);
+
+    while (received < c->num_requests)
+    {
+        while (sent < c->num_requests && sent - received < WINDOW)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &c->sent[sent]);
+            if (write_all(fd, header, header_length)
+                    || write_all(fd, c->payload, c->length))
+            {
+                c->error = 1;
+                break;
+            }
+            sent++;
+        }
+        if (c->error
+                || read_line(fd, &buf, &used, &size, &line, &line_size))
+        {
+            c->error = 1;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (sscanf(line, "{\"id\":%ld", &id) != 1 || id < 0 || id >= sent)
+        {
+            c->error = 1;
+            break;
+        }
+        c->latency[received++] = elapsed_us(c->sent[id], now);
+        if (strstr(line, "\"status\":\"ok\"") == NULL)
+            c->failures++;
+    }
+
+    close(fd);
+    free(buf);
+    free(line);
+
+    return NULL;
+}
+
+/* Reads the file filename into a new buffer, setting *length. Returns NULL
+ * on failure. */
+static char *read_file(const char *filename, size_t *length)
+{
+    FILE *fp;
+    char *text;
+    long size;
+
+    if ((fp = fopen(filename, "rb")) == NULL)
+        return NULL;
+    if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0
+            || size > SERVER_MAX_PAYLOAD || fseek(fp, 0, SEEK_SET)
+            || (text = malloc(size + 1)) == NULL)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    if (fread(text, 1, size, fp) != (size_t)size)
+    {
+        free(text);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *length = size;
+
+    return text;
+}
+
+static int compare_double(const void *p, const void *q)
+{
+    double a = *(const double *)p, b = *(const double *)q;
+
+    return (a > b) - (a < b);
+}
+
+/* Prints the server's counters, from a stats request on a new
+ * connection */
+static void print_stats(const char *socket_path)
+{
+    char *buf = NULL, *line = NULL;
+    size_t used = 0, size = 0, line_size = 0;
+    int fd;
+
+    if ((fd = connect_to(socket_path)) < 0)
+        return;
+    if (!write_all(fd, "stats\n", 6)
+            && !read_line(fd, &buf, &used, &size, &line, &line_size))
+        printf("Server: %s\n", line);
+
+    close(fd);
+    free(buf);
+    free(line);
+}
+
+/* Load-tests the solver server at SOCKET: CLIENTS connections (default 4)
+ * each send REQUESTS (default 1000) copies of the simulation parameter file
+ * FILE, WINDOW at a time, and the throughput, the round trip percentiles and
+ * the server's own counters are printed.
+ *
+ * Usage:
+ * ./simclient SOCKET FILE [CLIENTS] [REQUESTS]
+ */
+int main(int argc, char *argv[])
+{
+    static Client clients[MAX_CLIENTS];
+    struct timespec start, end;
+    double *latency, seconds;
+    long num_requests = 1000, total = 0, failures = 0, k;
+    int num_clients = 4, i, error = 0;
+    char *payload;
+    size_t length;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s SOCKET FILE [CLIENTS] [REQUESTS]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 3 && ((num_clients = atoi(argv[3])) < 1
+                || num_clients > MAX_CLIENTS))
+    {
+        fprintf(stderr, "Clients must be 1-%d.\n", MAX_CLIENTS);
+        return EXIT_FAILURE;
+    }
+    if (argc > 4 && (num_requests = atol(argv[4])) < 1)
+    {
+        fprintf(stderr, "Requests must be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((payload = read_file(argv[2], &length)) == NULL)
+    {
+        fprintf(stderr, "Failed to read %s.\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    if ((latency = malloc((size_t)num_clients * num_requests
+                    * sizeof(double))) == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory.\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < num_clients; i++)
+    {
+        clients[i].socket_path = argv[1];
+        clients[i].payload = payload;
+        clients[i].length = length;
+        clients[i].num_requests = num_requests;
+        clients[i].latency = latency + (size_t)i * num_requests;
+        clients[i].sent = malloc(num_requests * sizeof(struct timespec));
+        if (clients[i].sent == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_clients; i++)
+        if (pthread_create(&clients[i].thread, NULL, run_client,
+                    &clients[i]))
+        {
+            fprintf(stderr, "Failed to start client %d.\n", i);
+            return EXIT_FAILURE;
+        }
+
+    /* Gather the round trips of every client together */
+    for (i = 0; i < num_clients; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        if (clients[i].error)
+        {
+            fprintf(stderr, "Client %d lost its connection.\n", i);
+            error = 1;
+            continue;
+        }
+        memmove(latency + total, clients[i].latency,
+                num_requests * sizeof(double));
+        total += num_requests;
+        failures += clients[i].failures;
+        free(clients[i].sent);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = elapsed_us(start, end) / 1e6;
+
+    if (total > 0)
+    {
+        qsort(latency, total, sizeof(double), compare_double);
+        printf("%ld requests from %d clients in %.3f s: %.0f requests/s, "
+                "%ld failed\n", total, num_clients, seconds, total / seconds,
+                failures);
+        printf("Round trip (us): p50 %.0f, p90 %.0f, p99 %.0f, max %.0f\n",
+                latency[total / 2], latency[total * 9 / 10],
+                latency[total * 99 / 100], latency[total - 1]);
+    }
+    print_stats(argv[1]);
+
+    for (k = 0; k < num_clients; k++)
+        if (clients[k].error)
+            free(clients[k].sent);
+    free(latency);
+    free(payload);
+
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -6,11 +6,248 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "types.h"
-#include "importdata.h"
-#include "asolve.h"
+#include "loadedstring.h"
 #include "plot.h"
+#include "session.h"
+#include "export.h"
+#include "server.h"
+
+#define QUERY_BATCH 4096 /* (bead, t) pairs read before evaluating */
+#define RESPONSE_POINTS 2000 /* Driving frequencies in a response sweep */
+#define RESPONSE_RANGE 1.2 /* Sweep up to this times the highest
+                              eigenfrequency */
+
+/* Reads "BEAD T" pairs (bead one indexed) from stdin until EOF and prints
+ * "BEAD T VALUE" for each, where VALUE is the displacement, velocity or
+ * energy of the bead at time T as chosen by quantity ("x", "v" or "e").
+ * Returns 1 if an error occured, 0 otherwise. */
+static int run_queries(Simulation sim, Result result, const char *quantity)
+{
+    static LsQuery queries[QUERY_BATCH];
+    static double values[QUERY_BATCH];
+    LsProbe *probe;
+    LsQuantity q;
+    LsStatus status;
+    size_t count, k;
+    int done = 0;
+
+    if (!strcmp(quantity, "x"))
+        q = LS_DISPLACEMENT;
+    else if (!strcmp(quantity, "v"))
+        q = LS_VELOCITY;
+    else if (!strcmp(quantity, "e"))
+        q = LS_ENERGY;
+    else
+    {
+        fprintf(stderr, "Query quantity must be x, v or e.\n");
+        return 1;
+    }
+
+    if ((status = ls_probe_create(&sim, &result, NULL, &probe)) != LS_OK)
+    {
+        fprintf(stderr, "Failed to create probe: %s.\n", ls_strerror(status));
+        return 1;
+    }
+
+    while (!done)
+    {
+        for (count = 0; count < QUERY_BATCH; count++)
+        {
+            if (scanf("%d %lf", &queries[count].bead, &queries[count].t) != 2)
+            {
+                done = 1;
+                break;
+            }
+            queries[count].bead--;
+        }
+
+        if ((status = ls_probe_eval(probe, q, queries, count, values))
+                != LS_OK)
+        {
+            fprintf(stderr, "Bad query in batch: %s.\n", ls_strerror(status));
+            ls_probe_free(probe);
+            return 1;
+        }
+
+        for (k = 0; k < count; k++)
+            printf("%d %.9lf %.9e\n", queries[k].bead + 1, queries[k].t,
+                    values[k]);
+    }
+
+    ls_probe_free(probe);
+
+    return 0;
+}
+
+/* Reads the damping of each bead of sim into damping, from arg: either one
+ * number used for every bead, or the name of a file holding one number per
+ * bead. Returns 1 if an error occured or a damping is negative, 0
+ * otherwise. */
+static int read_damping(Simulation sim, const char *arg, double *damping)
+{
+    FILE *fp;
+    char *end;
+    double value;
+    int i;
+
+    value = strtod(arg, &end);
+    if (*end == '\0')
+    {
+        if (!(value >= 0))
+        {
+            fprintf(stderr, "Damping must not be negative.\n");
+            return 1;
+        }
+        for (i = 0; i < sim.num_beads; i++)
+            damping[i] = value;
+        return 0;
+    }
+
+    if ((fp = fopen(arg, "r")) == NULL)
+    {
+        fprintf(stderr, "Failed to open damping file %s.\n", arg);
+        return 1;
+    }
+    for (i = 0; i < sim.num_beads; i++)
+        if (fscanf(fp, "%lf", &damping[i]) != 1)
+        {
+            fprintf(stderr, "Damping file %s must hold %d numbers.\n", arg,
+                    sim.num_beads);
+            fclose(fp);
+            return 1;
+        }
+    fclose(fp);
+
+    for (i = 0; i < sim.num_beads; i++)
+        if (!(damping[i] >= 0))
+        {
+            fprintf(stderr, "Damping file %s holds a negative damping for "
+                    "bead %d.\n", arg, i + 1);
+            return 1;
+        }
+
+    return 0;
+}
+
+/* Sweeps the steady-state response of system, with bead drive_bead (one
+ * indexed) driven by a 1 N force and damping read by read_damping from
+ * damping_arg, from 0 to RESPONSE_RANGE x the highest eigenfrequency of
+ * result. Writes FILE.resp and plots the response. Returns 1 if an error
+ * occured, 0 otherwise. */
+static int run_response(const LsSystem *system, Result result,
+        int drive_bead, const char *damping_arg)
+{
+    Simulation sim = *ls_system_simulation(system);
+    LsResponseOptions opts;
+    LsStatus status;
+    double *damping, *frequencies, *response;
+    char resp_name[NAME_MAX + 6];
+    int k, error = 1;
+
+    if (drive_bead < 1 || drive_bead > sim.num_beads)
+    {
+        fprintf(stderr, "Driven bead must be 1-%d.\n", sim.num_beads);
+        return 1;
+    }
+
+    damping = malloc(sim.num_beads * sizeof(double));
+    frequencies = malloc(RESPONSE_POINTS * sizeof(double));
+    response = malloc(2 * (size_t)RESPONSE_POINTS * sim.num_beads
+            * sizeof(double));
+    if (damping == NULL || frequencies == NULL || response == NULL)
+        fprintf(stderr, "Failed to allocate memory for the response.\n");
+    else if (!read_damping(sim, damping_arg, damping))
+    {
+        for (k = 0; k < RESPONSE_POINTS; k++)
+            frequencies[k] = RESPONSE_RANGE * (k + 1)
+                * result.eigenfrequencies[result.num_modes - 1]
+                / RESPONSE_POINTS;
+
+        opts.damping = damping;
+        opts.drive_bead = drive_bead - 1;
+        opts.force = 1.0;
+        opts.num_threads = 0;
+
+        if ((status = ls_frequency_response(system, &opts, frequencies,
+                        RESPONSE_POINTS, NULL, response)) != LS_OK)
+            fprintf(stderr, "Failed to find the response: %s.\n",
+                    ls_strerror(status));
+        else
+        {
+            sprintf(resp_name, "%s.resp", sim.filename);
+            export_response(resp_name, sim.num_beads, drive_bead - 1,
+                    frequencies, response, RESPONSE_POINTS);
+            plot_response(frequencies, response, RESPONSE_POINTS,
+                    sim.num_beads, drive_bead - 1);
+            error = 0;
+        }
+    }
+
+    free(damping);
+    free(frequencies);
+    free(response);
+
+    return error;
+}
+
+/* Returns the LsNeed flags of the parts of the solution that option flag
+ * uses, 0 if it uses none */
+static unsigned option_needs(const char *flag)
+{
+    if (!strcmp(flag, "-e") || !strcmp(flag, "--eigenfrequencies")
+            || !strcmp(flag, "-r") || !strcmp(flag, "--response"))
+        return LS_NEED_FREQUENCIES;
+    if (!strcmp(flag, "-m") || !strcmp(flag, "--modes")
+            || !strcmp(flag, "-A") || !strcmp(flag, "--atlas"))
+        return LS_NEED_FREQUENCIES | LS_NEED_VECTORS;
+    if (!strcmp(flag, "-a") || !strcmp(flag, "--amplitudes"))
+        return LS_NEED_COEFFICIENTS;
+    if (!strcmp(flag, "-p") || !strcmp(flag, "--print")
+            || !strcmp(flag, "-s") || !strcmp(flag, "--simulate")
+            || !strcmp(flag, "-x") || !strcmp(flag, "--export")
+            || !strcmp(flag, "-q") || !strcmp(flag, "--query"))
+        return LS_NEED_ALL;
+
+    return 0;
+}
+
+/* Prints plan, for sim with the memory limit given by budget in MB (0 for
+ * none): the predicted cost of each engine and the one chosen */
+static void print_plan(Simulation sim, LsPlan plan, unsigned needs,
+        double budget)
+{
+    static const char *parts[] = {"eigenfrequencies", "eigenvectors",
+        "coefficients"};
+    int e, k, count = 0;
+
+    printf("Plan for %d beads, needing", sim.num_beads);
+    for (k = 0; k < 3; k++)
+        if (needs & 1u << k)
+            printf("%s %s", count++ ? "," : "", parts[k]);
+    printf("; memory limit ");
+    if (budget > 0)
+        printf("%.0f MB:\n", budget);
+    else
+        printf("none:\n");
+
+    printf("  %-12s %16s %12s\n", "engine", "predicted flops", "memory (MB)");
+    for (e = 0; e < LS_NUM_ENGINES; e++)
+        if (plan.flops[e] >= 0)
+            printf("%c %-12s %16.3g %12.3g\n",
+                    e == (int)plan.engine ? '*' : ' ',
+                    ls_engine_name(e), plan.flops[e],
+                    plan.bytes[e] / (1024 * 1024));
+
+    printf("Solving with the %s engine%s%s.\n\n",
+            ls_engine_name(plan.engine),
+            plan.needs == LS_NEED_FREQUENCIES ? ", eigenfrequencies only"
+            : plan.needs & LS_NEED_COEFFICIENTS ? ""
+            : ", eigenvectors found as they are drawn",
+            plan.mapped ? ", eigenvectors mapped from a file" : "");
+}
 
 /* Simulates a loaded string or mass-spring coupled oscillator.
  *
@@ -30,6 +267,15 @@
  * -m, --modes
  *        plots individual normal modes
  *
+ * -A, --atlas [MODES]
+ *        draws the lowest MODES normal modes (all of them if unspecified)
+ *        without waiting for input, to FILE_mode0001.png and on, with one
+ *        gnuplot process per processor drawing at once
+ *
+ * -P, --pages
+ *        only use before -A option. Draws the modes as the pages of
+ *        FILE_modes.pdf instead
+ *
  * -s, --simulate [TIME_SCALE]
  *        animates the simulation at a speed TIME_SCALE x real speed
  *        TIME_SCALE defaults to 1.0 if unspecified
@@ -37,14 +283,84 @@
  * -g, --gif
  *        only use following -s option. Saves animation as a .gif
  *
+ * -f, --float
+ *        only use before -s option. Synthesizes animation frames in single
+ *        precision with the vectorized kernel and reports the max error
+ *
+ * -k, --keep FRACTION
+ *        only use before -s option. Animates with only the modes carrying
+ *        FRACTION (0 to 1) of the mode energy and reports the error bound
+ *
+ * -o, --output-rate FPS
+ *        only use before -s or -x options. Samples time at FPS frames per
+ *        second of output instead of resolving the fastest mode, so an
+ *        animation covers the whole run in a fraction of the frames. Modes
+ *        above the Nyquist frequency of that rate are filtered out and the
+ *        mode energy they carried is reported
+ *
+ * -w, --publish NAME
+ *        only use before -s option. Also publishes every frame of a string
+ *        or spring animation to the POSIX shared memory ring NAME (format in
+ *        publish.h), which other processes can map and read without holding
+ *        up the animation. shmview is a sample reader
+ *
+ * -x, --export FRAMES
+ *        writes FRAMES frames, one animation timestep apart, to the binary
+ *        trajectory file FILE.traj (format in export.h). -f before it writes
+ *        float32 displacements and -k applies as for -s
+ *
+ * -q, --query x|v|e
+ *        reads "BEAD T" pairs from stdin until EOF and prints the
+ *        displacement (x), velocity (v) or energy (e) of each bead at time T,
+ *        computed directly from the modes rather than by animating
+ *
+ * -r, --response BEAD DAMPING
+ *        drives bead BEAD with a 1 N sinusoidal force and plots the
+ *        steady-state amplitude and phase against driving frequency, with
+ *        DAMPING (kg/s) on every bead, or one value per bead read from the
+ *        file DAMPING. The complex amplitudes are written to FILE.resp
+ *        (format in export.h)
+ *
+ * -b, --budget MB
+ *        limits the memory of the solution to MB megabytes. A string or
+ *        spring chain whose eigenvectors don't fit is solved out of core: they
+ *        are written to FILE.vec and mapped from there, and -s, -x and -q read
+ *        them a tile of rows at a time; the other options read them directly
+ *
+ * -E, --explain
+ *        prints the predicted cost of each engine that can solve the system
+ *        for the other options given, and which one is used. The solver
+ *        needs eigenfrequencies only for -e and -r, and eigenvectors for the
+ *        rest
+ *
+ * -i, --interactive
+ *        starts an interactive session: the system is solved once and kept
+ *        in memory along with one gnuplot process, and commands such as
+ *        "modes 12", "animate 0.5" or "set mass 3 2.0" are read from stdin.
+ *        Other options are ignored.
+ *
+ * -d, --daemon
+ *        serves solves on the Unix domain socket FILE until interrupted,
+ *        instead of solving a file: clients send simulation parameters and
+ *        get eigenfrequencies and coefficients back as JSON lines (protocol
+ *        in server.h). simclient load-tests it. Other options are ignored.
+ *
  * -p option is used if no options specified
  */
 int main(int argc, char *argv[])
 {
+    LsSystem *system;
+    LsSolution *solution;
+    LsStatus status;
     Simulation sim;
     Result result;
+    AnimationOptions opts = {1.0, false, false, 1.0, 0.0, NULL};
+    AtlasOptions atlas_opts = {0, false, 0};
+    LsPlan plan;
+    double budget = 0;
+    unsigned needs = 0;
+    bool explain = false;
     int argnum;
-    int i;
 
     /* Check if a filename has been specified in the command */
     if (argc < 2)
@@ -53,13 +369,55 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (import_data(argv[argc - 1], &sim))
+    for (argnum = 1; argnum < argc - 1; argnum++)
     {
-        fprintf(stderr, "Failed to import data.\n");
+        if (!strcmp(argv[argnum], "-i") || !strcmp(argv[argnum], "--interactive"))
+            return run_session(argv[argc - 1]) ? EXIT_FAILURE : EXIT_SUCCESS;
+        if (!strcmp(argv[argnum], "-d") || !strcmp(argv[argnum], "--daemon"))
+            return run_server(argv[argc - 1]) ? EXIT_FAILURE : EXIT_SUCCESS;
+        if ((!strcmp(argv[argnum], "-b") || !strcmp(argv[argnum], "--budget"))
+                && (argnum + 2 >= argc || (budget = atof(argv[argnum + 1])) <= 0))
+        {
+            fprintf(stderr, "Memory budget must be a positive number of MB.\n");
+            return EXIT_FAILURE;
+        }
+        if (!strcmp(argv[argnum], "-E") || !strcmp(argv[argnum], "--explain"))
+            explain = true;
+        needs |= option_needs(argv[argnum]);
+    }
+
+    /* Plain runs print everything */
+    if (needs == 0)
+        needs = LS_NEED_ALL;
+
+    if ((status = ls_system_load(argv[argc - 1], NULL, &system)) != LS_OK)
+    {
+        fprintf(stderr, "Failed to import data: %s.\n", ls_strerror(status));
         return EXIT_FAILURE;
     }
+    sim = *ls_system_simulation(system);
+    printf("Finished importing data from %s\n\n", sim.filename);
+
+    print_setup(sim);
+    if ((status = ls_plan(system, needs, budget > 0 ? budget * 1024 * 1024
+                    : SIZE_MAX, &plan)) == LS_OK)
+    {
+        char vec_name[NAME_MAX + 5];
 
-    result = asolve(sim);
+        if (explain)
+            print_plan(sim, plan, needs, budget);
+        sprintf(vec_name, "%s.vec", sim.filename);
+        status = ls_solve_planned(system, &plan, vec_name,
+                budget > 0 ? budget * 1024 * 1024 : SIZE_MAX, NULL,
+                &solution);
+    }
+    if (status != LS_OK)
+    {
+        fprintf(stderr, "Failed to solve: %s.\n", ls_strerror(status));
+        ls_system_free(system);
+        return EXIT_FAILURE;
+    }
+    result = *ls_solution_result(solution);
 
     /* print results if no flags specified */
     if (argc == 2)
@@ -75,37 +433,113 @@ int main(int argc, char *argv[])
             plot_mode_amplitudes(result);
         else if (!strcmp(argv[argnum], "-m") || !strcmp(argv[argnum], "--modes"))
             plot_normal_modes(result, sim);
+        else if (!strcmp(argv[argnum], "-A") || !strcmp(argv[argnum], "--atlas"))
+        {
+            if (argnum + 2 < argc && atoi(argv[argnum + 1]) > 0)
+                atlas_opts.num_modes = atoi(argv[++argnum]);
+            else
+                atlas_opts.num_modes = 0;
+            export_mode_atlas(result, sim, atlas_opts);
+        }
+        else if (!strcmp(argv[argnum], "-P") || !strcmp(argv[argnum], "--pages"))
+            atlas_opts.multipage = true;
+        else if (!strcmp(argv[argnum], "-f") || !strcmp(argv[argnum], "--float"))
+            opts.single_precision = true;
+        else if (!strcmp(argv[argnum], "-b") || !strcmp(argv[argnum], "--budget"))
+            argnum++;
+        else if (!strcmp(argv[argnum], "-E") || !strcmp(argv[argnum], "--explain"))
+            continue;
+        else if (!strcmp(argv[argnum], "-k") || !strcmp(argv[argnum], "--keep"))
+        {
+            if (argnum + 2 < argc && (opts.energy_fraction = atof(argv[argnum + 1])) > 0
+                    && opts.energy_fraction <= 1)
+                argnum++;
+            else
+            {
+                fprintf(stderr, "Energy fraction must be in (0, 1], default to 1.\n");
+                opts.energy_fraction = 1.0;
+            }
+        }
+        else if (!strcmp(argv[argnum], "-o") || !strcmp(argv[argnum], "--output-rate"))
+        {
+            if (argnum + 2 < argc && atof(argv[argnum + 1]) > 0)
+                opts.frame_rate = atof(argv[++argnum]);
+            else
+                fprintf(stderr, "Output frame rate must be positive.\n");
+        }
+        else if (!strcmp(argv[argnum], "-w") || !strcmp(argv[argnum], "--publish"))
+        {
+            if (argnum + 2 < argc)
+                opts.publish_name = argv[++argnum];
+            else
+                fprintf(stderr, "Missing frame ring name.\n");
+        }
+        else if (!strcmp(argv[argnum], "-x") || !strcmp(argv[argnum], "--export"))
+        {
+            ExportOptions export_opts;
+            char traj_name[NAME_MAX + 6];
+
+            if (argnum + 2 < argc && atol(argv[argnum + 1]) > 0)
+                export_opts.num_frames = atol(argv[++argnum]);
+            else
+            {
+                fprintf(stderr, "Number of frames to export must be "
+                        "positive.\n");
+                continue;
+            }
+            export_opts.single_precision = opts.single_precision;
+            export_opts.energy_fraction = opts.energy_fraction;
+            export_opts.frame_rate = opts.frame_rate;
+
+            sprintf(traj_name, "%s.traj", sim.filename);
+            export_trajectory(traj_name, result, export_opts);
+        }
+        else if (!strcmp(argv[argnum], "-q") || !strcmp(argv[argnum], "--query"))
+        {
+            if (argnum + 2 < argc)
+                run_queries(sim, result, argv[++argnum]);
+            else
+                fprintf(stderr, "Missing query quantity.\n");
+        }
+        else if (!strcmp(argv[argnum], "-r") || !strcmp(argv[argnum], "--response"))
+        {
+            if (argnum + 3 < argc)
+            {
+                run_response(system, result, atoi(argv[argnum + 1]),
+                        argv[argnum + 2]);
+                argnum += 2;
+            }
+            else
+                fprintf(stderr, "Missing driven bead or damping.\n");
+        }
         else if (!strcmp(argv[argnum], "-s") || !strcmp(argv[argnum], "--simulate"))
         {
-            double time_scale; /* defaults to real time if not specified */
-            if ((time_scale = atof(argv[argnum + 1])) != 0)
+            /* defaults to real time if not specified */
+            if ((opts.time_scale = atof(argv[argnum + 1])) != 0)
                 argnum++;
             else
             {
                 fprintf(stderr, "No time scale specified, default to 1.\n");
-                time_scale = 1.0;
+                opts.time_scale = 1.0;
             }
 
             /* Save gif of simulation: name will be simulationfilename.gif */
             if (!strcmp(argv[argnum + 1], "-g") || !strcmp(argv[argnum + 1], "--gif"))
             {
-                animate(result, sim, time_scale, true);
+                opts.save_gif = true;
                 argnum++;
             }
             else
-                animate(result, sim, time_scale, false);
+                opts.save_gif = false;
+
+            animate(result, sim, opts);
         }
         else
             fprintf(stderr, "Invalid flag.\n");
     }
 
-    free(sim.beads);
-    free(sim.connections);
-    free(result.eigenfrequencies);
-    free(result.coefficients);
-    for (i = 0; i < result.num_modes; i++)
-        free(result.eigenvectors[i]);
-    free(result.eigenvectors);
+    ls_solution_free(solution);
+    ls_system_free(system);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,465 @@
+/*----------------------------------------------------------------------------*/
+/* sparse.c                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_eigen.h>
+
+#include "sparse.h"
+#include "alloc.h"
+
+#define BASIS_EXTRA 40 /* Lanczos vectors kept beyond twice the wanted modes */
+#define LANCZOS_TOL 1e-10 /* Residual of a converged Ritz pair, relative to
+                             the largest Ritz value */
+#define BREAKDOWN_TOL 1e-12 /* Relative size of a residual that means the
+                               basis spans an invariant subspace */
+#define MAX_RESTARTS 1000
+#define MAX_PASSES 8 /* Passes looking for repeated eigenvalues */
+#define RESTART_BLOCK 64 /* Coordinates transformed together on restart */
+
+/* State of a thick-restart Lanczos run */
+typedef struct lanczos
+{
+    const Csr *a;
+    int n; /* a->size */
+    int basis; /* Maximum number of Lanczos vectors */
+    double *q; /* basis + 1 Lanczos vectors of n doubles */
+    double *h; /* basis x basis projection of a onto the Lanczos vectors */
+    double *hcopy; /* Copy of h destroyed by the eigensolver */
+    double *s; /* basis x basis eigenvectors of h, one per column */
+    double *theta; /* basis Ritz values */
+    double *coef; /* Orthogonalization coefficients of one step */
+    double *w; /* n doubles of scratch */
+    double *tmp; /* basis x RESTART_BLOCK doubles of scratch */
+    const double *locked; /* num_locked vectors of n doubles that the search
+                             stays orthogonal to */
+    int num_locked;
+    gsl_eigen_symmv_workspace *ws; /* Eigensolver for h, sized for the last
+                                      projection it was used on */
+    uint64_t seed; /* State of the start vector generator */
+} Lanczos;
+
+void csr_multiply(const Csr *a, const double *x, double *y)
+{
+    int i, k;
+
+    assert(a != NULL);
+    assert(x != NULL);
+    assert(y != NULL);
+
+    for (i = 0; i < a->size; i++)
+    {
+        double sum = 0;
+        for (k = a->row_start[i]; k < a->row_start[i + 1]; k++)
+            sum += a->values[k] * x[a->cols[k]];
+        y[i] = sum;
+    }
+}
+
+static double dot(const double *x, const double *y, int n)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        sum += x[i] * y[i];
+
+    return sum;
+}
+
+/* y += alpha x */
+static void axpy(double alpha, const double *x, double *y, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+/* Removes from v its components along the locked vectors and the first count
+ * Lanczos vectors of lz, adding the latter to lz->coef. Classical
+ * Gram-Schmidt is done twice, which keeps the basis orthogonal to working
+ * precision. */
+static void orthogonalize(Lanczos *lz, double *v, int count)
+{
+    int pass, i;
+
+    memset(lz->coef, 0, count * sizeof(double));
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (i = 0; i < lz->num_locked; i++)
+        {
+            const double *l = lz->locked + (size_t)i * lz->n;
+            axpy(-dot(l, v, lz->n), l, v, lz->n);
+        }
+        for (i = 0; i < count; i++)
+        {
+            const double *q = lz->q + (size_t)i * lz->n;
+            double c = dot(q, v, lz->n);
+
+            lz->coef[i] += c;
+            axpy(-c, q, v, lz->n);
+        }
+    }
+}
+
+/* Fills v with a random unit vector orthogonal to the locked vectors and the
+ * first count Lanczos vectors. Returns 1 if there is no such vector, 0
+ * otherwise. */
+static int random_vector(Lanczos *lz, double *v, int count)
+{
+    double norm;
+    int i;
+
+    /* xorshift64, seeded per run so that results are reproducible */
+    for (i = 0; i < lz->n; i++)
+    {
+        lz->seed ^= lz->seed << 13;
+        lz->seed ^= lz->seed >> 7;
+        lz->seed ^= lz->seed << 17;
+        v[i] = (double)(lz->seed >> 11) / (double)(1ULL << 53) - 0.5;
+    }
+
+    orthogonalize(lz, v, count);
+    norm = sqrt(dot(v, v, lz->n));
+    if (norm < BREAKDOWN_TOL)
+        return 1;
+
+    for (i = 0; i < lz->n; i++)
+        v[i] /= norm;
+
+    return 0;
+}
+
+/* Computes the Ritz values and vectors of the first m Lanczos vectors, sorted
+ * in ascending order. Returns 1 if an error occured, 0 otherwise. */
+static int ritz(Lanczos *lz, int m)
+{
+    gsl_matrix_view h = gsl_matrix_view_array(lz->hcopy, m, m);
+    gsl_matrix_view s = gsl_matrix_view_array(lz->s, m, m);
+    gsl_vector_view theta = gsl_vector_view_array(lz->theta, m);
+    int i;
+
+    for (i = 0; i < m; i++)
+        memcpy(lz->hcopy + (size_t)i * m, lz->h + (size_t)i * lz->basis,
+                m * sizeof(double));
+
+    /* The projection grows and shrinks between restarts, and the eigensolver
+     * only takes matrices of the size it was allocated for */
+    if (lz->ws != NULL && lz->ws->size != (size_t)m)
+    {
+        gsl_eigen_symmv_free(lz->ws);
+        lz->ws = NULL;
+    }
+    if (lz->ws == NULL && (lz->ws = gsl_eigen_symmv_alloc(m)) == NULL)
+        return 1;
+    if (gsl_eigen_symmv(&h.matrix, &theta.vector, &s.matrix, lz->ws))
+        return 1;
+    gsl_eigen_symmv_sort(&theta.vector, &s.matrix, GSL_EIGEN_SORT_VAL_ASC);
+
+    return 0;
+}
+
+/* Replaces the first keep Lanczos vectors with the first keep Ritz vectors of
+ * the first m, from the eigenvectors in lz->s. Done in place, a block of
+ * coordinates at a time. */
+static void rotate_basis(Lanczos *lz, int m, int keep)
+{
+    int start, len, i, j, r;
+
+    for (start = 0; start < lz->n; start += RESTART_BLOCK)
+    {
+        len = lz->n - start < RESTART_BLOCK ? lz->n - start : RESTART_BLOCK;
+
+        for (j = 0; j < m; j++)
+            memcpy(lz->tmp + (size_t)j * RESTART_BLOCK,
+                    lz->q + (size_t)j * lz->n + start, len * sizeof(double));
+
+        for (i = 0; i < keep; i++)
+        {
+            double *q = lz->q + (size_t)i * lz->n + start;
+
+            memset(q, 0, len * sizeof(double));
+            for (j = 0; j < m; j++)
+            {
+                double c = lz->s[(size_t)j * m + i];
+                const double *t = lz->tmp + (size_t)j * RESTART_BLOCK;
+                for (r = 0; r < len; r++)
+                    q[r] += c * t[r];
+            }
+        }
+    }
+}
+
+/* Finds the num_wanted smallest eigenpairs of lz->a restricted to the space
+ * orthogonal to the locked vectors, storing them in eval and evec as
+ * described for lanczos_lowest. Returns LS_OK on success. */
+static LsStatus run_pass(Lanczos *lz, int num_wanted, double *eval,
+        double *evec)
+{
+    int n = lz->n;
+    int m = lz->basis;
+    int keep, start = 0;
+    int restarts, i, j;
+    double beta = 0;
+
+    /* There are only n - num_locked dimensions left to search */
+    if (m > n - lz->num_locked)
+        m = n - lz->num_locked;
+    keep = num_wanted + (m - num_wanted) / 2;
+    if (keep >= m)
+        keep = m - 1;
+
+    memset(lz->h, 0, (size_t)lz->basis * lz->basis * sizeof(double));
+    if (random_vector(lz, lz->q, 0))
+        return LS_ERR_SOLVER;
+
+    for (restarts = 0; restarts < MAX_RESTARTS; restarts++)
+    {
+        int converged = 1;
+        double scale;
+
+        for (j = start; j < m; j++)
+        {
+            double *next = lz->q + (size_t)(j + 1) * n;
+            double norm_aq;
+
+            csr_multiply(lz->a, lz->q + (size_t)j * n, lz->w);
+            norm_aq = sqrt(dot(lz->w, lz->w, n));
+
+            /* The coefficients are column j of the projection of a, which
+             * after a restart includes the couplings to the kept Ritz
+             * vectors */
+            orthogonalize(lz, lz->w, j + 1);
+            for (i = 0; i <= j; i++)
+            {
+                lz->h[(size_t)i * lz->basis + j] = lz->coef[i];
+                lz->h[(size_t)j * lz->basis + i] = lz->coef[i];
+            }
+
+            beta = sqrt(dot(lz->w, lz->w, n));
+            if (beta > BREAKDOWN_TOL * norm_aq)
+            {
+                for (i = 0; i < n; i++)
+                    next[i] = lz->w[i] / beta;
+            }
+            else
+            {
+                /* The basis spans an invariant subspace; carry on with a
+                 * fresh direction, which a does not couple to */
+                beta = 0;
+                if (j + 1 < m && random_vector(lz, next, j + 1))
+                    return LS_ERR_SOLVER;
+            }
+            if (j + 1 < m)
+            {
+                lz->h[(size_t)(j + 1) * lz->basis + j] = beta;
+                lz->h[(size_t)j * lz->basis + j + 1] = beta;
+            }
+        }
+
+        if (ritz(lz, m))
+            return LS_ERR_SOLVER;
+
+        /* The residual of Ritz pair i is beta times the last entry of its
+         * eigenvector */
+        scale = fmax(fabs(lz->theta[0]), fabs(lz->theta[m - 1]));
+        for (i = 0; i < num_wanted; i++)
+            if (fabs(beta * lz->s[(size_t)(m - 1) * m + i])
+                    > LANCZOS_TOL * scale)
+                converged = 0;
+
+        if (converged || m == n - lz->num_locked)
+            break;
+
+        /* Thick restart: keep the best Ritz vectors and the residual */
+        rotate_basis(lz, m, keep);
+        memcpy(lz->q + (size_t)keep * n, lz->q + (size_t)m * n,
+                n * sizeof(double));
+        memset(lz->h, 0, (size_t)lz->basis * lz->basis * sizeof(double));
+        for (i = 0; i < keep; i++)
+            lz->h[(size_t)i * lz->basis + i] = lz->theta[i];
+        start = keep;
+    }
+
+    if (restarts == MAX_RESTARTS)
+        return LS_ERR_SOLVER;
+
+    for (i = 0; i < num_wanted; i++)
+    {
+        double *v = evec + (size_t)i * n;
+        double norm;
+
+        eval[i] = lz->theta[i];
+        memset(v, 0, n * sizeof(double));
+        for (j = 0; j < m; j++)
+            axpy(lz->s[(size_t)j * m + i], lz->q + (size_t)j * n, v, n);
+
+        norm = sqrt(dot(v, v, n));
+        for (j = 0; j < n; j++)
+            v[j] /= norm;
+    }
+
+    return LS_OK;
+}
+
+/* Indices of values, sorted by value. Used to merge passes. */
+typedef struct ranked
+{
+    double value;
+    int index;
+} Ranked;
+
+static int compare_ranked(const void *p, const void *q)
+{
+    const Ranked *a = p, *b = q;
+
+    if (a->value != b->value)
+        return a->value < b->value ? -1 : 1;
+    return a->index - b->index;
+}
+
+static int compare_index(const void *p, const void *q)
+{
+    return ((const Ranked *)p)->index - ((const Ranked *)q)->index;
+}
+
+LsStatus lanczos_lowest(const Csr *a, int num_wanted,
+        const LsAllocator *allocator, double *eval, double *evec)
+{
+    Lanczos lz;
+    double *block, *pos;
+    double *found, *found_eval; /* Up to 2 num_wanted best eigenpairs */
+    Ranked *ranked;
+    size_t n, m, size;
+    int count, pass, i;
+    LsStatus status = LS_OK;
+
+    assert(a != NULL);
+    assert(allocator != NULL);
+    assert(num_wanted > 0 && num_wanted <= a->size);
+
+    n = a->size;
+    m = 2 * num_wanted + BASIS_EXTRA;
+    if (m > n)
+        m = n;
+
+    /* Lanczos vectors, h, its copy and eigenvectors, Ritz values,
+     * coefficients, w, the restart block and the found pairs */
+    size = (m + 1) * n + 3 * m * m + m + (m + 1) + n + m * RESTART_BLOCK
+        + 2 * num_wanted * (n + 1);
+    block = ls_alloc(allocator, size * sizeof(double));
+    ranked = ls_alloc(allocator, 2 * num_wanted * sizeof(Ranked));
+    if (block == NULL || ranked == NULL)
+    {
+        ls_free(allocator, block);
+        ls_free(allocator, ranked);
+        return LS_ERR_NOMEM;
+    }
+
+    memset(&lz, 0, sizeof(Lanczos));
+    lz.a = a;
+    lz.n = n;
+    lz.basis = m;
+    pos = block;
+    lz.q = pos;
+    pos += (m + 1) * n;
+    lz.h = pos;
+    pos += m * m;
+    lz.hcopy = pos;
+    pos += m * m;
+    lz.s = pos;
+    pos += m * m;
+    lz.theta = pos;
+    pos += m;
+    lz.coef = pos;
+    pos += m + 1;
+    lz.w = pos;
+    pos += n;
+    lz.tmp = pos;
+    pos += m * RESTART_BLOCK;
+
+    found = pos;
+    pos += 2 * num_wanted * n;
+    found_eval = pos;
+
+    /* A single Krylov sequence sees one direction of each eigenspace, so
+     * repeated eigenvalues (square membranes have many) are missed. Further
+     * passes search the space orthogonal to the pairs found so far, until
+     * one finds nothing lower. */
+    count = 0;
+    for (pass = 0; pass < MAX_PASSES && count < (int)n; pass++)
+    {
+        int extra = num_wanted;
+        int lower = 0;
+        double largest = -INFINITY;
+
+        if (extra > (int)n - count)
+            extra = n - count;
+
+        lz.locked = found;
+        lz.num_locked = count;
+        lz.seed = 0x9E3779B97F4A7C15ULL + pass;
+        if ((status = run_pass(&lz, extra, found_eval + count,
+                        found + (size_t)count * n)) != LS_OK)
+            break;
+
+        for (i = 0; i < count; i++)
+            largest = fmax(largest, found_eval[i]);
+        for (i = count; i < count + extra; i++)
+            if (found_eval[i] < largest
+                    - LANCZOS_TOL * fmax(fabs(largest), 1.0))
+                lower++;
+
+        /* Keep the lowest num_wanted, compacted in their current order */
+        for (i = 0; i < count + extra; i++)
+        {
+            ranked[i].value = found_eval[i];
+            ranked[i].index = i;
+        }
+        qsort(ranked, count + extra, sizeof(Ranked), compare_ranked);
+        count = count + extra < num_wanted ? count + extra : num_wanted;
+        qsort(ranked, count, sizeof(Ranked), compare_index);
+        for (i = 0; i < count; i++)
+        {
+            found_eval[i] = found_eval[ranked[i].index];
+            memmove(found + (size_t)i * n,
+                    found + (size_t)ranked[i].index * n, n * sizeof(double));
+        }
+
+        if (pass > 0 && lower == 0)
+            break;
+    }
+
+    if (status == LS_OK)
+    {
+        for (i = 0; i < count; i++)
+        {
+            ranked[i].value = found_eval[i];
+            ranked[i].index = i;
+        }
+        qsort(ranked, count, sizeof(Ranked), compare_ranked);
+        for (i = 0; i < num_wanted; i++)
+        {
+            eval[i] = found_eval[ranked[i].index];
+            memcpy(evec + (size_t)i * n, found + (size_t)ranked[i].index * n,
+                    n * sizeof(double));
+        }
+    }
+
+    ls_free(allocator, block);
+    ls_free(allocator, ranked);
+    if (lz.ws != NULL)
+        gsl_eigen_symmv_free(lz.ws);
+
+    return status;
+}
@@ -0,0 +1,36 @@
+/*----------------------------------------------------------------------------*/
+/* sparse.h                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SPARSE_INCLUDED
+#define SPARSE_INCLUDED
+
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. */
+
+/* Square sparse matrix in compressed sparse row form */
+typedef struct csr
+{
+    int size; /* Number of rows and columns */
+    int *row_start; /* Array of size + 1 offsets into cols and values; row i
+                       holds entries row_start[i] to row_start[i + 1] - 1 */
+    int *cols; /* Column of each nonzero */
+    double *values; /* Value of each nonzero */
+} Csr;
+
+/* y = a x, where x and y are arrays of a->size doubles */
+void csr_multiply(const Csr *a, const double *x, double *y);
+
+/* Finds the num_wanted smallest eigenvalues of the symmetric matrix a and
+ * their eigenvectors, using Lanczos with full reorthogonalization and thick
+ * restarts. Eigenvalues are stored in eval in ascending order and eigenvector
+ * j in evec[j * a->size] to evec[(j + 1) * a->size - 1], normalized. Work
+ * memory, from allocator, is proportional to num_wanted x a->size; each step
+ * costs one multiply by a plus vector operations, so time scales with the
+ * number of nonzeros rather than with a->size^2. */
+LsStatus lanczos_lowest(const Csr *a, int num_wanted,
+        const LsAllocator *allocator, double *eval, double *evec);
+
+#endif
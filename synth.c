@@ -0,0 +1,516 @@
+/*----------------------------------------------------------------------------*/
+/* synth.c                                                                    */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define KERNEL_NAME "AVX2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KERNEL_NAME "SSE2"
+#else
+#define KERNEL_NAME "scalar"
+#endif
+
+#include "synth.h"
+#include "loadedstring.h"
+#include "asolve.h"
+
+#define PAD 32 /* beads handled per kernel iteration; stride is a multiple */
+#define ALIGNMENT 32 /* byte alignment of the eigenvector copies */
+#define ERROR_SAMPLES 16 /* frames used to measure the float32 error */
+
+/* Allocates size bytes aligned to ALIGNMENT. Returns NULL on failure. Free with
+ * free(). */
+static void *alloc_aligned(size_t size)
+{
+    void *ptr;
+
+    if (posix_memalign(&ptr, ALIGNMENT, size))
+        return NULL;
+
+    return ptr;
+}
+
+/* Fills synth->weights with the modal weights a cos(wt) + b sin(wt) at time
+ * t, or a + bt for a mode of zero frequency. */
+static void calc_weights(Synth *synth, double t)
+{
+    int j;
+
+    for (j = 0; j < synth->num_modes; j++)
+        if (synth->frequencies[j] == 0)
+            synth->weights[j] = synth->coefficients[j].a
+                + synth->coefficients[j].b * t;
+        else
+            synth->weights[j] = synth->coefficients[j].a
+                * cos(synth->frequencies[j] * t)
+                + synth->coefficients[j].b * sin(synth->frequencies[j] * t);
+}
+
+/* y = sum over modes of weights[j] * vectors[j], for the first num_beads
+ * entries of each mode. Double precision path. */
+static void kernel_f64(const double *vectors, const double *weights,
+        int num_modes, int num_beads, int stride, double *y)
+{
+    int i, j;
+
+    memset(y, 0, num_beads * sizeof(double));
+    for (j = 0; j < num_modes; j++)
+    {
+        const double *v = vectors + (size_t)j * stride;
+        for (i = 0; i < num_beads; i++)
+            y[i] += weights[j] * v[i];
+    }
+}
+
+/* y = sum over modes of weights[j] * vectors[j]. Single precision path. Each
+ * block of PAD beads is kept in registers while all modes are streamed
+ * through, so y is written once per frame. */
+static void kernel_f32(const float *vectors, const float *weights,
+        int num_modes, int stride, float *y)
+{
+    int i, j;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    for (i = 0; i < stride; i += PAD)
+    {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        for (j = 0; j < num_modes; j++)
+        {
+            const float *v = vectors + (size_t)j * stride + i;
+            __m256 w = _mm256_set1_ps(weights[j]);
+            acc0 = _mm256_fmadd_ps(w, _mm256_load_ps(v), acc0);
+            acc1 = _mm256_fmadd_ps(w, _mm256_load_ps(v + 8), acc1);
+            acc2 = _mm256_fmadd_ps(w, _mm256_load_ps(v + 16), acc2);
+            acc3 = _mm256_fmadd_ps(w, _mm256_load_ps(v + 24), acc3);
+        }
+        _mm256_store_ps(y + i, acc0);
+        _mm256_store_ps(y + i + 8, acc1);
+        _mm256_store_ps(y + i + 16, acc2);
+        _mm256_store_ps(y + i + 24, acc3);
+    }
+#elif defined(__SSE2__)
+    int k;
+
+    for (i = 0; i < stride; i += PAD)
+    {
+        __m128 acc[PAD / 4];
+        for (k = 0; k < PAD / 4; k++)
+            acc[k] = _mm_setzero_ps();
+        for (j = 0; j < num_modes; j++)
+        {
+            const float *v = vectors + (size_t)j * stride + i;
+            __m128 w = _mm_set1_ps(weights[j]);
+            for (k = 0; k < PAD / 4; k++)
+                acc[k] = _mm_add_ps(acc[k],
+                        _mm_mul_ps(w, _mm_load_ps(v + 4 * k)));
+        }
+        for (k = 0; k < PAD / 4; k++)
+            _mm_store_ps(y + i + 4 * k, acc[k]);
+    }
+#else
+    memset(y, 0, stride * sizeof(float));
+    for (j = 0; j < num_modes; j++)
+    {
+        const float *v = vectors + (size_t)j * stride;
+        for (i = 0; i < stride; i++)
+            y[i] += weights[j] * v[i];
+    }
+#endif
+}
+
+/* y = sum over modes of weights[j] * vectors[j] for a uniform chain, where
+ * mode mode_index[j] is the sine wave
+ * sqrt(2 / (N + 1)) sin((i + 1)(mode_index[j] + 1) pi / (N + 1)), so y is the
+ * discrete sine transform of the weights. */
+static void sine_frame(Synth *synth, double *y)
+{
+    double *data = synth->transform;
+    int j;
+
+    memset(data, 0, synth->num_beads * sizeof(double));
+    for (j = 0; j < synth->num_modes; j++)
+        data[synth->mode_index[j]] = synth->weights[j];
+
+    sine_transform(data, synth->num_beads, synth->wavetable,
+            synth->fft_workspace);
+    memcpy(y, data, synth->num_beads * sizeof(double));
+}
+
+/* y = sum over modes of weights[j] * vectors[j], reading the eigenvectors in
+ * place from synth->mapped a tile of rows at a time. Each tile is released
+ * once read, so a frame never holds more than one tile in memory. */
+static void mapped_frame(Synth *synth, double *y)
+{
+    const Result *result = &synth->mapped;
+    int first, rows, i, j;
+
+    for (first = 0; first < synth->num_beads; first += rows)
+    {
+        rows = synth->num_beads - first < result->tile_rows
+            ? synth->num_beads - first : result->tile_rows;
+        for (i = first; i < first + rows; i++)
+        {
+            const double *row = result->eigenvectors[i];
+            double sum = 0;
+
+            for (j = 0; j < synth->num_modes; j++)
+                sum += synth->weights[j] * row[synth->mode_index[j]];
+            y[i] = sum;
+        }
+        ls_release_rows(result, first, rows);
+    }
+}
+
+/* Computes the largest difference between the float32 frames of synth and the
+ * double precision frames given by result, over ERROR_SAMPLES frames spread
+ * across one period of the slowest oscillating mode. */
+static double measure_error(Synth *synth, Result result)
+{
+    double *y, *ref;
+    double period, err = 0;
+    int i, j, k;
+
+    y = malloc(synth->num_beads * sizeof(double));
+    ref = malloc(synth->num_beads * sizeof(double));
+    if (y == NULL || ref == NULL)
+    {
+        free(y);
+        free(ref);
+        return NAN;
+    }
+
+    /* A ring's slowest mode doesn't oscillate */
+    for (j = 0; j < result.num_modes - 1; j++)
+        if (result.eigenfrequencies[j] > 0)
+            break;
+    period = 2 * M_PI / result.eigenfrequencies[j];
+    for (k = 0; k < ERROR_SAMPLES; k++)
+    {
+        double t = k * period / ERROR_SAMPLES;
+
+        synth_frame(synth, t, y);
+
+        /* The weights of the frame just computed are still in scratch */
+        for (i = 0; i < synth->num_beads; i++)
+        {
+            ref[i] = 0;
+            for (j = 0; j < synth->num_modes; j++)
+                ref[i] += synth->weights[j]
+                    * result.eigenvectors[i][synth->mode_index[j]];
+            if (fabs(y[i] - ref[i]) > err)
+                err = fabs(y[i] - ref[i]);
+        }
+    }
+
+    free(y);
+    free(ref);
+
+    return err;
+}
+
+/* Used to sort modes by decreasing energy */
+typedef struct mode_energy
+{
+    int index; /* Index of the mode in the Result */
+    double energy; /* a^2 + b^2 of the mode */
+    bool aliased; /* True if the mode is too fast for the output to show */
+} ModeEnergy;
+
+static int compare_energy_desc(const void *p, const void *q)
+{
+    const ModeEnergy *a = p, *b = q;
+
+    /* Aliased modes go last, so that they are the first to be dropped */
+    if (a->aliased != b->aliased)
+        return a->aliased - b->aliased;
+    if (a->energy < b->energy)
+        return 1;
+    if (a->energy > b->energy)
+        return -1;
+    return a->index - b->index;
+}
+
+static int compare_int_asc(const void *p, const void *q)
+{
+    return *(const int *)p - *(const int *)q;
+}
+
+/* Picks the fewest modes of result whose a^2 + b^2 add up to energy_fraction
+ * of the total, never one above max_frequency unless it is 0, and fills in
+ * mode_index, num_modes, num_filtered, energy_kept, energy_filtered and
+ * truncation_bound of synth. At least one mode is always kept, so the lowest
+ * mode must not be above max_frequency. Returns 1 if an error occured, 0
+ * otherwise. */
+static int select_modes(Synth *synth, Result result, double energy_fraction,
+        double max_frequency)
+{
+    ModeEnergy *modes;
+    double *max_component;
+    double total = 0, kept = 0, filtered = 0;
+    int eligible = 0;
+    int i, j;
+
+    modes = malloc(result.num_modes * sizeof(ModeEnergy));
+    synth->mode_index = malloc(result.num_modes * sizeof(int));
+    if (modes == NULL || synth->mode_index == NULL)
+    {
+        free(modes);
+        return 1;
+    }
+
+    for (j = 0; j < result.num_modes; j++)
+    {
+        modes[j].index = j;
+        modes[j].energy = pow(result.coefficients[j].a, 2)
+            + pow(result.coefficients[j].b, 2);
+        modes[j].aliased = max_frequency > 0
+            && result.eigenfrequencies[j] > max_frequency;
+        total += modes[j].energy;
+        if (modes[j].aliased)
+            filtered += modes[j].energy;
+        else
+            eligible++;
+    }
+    assert(eligible > 0);
+
+    qsort(modes, result.num_modes, sizeof(ModeEnergy), compare_energy_desc);
+
+    synth->num_modes = 0;
+    do
+    {
+        kept += modes[synth->num_modes].energy;
+        synth->mode_index[synth->num_modes] = modes[synth->num_modes].index;
+        synth->num_modes++;
+    }
+    while (synth->num_modes < eligible && kept < energy_fraction * total);
+
+    synth->energy_kept = total > 0 ? kept / total : 1.0;
+    synth->energy_filtered = total > 0 ? filtered / total : 0.0;
+    synth->num_filtered = result.num_modes - eligible;
+
+    /* A dropped mode moves bead i by at most its amplitude times |v_i|, so
+     * the largest component of each dropped eigenvector bounds the error.
+     * The eigenvectors are scanned by rows, as a mapped Result is stored. */
+    synth->truncation_bound = 0;
+    if (synth->num_modes < result.num_modes)
+    {
+        max_component = calloc(result.num_modes, sizeof(double));
+        if (max_component == NULL)
+        {
+            free(modes);
+            return 1;
+        }
+        for (i = 0; i < result.num_beads; i++)
+        {
+            for (j = synth->num_modes; j < result.num_modes; j++)
+            {
+                double v = fabs(result.eigenvectors[i][modes[j].index]);
+
+                if (v > max_component[j])
+                    max_component[j] = v;
+            }
+            if (result.tile_rows > 0 && i % result.tile_rows == 0 && i > 0)
+                ls_release_rows(&result, i - result.tile_rows,
+                        result.tile_rows);
+        }
+        ls_release_rows(&result, 0, result.num_beads);
+        for (j = synth->num_modes; j < result.num_modes; j++)
+            synth->truncation_bound += sqrt(modes[j].energy)
+                * max_component[j];
+        free(max_component);
+    }
+
+    /* Keep the selected modes in their original order */
+    qsort(synth->mode_index, synth->num_modes, sizeof(int), compare_int_asc);
+
+    free(modes);
+
+    return 0;
+}
+
+int synth_init(Synth *synth, Result result, bool single_precision,
+        double energy_fraction, double max_frequency)
+{
+    size_t size;
+    int i, j;
+
+    assert(synth != NULL);
+    assert(result.eigenfrequencies != NULL);
+    assert(result.eigenvectors != NULL);
+    assert(result.coefficients != NULL);
+
+    memset(synth, 0, sizeof(Synth));
+    synth->num_beads = result.num_beads;
+    synth->total_modes = result.num_modes;
+    synth->stride = (result.num_beads + PAD - 1) / PAD * PAD;
+    /* Mapped eigenvectors are too large to copy, so they are summed in place
+     * in double precision */
+    if (result.tile_rows > 0)
+    {
+        single_precision = false;
+        synth->mapped = result;
+    }
+    synth->single_precision = single_precision;
+
+    /* The eigenfrequencies are sorted, so the lowest is first */
+    if (max_frequency > 0 && result.eigenfrequencies[0] > max_frequency)
+    {
+        fprintf(stderr, "Output rate too low: every mode is above its Nyquist "
+                "frequency of %.4g rad/s.\n", max_frequency);
+        return 1;
+    }
+
+    if (select_modes(synth, result, energy_fraction, max_frequency))
+    {
+        fprintf(stderr, "Failed to allocate memory for synthesis.\n");
+        synth_free(synth);
+        return 1;
+    }
+
+    synth->frequencies = malloc(synth->num_modes * sizeof(double));
+    synth->coefficients = malloc(synth->num_modes * sizeof(Coefficient));
+    synth->weights = malloc(synth->num_modes * sizeof(double));
+    if (synth->frequencies == NULL || synth->coefficients == NULL
+            || synth->weights == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for synthesis.\n");
+        synth_free(synth);
+        return 1;
+    }
+
+    for (j = 0; j < synth->num_modes; j++)
+    {
+        synth->frequencies[j] =
+            result.eigenfrequencies[synth->mode_index[j]];
+        synth->coefficients[j] = result.coefficients[synth->mode_index[j]];
+    }
+
+    size = (size_t)synth->num_modes * synth->stride;
+    if (result.sine_modes && !single_precision)
+    {
+        size = 2 * (synth->num_beads + 1);
+        synth->sine_transform = true;
+        synth->transform = malloc(size * sizeof(double));
+        synth->wavetable = gsl_fft_real_wavetable_alloc(size);
+        synth->fft_workspace = gsl_fft_real_workspace_alloc(size);
+        if (synth->transform == NULL || synth->wavetable == NULL
+                || synth->fft_workspace == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory for synthesis.\n");
+            synth_free(synth);
+            return 1;
+        }
+    }
+    else if (single_precision)
+    {
+        synth->vectors_f32 = alloc_aligned(size * sizeof(float));
+        synth->weights_f32 = malloc(synth->num_modes * sizeof(float));
+        synth->frame_f32 = alloc_aligned(synth->stride * sizeof(float));
+        if (synth->vectors_f32 == NULL || synth->weights_f32 == NULL
+                || synth->frame_f32 == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory for synthesis.\n");
+            synth_free(synth);
+            return 1;
+        }
+        memset(synth->vectors_f32, 0, size * sizeof(float));
+        for (j = 0; j < synth->num_modes; j++)
+            for (i = 0; i < synth->num_beads; i++)
+                synth->vectors_f32[(size_t)j * synth->stride + i] =
+                    (float)result.eigenvectors[i][synth->mode_index[j]];
+    }
+    else if (result.tile_rows == 0)
+    {
+        synth->vectors = alloc_aligned(size * sizeof(double));
+        if (synth->vectors == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory for synthesis.\n");
+            synth_free(synth);
+            return 1;
+        }
+        memset(synth->vectors, 0, size * sizeof(double));
+        for (j = 0; j < synth->num_modes; j++)
+            for (i = 0; i < synth->num_beads; i++)
+                synth->vectors[(size_t)j * synth->stride + i] =
+                    result.eigenvectors[i][synth->mode_index[j]];
+    }
+
+    if (synth->num_modes < synth->total_modes)
+        printf("Synthesizing %d of %d modes (%.4g%% of mode energy), "
+                "truncation error at most %.3g m.\n", synth->num_modes,
+                synth->total_modes, 100 * synth->energy_kept,
+                synth->truncation_bound);
+    if (synth->num_filtered > 0)
+        printf("Filtered out %d modes above the output's Nyquist frequency of "
+                "%.4g rad/s, carrying %.4g%% of mode energy.\n",
+                synth->num_filtered, max_frequency,
+                100 * synth->energy_filtered);
+
+    if (single_precision)
+    {
+        synth->max_error = measure_error(synth, result);
+        printf("Using %s float32 synthesis kernel, max error %.3g m against "
+                "double precision.\n", KERNEL_NAME, synth->max_error);
+    }
+
+    return 0;
+}
+
+void synth_frame(Synth *synth, double t, double *y)
+{
+    int i, j;
+
+    assert(synth != NULL);
+    assert(y != NULL);
+
+    calc_weights(synth, t);
+
+    if (synth->single_precision)
+    {
+        for (j = 0; j < synth->num_modes; j++)
+            synth->weights_f32[j] = (float)synth->weights[j];
+        kernel_f32(synth->vectors_f32, synth->weights_f32, synth->num_modes,
+                synth->stride, synth->frame_f32);
+        for (i = 0; i < synth->num_beads; i++)
+            y[i] = synth->frame_f32[i];
+    }
+    else if (synth->sine_transform)
+        sine_frame(synth, y);
+    else if (synth->mapped.tile_rows > 0)
+        mapped_frame(synth, y);
+    else
+        kernel_f64(synth->vectors, synth->weights, synth->num_modes,
+                synth->num_beads, synth->stride, y);
+}
+
+void synth_free(Synth *synth)
+{
+    assert(synth != NULL);
+
+    free(synth->mode_index);
+    free(synth->frequencies);
+    free(synth->coefficients);
+    free(synth->vectors);
+    free(synth->vectors_f32);
+    free(synth->weights);
+    free(synth->weights_f32);
+    free(synth->frame_f32);
+    free(synth->transform);
+    if (synth->wavetable != NULL)
+        gsl_fft_real_wavetable_free(synth->wavetable);
+    if (synth->fft_workspace != NULL)
+        gsl_fft_real_workspace_free(synth->fft_workspace);
+    memset(synth, 0, sizeof(Synth));
+}
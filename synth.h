@@ -0,0 +1,83 @@
+/*----------------------------------------------------------------------------*/
+/* synth.h                                                                    */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SYNTH_INCLUDED
+#define SYNTH_INCLUDED
+
+#include <stdbool.h>
+#include <gsl/gsl_fft_real.h>
+#include "types.h"
+
+/* Evaluates bead displacements of a solved system at arbitrary times. The
+ * eigenvectors are copied into a mode-major, padded layout so that a frame is a
+ * sequence of vectorized multiply-adds over beads. In single precision mode
+ * only a float32 copy of the eigenvectors is kept, which halves the memory
+ * traffic of every frame. Only the modes carrying the requested fraction of
+ * the mode energy are kept, so a frame costs num_modes x num_beads. Uniform
+ * chains, whose modes are sine waves, are instead synthesized in double
+ * precision with a discrete sine transform of the modal weights, which costs
+ * num_beads log(num_beads) per frame and needs no copy of the eigenvectors.
+ * Eigenvectors mapped from a file are not copied either: they are read in
+ * place, a tile of rows at a time, in double precision. */
+typedef struct synth
+{
+    int num_beads; /* Number of beads in a frame */
+    int num_modes; /* Number of modes summed for each frame */
+    int total_modes; /* Number of modes in the Result */
+    int *mode_index; /* Array of num_modes indices of the kept modes in the
+                        Result, in ascending order */
+    int stride; /* num_beads padded up to a multiple of the kernel width */
+    bool single_precision; /* True if frames use the float32 kernel */
+    bool sine_transform; /* True if frames are computed with a discrete sine
+                            transform */
+    double *frequencies; /* Array of num_modes eigenfrequencies */
+    Coefficient *coefficients; /* Array of num_modes coefficients */
+    double *vectors; /* num_modes x stride eigenvectors, mode-major. NULL in
+                        single precision mode, with sine transforms and for
+                        mapped eigenvectors. */
+    float *vectors_f32; /* Same as vectors, in float32. NULL in double
+                           precision mode. */
+    double *weights; /* Scratch for the per-frame modal weights */
+    float *weights_f32; /* Scratch for the float32 modal weights */
+    float *frame_f32; /* Scratch for the float32 frame */
+    double *transform; /* Scratch for the 2 (num_beads + 1) point sine
+                          transform. NULL without sine transforms. */
+    gsl_fft_real_wavetable *wavetable; /* FFT factors for the transform */
+    gsl_fft_real_workspace *fft_workspace; /* FFT scratch for the transform */
+    Result mapped; /* The Result, if its eigenvectors are mapped from a file
+                      and must outlive synth. Zeroed otherwise. */
+    double max_error; /* Largest difference between the float32 and double
+                         frames seen at creation time, in m. 0 in double
+                         precision mode. */
+    double energy_kept; /* Fraction of the total mode energy, measured as
+                           a^2 + b^2, carried by the kept modes */
+    int num_filtered; /* Number of modes dropped for being above the
+                         max_frequency given to synth_init */
+    double energy_filtered; /* Fraction of the total mode energy carried by
+                               those modes */
+    double truncation_bound; /* Upper bound on the displacement error of any
+                                bead caused by the dropped modes, in m */
+} Synth;
+
+/* Builds a Synth for result, keeping the fewest modes whose amplitudes
+ * sqrt(a^2 + b^2) cover energy_fraction of the total a^2 + b^2. An
+ * energy_fraction of 1.0 keeps every mode. Modes above max_frequency (in
+ * rad/s) are dropped first, whatever their energy: frames sampled at
+ * intervals of dt can't show modes above the Nyquist frequency pi / dt,
+ * which would alias to slow, spurious motion. A max_frequency of 0 keeps
+ * them. If single_precision is true, frames are computed with the float32
+ * kernel and max_error is measured against the double path, unless the
+ * eigenvectors are mapped. Returns 1 if an error occured, 0 otherwise. */
+int synth_init(Synth *synth, Result result, bool single_precision,
+        double energy_fraction, double max_frequency);
+
+/* Computes the displacement of every bead at time t and stores them in y, an
+ * array of num_beads doubles. */
+void synth_frame(Synth *synth, double t, double *y);
+
+/* Frees all dynamically allocated parts of synth. */
+void synth_free(Synth *synth);
+
+#endif
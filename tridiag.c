@@ -0,0 +1,311 @@
+/*----------------------------------------------------------------------------*/
+/* tridiag.c                                                                  */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+#include <math.h>
+
+#include "tridiag.h"
+#include "asolve.h"
+
+#define MAX_QL_ITERATIONS 60 /* Per eigenvalue */
+#define MAX_INVERSE_ITERATIONS 5
+#define MIN_INVERSE_ITERATIONS 2
+#define MAX_STARTS 4 /* Start vectors tried before giving up on a vector */
+
+int cluster_size(const double *eval, int last, int count, double lambda,
+        double scale)
+{
+    int c = 0;
+
+    while (c < count && lambda - eval[last - c] <= CLUSTER_TOL * scale)
+        c++;
+
+    return c;
+}
+
+void chain_tridiagonal(const Simulation *sim, double *diag, double *offdiag)
+{
+    const Bead *beads = sim->beads;
+    int i;
+
+    assert(sim->sim_type != MEMBRANE);
+    assert(!sim->periodic);
+
+    for (i = 0; i < sim->num_beads; i++)
+    {
+        diag[i] = (spring_constant(sim, sim->connections[i])
+                + spring_constant(sim, sim->connections[i + 1]))
+            / beads[i].mass;
+        if (i + 1 < sim->num_beads)
+            offdiag[i] = -spring_constant(sim, sim->connections[i + 1])
+                / sqrt(beads[i].mass * beads[i + 1].mass);
+    }
+}
+
+static int compare_double(const void *p, const void *q)
+{
+    double a = *(const double *)p, b = *(const double *)q;
+
+    return (a > b) - (a < b);
+}
+
+int tridiag_eigenvalues(const double *diag, const double *offdiag, int n,
+        double *work, double *eval)
+{
+    double *d = eval, *e = work;
+    int l, m, i, iter;
+
+    assert(n > 0);
+
+    memcpy(d, diag, n * sizeof(double));
+    if (n > 1)
+        memcpy(e, offdiag, (n - 1) * sizeof(double));
+    e[n - 1] = 0;
+
+    for (l = 0; l < n; l++)
+    {
+        iter = 0;
+        do
+        {
+            double g, r, s, c, p, f, b;
+
+            /* Look for a negligible off-diagonal entry that splits off the
+             * block starting at l */
+            for (m = l; m < n - 1; m++)
+                if (fabs(e[m]) <= DBL_EPSILON * (fabs(d[m]) + fabs(d[m + 1])))
+                    break;
+            if (m == l)
+                break;
+            if (iter++ == MAX_QL_ITERATIONS)
+                return 1;
+
+            /* Wilkinson shift from the leading 2 x 2 block */
+            g = (d[l + 1] - d[l]) / (2 * e[l]);
+            r = hypot(g, 1.0);
+            g = d[m] - d[l] + e[l] / (g + copysign(r, g));
+            s = c = 1;
+            p = 0;
+
+            /* Chase the bulge up from m to l with plane rotations */
+            for (i = m - 1; i >= l; i--)
+            {
+                f = s * e[i];
+                b = c * e[i];
+                e[i + 1] = r = hypot(f, g);
+                if (r == 0)
+                {
+                    /* Underflow: the block has split at i + 1 */
+                    d[i + 1] -= p;
+                    e[m] = 0;
+                    break;
+                }
+                s = f / r;
+                c = g / r;
+                g = d[i + 1] - p;
+                r = (d[i] - g) * s + 2 * c * b;
+                p = s * r;
+                d[i + 1] = g + p;
+                g = c * r - b;
+            }
+            if (r == 0 && i >= l)
+                continue;
+
+            d[l] -= p;
+            e[l] = g;
+            e[m] = 0;
+        }
+        while (m != l);
+    }
+
+    qsort(d, n, sizeof(double), compare_double);
+
+    return 0;
+}
+
+/* Factors the tridiagonal matrix minus shift as P L U by Gaussian elimination
+ * with partial pivoting. U has diagonal u0 and two superdiagonals u1 and u2;
+ * l holds the multipliers and swap is 1 where rows were exchanged. A zero
+ * pivot is replaced by tiny, which inverse iteration tolerates. */
+static void factor(const double *diag, const double *offdiag, int n,
+        double shift, double tiny, double *u0, double *u1, double *u2,
+        double *l, double *swap)
+{
+    /* The row still to be eliminated, which has entries in columns i and
+     * i + 1 only */
+    double p = diag[0] - shift;
+    double q = n > 1 ? offdiag[0] : 0;
+    int i;
+
+    for (i = 0; i < n - 1; i++)
+    {
+        double sub = offdiag[i];
+        double next_diag = diag[i + 1] - shift;
+        double next_sup = i + 2 < n ? offdiag[i + 1] : 0;
+
+        if (fabs(p) >= fabs(sub))
+        {
+            if (p == 0)
+                p = tiny;
+            swap[i] = 0;
+            l[i] = sub / p;
+            u0[i] = p;
+            u1[i] = q;
+            u2[i] = 0;
+            p = next_diag - l[i] * q;
+            q = next_sup;
+        }
+        else
+        {
+            swap[i] = 1;
+            l[i] = p / sub;
+            u0[i] = sub;
+            u1[i] = next_diag;
+            u2[i] = next_sup;
+            p = q - l[i] * next_diag;
+            q = -l[i] * next_sup;
+        }
+    }
+    u0[n - 1] = p == 0 ? tiny : p;
+}
+
+/* Solves P L U z = x with the factors from factor */
+static void solve(int n, const double *u0, const double *u1, const double *u2,
+        const double *l, const double *swap, const double *x, double *z)
+{
+    double r = x[0];
+    int i;
+
+    for (i = 0; i < n - 1; i++)
+    {
+        if (swap[i] == 0)
+        {
+            z[i] = r;
+            r = x[i + 1] - l[i] * r;
+        }
+        else
+        {
+            z[i] = x[i + 1];
+            r -= l[i] * x[i + 1];
+        }
+    }
+    z[n - 1] = r;
+
+    z[n - 1] /= u0[n - 1];
+    if (n > 1)
+        z[n - 2] = (z[n - 2] - u1[n - 2] * z[n - 1]) / u0[n - 2];
+    for (i = n - 3; i >= 0; i--)
+        z[i] = (z[i] - u1[i] * z[i + 1] - u2[i] * z[i + 2]) / u0[i];
+}
+
+/* Returns |(T - lambda) v| for the tridiagonal T with diagonal diag and
+ * off-diagonal offdiag */
+static double residual(const double *diag, const double *offdiag, int n,
+        double lambda, const double *v)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        double r = (diag[i] - lambda) * v[i];
+
+        if (i > 0)
+            r += offdiag[i - 1] * v[i - 1];
+        if (i + 1 < n)
+            r += offdiag[i] * v[i + 1];
+        sum += r * r;
+    }
+
+    return sqrt(sum);
+}
+
+/* Removes the components of z along the count unit vectors in cluster and
+ * returns the length of what is left */
+static double orthogonalize(int n, const double *const *cluster, int count,
+        double *z)
+{
+    double norm = 0;
+    int i, k;
+
+    for (k = 0; k < count; k++)
+    {
+        double dot = 0;
+
+        for (i = 0; i < n; i++)
+            dot += cluster[k][i] * z[i];
+        for (i = 0; i < n; i++)
+            z[i] -= dot * cluster[k][i];
+    }
+
+    for (i = 0; i < n; i++)
+        norm += z[i] * z[i];
+
+    return sqrt(norm);
+}
+
+int tridiag_eigenvector(const double *diag, const double *offdiag, int n,
+        double lambda, double scale, const double *const *cluster, int count,
+        unsigned seed, double *work, double *vec)
+{
+    double *u0 = work, *u1 = work + n, *u2 = work + 2 * n;
+    double *l = work + 3 * n, *swap = work + 4 * n, *z = work + 5 * n;
+    double tiny = DBL_EPSILON * fmax(scale, DBL_MIN);
+    /* Residual of a vector once lambda is as close as rounding allows, and
+     * the growth of the solve that gives it */
+    double tol = 1e3 * sqrt(n) * tiny;
+    double converged = 1 / tol;
+    int start, iter, i;
+
+    assert(n > 0);
+
+    factor(diag, offdiag, n, lambda, tiny, u0, u1, u2, l, swap);
+
+    for (start = 0; start < MAX_STARTS; start++)
+    {
+        uint32_t state = 2654435761u * (seed + 1) + 0x9E3779B9u * start;
+        double norm;
+
+        /* Pseudorandom start, so that no eigenvector is missed by chance */
+        for (i = 0; i < n; i++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            vec[i] = state / (double)UINT32_MAX - 0.5;
+        }
+        norm = orthogonalize(n, cluster, count, vec);
+        if (norm == 0)
+            continue;
+        for (i = 0; i < n; i++)
+            vec[i] /= norm;
+
+        /* Each solve multiplies the wanted component by 1 / |error in
+         * lambda| */
+        for (iter = 0; iter < MAX_INVERSE_ITERATIONS; iter++)
+        {
+            solve(n, u0, u1, u2, l, swap, vec, z);
+            norm = orthogonalize(n, cluster, count, z);
+            if (!(norm > 0) || !isfinite(norm))
+                break;
+            for (i = 0; i < n; i++)
+                vec[i] = z[i] / norm;
+            if (iter + 1 >= MIN_INVERSE_ITERATIONS && norm >= converged)
+                break;
+        }
+
+        /* Growth only bounds the residual before orthogonalization, and a
+         * vector that didn't grow enough may still be good; check it, and
+         * try another start if it isn't */
+        if (norm > 0 && isfinite(norm)
+                && residual(diag, offdiag, n, lambda, vec) <= tol)
+            return 0;
+    }
+
+    return 1;
+}
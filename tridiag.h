@@ -0,0 +1,57 @@
+/*----------------------------------------------------------------------------*/
+/* tridiag.h                                                                  */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef TRIDIAG_INCLUDED
+#define TRIDIAG_INCLUDED
+
+#include <stdbool.h>
+#include "types.h"
+
+/* Internal to libloadedstring. */
+
+/* Eigenvalues closer than this fraction of the largest are treated as a
+ * cluster, whose eigenvectors are orthogonalized against each other.
+ * Inverse iteration leaves the vectors of eigenvalues a fraction g apart
+ * orthogonal to about DBL_EPSILON / g, so this keeps them within 1e-10.
+ * LAPACK's dstein uses 1e-3, but that would make the lowest modes of a long
+ * chain, about 0.2 CLUSTER_TOL N^2 of them, one cluster, and a cluster of k
+ * vectors costs O(k^2 N) time. */
+#define CLUSTER_TOL 1e-6
+
+/* Eigenvectors of neighbouring eigenvalues are trusted only if they are
+ * orthogonal to within this */
+#define ORTHO_TOL 1e-8
+
+/* Returns how many of the count eigenvalues in eval ending at index last,
+ * counting back, lie within CLUSTER_TOL scale of eigenvalue lambda */
+int cluster_size(const double *eval, int last, int count, double lambda,
+        double scale);
+
+/* Fills diag and offdiag, arrays of num_beads and num_beads - 1 doubles, with
+ * the dynamical matrix M^-1/2 K M^-1/2 of sim, a string or spring chain, which
+ * is tridiagonal: offdiag[i] joins beads i and i + 1. */
+void chain_tridiagonal(const Simulation *sim, double *diag, double *offdiag);
+
+/* Finds the eigenvalues of the symmetric tridiagonal matrix of size n with
+ * diagonal diag and off-diagonal offdiag by the QL algorithm with implicit
+ * shifts, and stores them in eval in ascending order. No eigenvectors are
+ * formed, so this costs O(n^2) time and O(n) memory. work holds n doubles.
+ * Returns 1 if an eigenvalue fails to converge, 0 otherwise. */
+int tridiag_eigenvalues(const double *diag, const double *offdiag, int n,
+        double *work, double *eval);
+
+/* Finds a unit eigenvector vec of the same matrix for the eigenvalue lambda
+ * by inverse iteration, orthogonal to the count unit vectors in cluster, the
+ * eigenvectors already found for eigenvalues within CLUSTER_TOL of lambda.
+ * scale is the largest eigenvalue magnitude. seed picks the start vector, so
+ * that equal eigenvalues get different vectors. A vector is only accepted if
+ * |(T - lambda) vec| is within 1e3 sqrt(n) DBL_EPSILON scale; otherwise other
+ * start vectors are tried. work holds 6 n doubles. Returns 1 if no such
+ * vector was found, 0 otherwise. */
+int tridiag_eigenvector(const double *diag, const double *offdiag, int n,
+        double lambda, double scale, const double *const *cluster, int count,
+        unsigned seed, double *work, double *vec);
+
+#endif
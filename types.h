@@ -7,8 +7,9 @@
 #define TYPES_INCLUDED
 
 #include <limits.h>
+#include <stdbool.h>
 
-enum SimType {STRING, SPRING}; /* Simulation types */
+enum SimType {STRING, SPRING, MEMBRANE}; /* Simulation types */
 
 typedef struct bead
 {
@@ -20,31 +21,63 @@ typedef struct bead
 typedef struct simulation
 {
     char filename[NAME_MAX + 1]; /* prefix of simulation input file name */
-    enum SimType sim_type; /* Either STRING or SPRING */
-    Bead *beads; /* Array containing num_beads beads */
+    enum SimType sim_type; /* STRING, SPRING or MEMBRANE */
+    Bead *beads; /* Array containing num_beads beads. For membrane simulations,
+                    bead r * cols + c is in row r, column c. */
     double *connections; /* Array of length num_beads + 1. For string
                             simulations, represents distance between beads in m.
                             For spring simulations, represents spring constants
-                            of springs between beads in N/m. */
-    double tension; /* For string simulations, the tension in the string in N */
+                            of springs between beads in N/m. NULL for membrane
+                            simulations. */
+    bool periodic; /* True for rings: connection 0 joins the last bead back to
+                      the first instead of to a wall, and
+                      connections[num_beads] is kept equal to connections[0] */
+    double tension; /* For string simulations, the tension in the string in N.
+                       For membrane simulations, the tension along rows. */
     int num_beads; /* Number of beads */
+    int rows, cols; /* For membrane simulations, the size of the grid of beads.
+                       The edge beads are joined to a fixed frame. */
+    double tension_y; /* For membrane simulations, the tension along columns
+                         in N */
+    double spacing_x, spacing_y; /* For membrane simulations, distance between
+                                    neighbouring beads along rows and columns
+                                    in m */
+    int num_modes; /* For membrane simulations, number of lowest modes to
+                      find */
 } Simulation;
 
 typedef struct coefficient
 {
     double a; /* Coefficient of the cosine term */
-    double b; /* Coefficient of the sine term */
+    double b; /* Coefficient of the sine term. For a mode of zero frequency,
+                 such as a ring moving rigidly, the velocity of the mode, which
+                 then moves as a + b t. */
 } Coefficient;
 
 typedef struct result
 {
-    int num_modes; /* Number of normal modes. Equal to number of beads. */
+    int num_modes; /* Number of normal modes. Equal to number of beads, except
+                      for membranes where only the lowest modes are found. */
+    int num_beads; /* Number of beads */
     double *eigenfrequencies; /* Array containing num_modes eigenfrequencies.
                                  Sorted in order from smallest to largest. */
-    double **eigenvectors; /* Array containing num_modes arrays of normalized
-                              eigenvectors. Each eigenvector corresponds to the
-                              eigenfrequency in above array. */
+    double **eigenvectors; /* Array containing num_beads arrays of num_modes
+                              entries. Entry [i][j] is the displacement of bead
+                              i in normalized eigenvector j, which corresponds
+                              to eigenfrequency j in above array. Unless
+                              sine_modes, the first of the largest entries of
+                              each eigenvector is positive. */
     Coefficient *coefficients; /* Array of num_modes Coefficients */
+    bool sine_modes; /* True if eigenvector j is the sine wave
+                        sqrt(2 / (N + 1)) sin((i + 1)(j + 1) pi / (N + 1)) of
+                        a uniform chain of N beads, so displacements are a
+                        discrete sine transform of the modal weights */
+    int tile_rows; /* 0 if the eigenvectors are in memory. Otherwise they are
+                      mapped from a file, and are best read this many rows at
+                      a time, handing each tile back with ls_release_rows */
+    struct lazy_modes *lazy; /* NULL if every eigenvector is in place.
+                                Otherwise each is found the first time
+                                ls_find_mode asks for it, and kept. */
 } Result;
 
 #endif
@@ -0,0 +1,528 @@
+/*----------------------------------------------------------------------------*/
+/* update.c                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+
+#include "update.h"
+#include "asolve.h"
+#include "tridiag.h"
+#include "alloc.h"
+
+#define DEFLATE_TOL (8 * DBL_EPSILON) /* Relative size of a negligible
+                                         coupling or eigenvalue gap */
+#define MAX_SECULAR_ITERATIONS 100 /* Iterations per root of the secular
+                                      equation, bisections included */
+
+/* Returns the mass of bead i of sim before change */
+static double old_mass(const Simulation *sim, Change change, int i)
+{
+    if (change.mass && change.index == i)
+        return change.old_value;
+
+    return sim->beads[i].mass;
+}
+
+/* Evaluates the secular function 1 + rho sum w_i^2 / (d_i - mu) of the n
+ * ascending poles d at mu = d[k] + tau. Differences to the poles are taken
+ * from d[k] so that roots close to it are resolved accurately. The terms of
+ * the poles up to d[j] and those above it are kept apart: deriv[0] and
+ * deriv[1] are the derivatives of each part, and *size is the sum of the
+ * magnitudes of the terms, which bounds the rounding error. */
+static double secular(const double *d, const double *w, double rho, int n,
+        int j, int k, double tau, double *deriv, double *size)
+{
+    double f = 1;
+    int i;
+
+    deriv[0] = 0;
+    deriv[1] = 0;
+    *size = 1;
+    for (i = 0; i < n; i++)
+    {
+        double delta = (d[i] - d[k]) - tau;
+        double term = rho * w[i] * w[i] / delta;
+
+        f += term;
+        *size += fabs(term);
+        deriv[i > j] += term / delta;
+    }
+
+    return f;
+}
+
+/* Returns the step from tau toward the root of the secular function between
+ * its poles d[j] and d[j + 1], which lie lo_pole and hi_pole away from
+ * mu = d[k] + tau, given its value f and the derivatives deriv of its two
+ * parts there, as secular gives them. The parts are modelled as single poles
+ * at d[j] and d[j + 1] of the same value and slope, plus a constant, and the
+ * step is to the root of the model between them. For the last root there is
+ * no pole above, and hi_pole is 0. This is the "middle way" of LAPACK's
+ * dlaed4, after Li and Gragg, which converges in a few steps. Returns NaN if
+ * the model has no real root. */
+static double secular_step(double f, const double *deriv, double lo_pole,
+        double hi_pole)
+{
+    double a, b, c, disc;
+
+    if (hi_pole == 0)
+    {
+        /* f = c + lo_pole^2 deriv / (lo_pole - eta) */
+        c = f - lo_pole * deriv[0];
+        return lo_pole + lo_pole * lo_pole * deriv[0] / c;
+    }
+
+    /* The model's root is the smaller root of c eta^2 - a eta + b */
+    c = f - lo_pole * deriv[0] - hi_pole * deriv[1];
+    a = (lo_pole + hi_pole) * f - lo_pole * hi_pole * (deriv[0] + deriv[1]);
+    b = lo_pole * hi_pole * f;
+    if (c == 0)
+        return b / a;
+    disc = a * a - 4 * b * c;
+    if (disc < 0)
+        return NAN;
+    if (a <= 0)
+        return (a - sqrt(disc)) / (2 * c);
+    return 2 * b / (a + sqrt(disc));
+}
+
+/* Finds the n roots of 1 + rho sum w_i^2 / (d_i - mu) for distinct ascending
+ * d, rho > 0 and nonzero w. Root j lies between d[j] and d[j + 1], or above
+ * d[n - 1] by at most rho |w|^2, and is stored as d[origin[j]] + tau[j] with
+ * origin[j] the nearer of the two poles. The function increases between
+ * poles, so each root stays bracketed while secular_step homes in on it, and
+ * a step that would leave the bracket is replaced by a bisection. */
+static void solve_secular(const double *d, const double *w, double rho, int n,
+        int *origin, double *tau)
+{
+    double wnorm2 = 0;
+    int i, j, iter;
+
+    for (i = 0; i < n; i++)
+        wnorm2 += w[i] * w[i];
+
+    for (j = 0; j < n; j++)
+    {
+        double lo, hi, t, f, deriv[2], size;
+
+        origin[j] = j;
+        lo = 0;
+        if (j == n - 1)
+            hi = rho * wnorm2;
+        else
+        {
+            double gap = d[j + 1] - d[j];
+
+            hi = gap / 2;
+            if (secular(d, w, rho, n, j, j, hi, deriv, &size) <= 0)
+            {
+                origin[j] = j + 1;
+                lo = -gap / 2;
+                hi = 0;
+            }
+        }
+
+        t = origin[j] == j ? hi : lo;
+        for (iter = 0; iter < MAX_SECULAR_ITERATIONS; iter++)
+        {
+            double step;
+
+            f = secular(d, w, rho, n, j, origin[j], t, deriv, &size);
+            if (fabs(f) <= 8 * DBL_EPSILON * size)
+                break;
+            if (f > 0)
+                hi = t;
+            else
+                lo = t;
+
+            step = secular_step(f, deriv, (d[j] - d[origin[j]]) - t,
+                    j == n - 1 ? 0 : (d[j + 1] - d[origin[j]]) - t);
+            if (t + step > lo && t + step < hi)
+                t += step;
+            else
+                t = (lo + hi) / 2;
+            if (t == lo || t == hi)
+                break;
+        }
+
+        tau[j] = t;
+    }
+}
+
+LsStatus update_coefficients(const Simulation *sim,
+        const LsAllocator *allocator, Result *result)
+{
+    double *norm;
+    int i, j;
+
+    assert(sim != NULL);
+    assert(result != NULL);
+
+    if ((norm = ls_calloc(allocator, result->num_modes * sizeof(double)))
+            == NULL)
+        return LS_ERR_NOMEM;
+
+    /* a_j = v_j^T M x0 / v_j^T M v_j, and the same for the velocities */
+    for (j = 0; j < result->num_modes; j++)
+    {
+        result->coefficients[j].a = 0;
+        result->coefficients[j].b = 0;
+    }
+    for (i = 0; i < sim->num_beads; i++)
+    {
+        const Bead *bead = &sim->beads[i];
+
+        for (j = 0; j < result->num_modes; j++)
+        {
+            double mv = bead->mass * result->eigenvectors[i][j];
+
+            result->coefficients[j].a += mv * bead->x0;
+            result->coefficients[j].b += mv * bead->v0;
+            norm[j] += mv * result->eigenvectors[i][j];
+        }
+    }
+
+    /* For velocity terms, we divide by the eigenfrequency since we took a
+     * derivative. A mode of zero frequency keeps its velocity. */
+    for (j = 0; j < result->num_modes; j++)
+    {
+        result->coefficients[j].a /= norm[j];
+        result->coefficients[j].b /= norm[j];
+        if (result->eigenfrequencies[j] > 0)
+            result->coefficients[j].b /= result->eigenfrequencies[j];
+    }
+
+    ls_free(allocator, norm);
+
+    return LS_OK;
+}
+
+/* Fills z with e^T V, where the columns of V are the old modes of result
+ * divided by the norms in norm, so that V^T M V = I, and e is the unit vector
+ * of the changed bead or, for a connection, the difference of the beads it
+ * joins. Also returns rho and fills w so that the squared eigenfrequencies of
+ * sim are the eigenvalues of diag(lambda) + rho w w^T. */
+static double coupling(const Simulation *sim, Change change,
+        const Result *result, const double *norm, const double *lambda,
+        double *z, double *w)
+{
+    int n = sim->num_beads;
+    int c = change.index;
+    double rho;
+    int j;
+
+    for (j = 0; j < n; j++)
+    {
+        if (change.mass)
+            z[j] = result->eigenvectors[c][j];
+        else
+            z[j] = (c > 0 ? result->eigenvectors[c - 1][j] : 0)
+                - (c < n ? result->eigenvectors[c][j] : 0);
+        z[j] /= norm[j];
+    }
+
+    if (change.mass)
+    {
+        /* With V^T M' V = I + delta z z^T, the generalized problem becomes
+         * Lambda^1/2 (I + delta z z^T)^-1 Lambda^1/2, a rank-one change of
+         * Lambda by Sherman-Morrison */
+        double delta = sim->beads[c].mass - change.old_value;
+        double zz = 0;
+
+        for (j = 0; j < n; j++)
+            zz += z[j] * z[j];
+        rho = -delta / (1 + delta * zz);
+        for (j = 0; j < n; j++)
+            w[j] = sqrt(lambda[j]) * z[j];
+    }
+    else
+    {
+        rho = spring_constant(sim, sim->connections[c])
+            - spring_constant(sim, change.old_value);
+        for (j = 0; j < n; j++)
+            w[j] = z[j];
+    }
+
+    return rho;
+}
+
+/* Finds the new eigenvalues of result, the solution of sim before change, and
+ * stores them in eval in ascending order, using block for 8 n doubles and
+ * 2 n ints. Modes barely coupled to the change keep their eigenvalue, and
+ * those whose old eigenvector is still one to within rounding keep that too:
+ * source[j] is the old mode whose eigenvector is new mode j, or -1 if it must
+ * be found again. Returns LS_ERR_SOLVER if two coupled modes share an
+ * eigenvalue. */
+static LsStatus find_eigenvalues(const Simulation *sim, Change change,
+        const Result *result, double *block, double *eval, int *source)
+{
+    int n = sim->num_beads;
+    int c = change.index;
+    double *norm = block, *lambda = norm + n, *z = lambda + n, *w = z + n;
+    double *d = w + n, *wr = d + n, *tau = wr + n;
+    int *keep = (int *)(tau + n), *origin = keep + n;
+    double rho, scale, sign, reach;
+    int num_kept, i, j, k, p;
+
+    /* The M-norms of the old modes, read a row at a time */
+    for (j = 0; j < n; j++)
+    {
+        norm[j] = 0;
+        lambda[j] = result->eigenfrequencies[j] * result->eigenfrequencies[j];
+    }
+    for (i = 0; i < n; i++)
+    {
+        double m = old_mass(sim, change, i);
+        const double *row = result->eigenvectors[i];
+
+        for (j = 0; j < n; j++)
+            norm[j] += m * row[j] * row[j];
+    }
+    for (j = 0; j < n; j++)
+        norm[j] = sqrt(norm[j]);
+
+    rho = coupling(sim, change, result, norm, lambda, z, w);
+
+    /* Old mode j leaves a residual of reach |z_j| in the new dynamical
+     * matrix, times lambda_j for a new mass */
+    if (change.mass)
+        reach = fabs(sim->beads[c].mass - change.old_value)
+            / sqrt(sim->beads[c].mass);
+    else
+        reach = fabs(rho) * sqrt((c > 0 ? 1 / sim->beads[c - 1].mass : 0)
+                + (c < n ? 1 / sim->beads[c].mass : 0));
+
+    /* Modes barely coupled to the change keep their eigenvalue; the others
+     * must have distinct eigenvalues for the secular equation */
+    scale = lambda[n - 1];
+    for (j = 0; j < n; j++)
+        if (fabs(rho) * w[j] * w[j] > scale)
+            scale = fabs(rho) * w[j] * w[j];
+    num_kept = 0;
+    for (j = 0; j < n; j++)
+    {
+        if (fabs(rho) * w[j] * w[j] <= DEFLATE_TOL * scale)
+            continue;
+        if (num_kept > 0
+                && lambda[j] - lambda[keep[num_kept - 1]]
+                <= DEFLATE_TOL * scale)
+            return LS_ERR_SOLVER;
+        keep[num_kept++] = j;
+    }
+
+    /* The roots move up for rho > 0; otherwise solve the mirror problem
+     * -diag(lambda) - rho w w^T, which reverses the order */
+    sign = rho > 0 ? 1 : -1;
+    for (k = 0; k < num_kept; k++)
+    {
+        int src = keep[rho > 0 ? k : num_kept - 1 - k];
+
+        d[k] = sign * lambda[src];
+        wr[k] = w[src];
+    }
+    solve_secular(d, wr, sign * rho, num_kept, origin, tau);
+    for (k = 0; k < num_kept; k++)
+        tau[k] = sign * (d[origin[k]] + tau[k]);
+
+    /* Merge the roots, ascending either way, with the unchanged eigenvalues,
+     * which lie between them. i walks the uncoupled modes, skipping the
+     * kept ones, which p walks. */
+    i = 0;
+    p = 0;
+    k = 0;
+    for (j = 0; j < n; j++)
+    {
+        int root = rho > 0 ? k : num_kept - 1 - k;
+
+        while (i < n && p < num_kept && keep[p] == i)
+        {
+            i++;
+            p++;
+        }
+        if (k == num_kept || (i < n && lambda[i] <= tau[root]))
+        {
+            double residual = reach * fabs(z[i])
+                * (change.mass ? lambda[i] : 1);
+
+            eval[j] = lambda[i];
+            source[j] = residual <= DEFLATE_TOL * scale ? i : -1;
+            i++;
+        }
+        else
+        {
+            eval[j] = tau[root];
+            source[j] = -1;
+            k++;
+        }
+    }
+
+    /* Clamp rounding errors of 0 as asolve does */
+    scale = fmax(fabs(eval[0]), fabs(eval[n - 1]));
+    for (j = 0; j < n; j++)
+        if (eval[j] < ZERO_EIGENVALUE_TOL * scale)
+            eval[j] = 0;
+
+    return LS_OK;
+}
+/* Makes slot j % size of window hold mode j of result, a column of its
+ * eigenvectors, as a unit eigenvector of the dynamical matrix of sim, unless
+ * owner says it already does */
+static void fill_slot(const Simulation *sim, const Result *result, int j,
+        int size, double *window, int *owner)
+{
+    int n = sim->num_beads;
+    double *v = window + (size_t)(j % size) * n;
+    double norm = 0;
+    int i;
+
+    if (owner[j % size] == j)
+        return;
+
+    for (i = 0; i < n; i++)
+    {
+        v[i] = result->eigenvectors[i][j] * sqrt(sim->beads[i].mass);
+        norm += v[i] * v[i];
+    }
+    norm = sqrt(norm);
+    for (i = 0; i < n; i++)
+        v[i] /= norm;
+    owner[j % size] = j;
+}
+
+LsStatus update_modes(const Simulation *sim, Change change,
+        const LsAllocator *allocator, Result *result)
+{
+    int n;
+    double *block, *eval, *diag, *offdiag, *work, *window, *carry;
+    const double **cluster;
+    int *source, *owner;
+    bool sine_modes;
+    LsStatus status;
+    double scale;
+    int size, i, j, c;
+
+    assert(sim != NULL);
+    assert(sim->sim_type != MEMBRANE);
+    assert(result != NULL);
+    assert(result->num_modes == sim->num_beads);
+
+    n = sim->num_beads;
+    block = ls_alloc(allocator, 11 * (size_t)n * sizeof(double)
+            + 3 * n * sizeof(int));
+    if (block == NULL)
+        return LS_ERR_NOMEM;
+    eval = block;
+    carry = eval + n;
+    source = (int *)(carry + 10 * n);
+    if ((status = find_eigenvalues(sim, change, result, carry, eval, source))
+            != LS_OK)
+    {
+        ls_free(allocator, block);
+        return status;
+    }
+
+    /* Multiplying the old modes by the eigenvectors of the secular equation
+     * would cost O(N^3). The new chain is still tridiagonal, though, so each
+     * new mode that can't keep its old vector is found from its eigenvalue
+     * by inverse iteration in O(N), as tdsolve does, with the same checks.
+     * Only the vectors of the cluster being found are kept, as unit vectors
+     * of the dynamical matrix, in a window of size slots used in turn. */
+    scale = fmax(fabs(eval[0]), fabs(eval[n - 1]));
+    size = 2;
+    for (j = 0; j < n; j++)
+    {
+        c = cluster_size(eval, j - 1, j, eval[j], scale);
+        if (c + 2 > size)
+            size = c + 2;
+    }
+    if (size > n)
+        size = n;
+    window = ls_alloc(allocator, (size_t)size * n * sizeof(double)
+            + size * sizeof(double *) + size * sizeof(int));
+    if (window == NULL)
+    {
+        ls_free(allocator, block);
+        return LS_ERR_NOMEM;
+    }
+    cluster = (const double **)(window + (size_t)size * n);
+    owner = (int *)(cluster + size);
+    for (i = 0; i < size; i++)
+        owner[i] = -1;
+
+    diag = carry + 2 * n;
+    offdiag = diag + n;
+    work = offdiag + n;
+    chain_tridiagonal(sim, diag, offdiag);
+    sine_modes = result->sine_modes;
+    result->sine_modes = false;
+    for (j = 0; j < n; j++)
+    {
+        double *v = window + (size_t)(j % size) * n;
+        double norm = 0, overlap = 0;
+
+        /* A rank-one change moves each eigenvalue past at most one other,
+         * so a kept vector comes from mode j - 1, j or j + 1. Old mode j - 1
+         * is overwritten by now, and was saved in its half of carry. */
+        assert(source[j] < 0 || abs(source[j] - j) <= 1);
+        if (j + 1 < n && source[j + 1] == j)
+            for (i = 0; i < n; i++)
+                carry[(size_t)(j % 2) * n + i] = result->eigenvectors[i][j];
+        result->eigenfrequencies[j] = sqrt(eval[j]);
+
+        if (source[j] >= 0)
+        {
+            const double *old = carry + (size_t)((j + 1) % 2) * n;
+
+            if (source[j] != j)
+                for (i = 0; i < n; i++)
+                    result->eigenvectors[i][j] = source[j] < j ? old[i]
+                        : result->eigenvectors[i][j + 1];
+            if (sine_modes)
+                fix_sign(result, j);
+            continue;
+        }
+
+        c = cluster_size(eval, j - 1, j, eval[j], scale);
+        for (i = 0; i < c; i++)
+        {
+            fill_slot(sim, result, j - c + i, size, window, owner);
+            cluster[i] = window + (size_t)((j - c + i) % size) * n;
+        }
+        owner[j % size] = j;
+        if (tridiag_eigenvector(diag, offdiag, n, eval[j], scale, cluster, c,
+                    j, work, v))
+            break;
+        if (j > 0)
+        {
+            const double *prev = window + (size_t)((j - 1) % size) * n;
+
+            fill_slot(sim, result, j - 1, size, window, owner);
+            for (i = 0; i < n; i++)
+                overlap += prev[i] * v[i];
+        }
+        if (fabs(overlap) > ORTHO_TOL)
+            break;
+
+        /* Scale by M^-1/2, then normalize and sign like asolve does */
+        for (i = 0; i < n; i++)
+        {
+            work[i] = v[i] / sqrt(sim->beads[i].mass);
+            norm += work[i] * work[i];
+        }
+        norm = sqrt(norm) * largest_sign(work, n, 1);
+        for (i = 0; i < n; i++)
+            result->eigenvectors[i][j] = work[i] / norm;
+    }
+
+    ls_free(allocator, window);
+    ls_free(allocator, block);
+    if (j < n)
+        return LS_ERR_SOLVER;
+
+    return update_coefficients(sim, allocator, result);
+}
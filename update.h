@@ -0,0 +1,47 @@
+/*----------------------------------------------------------------------------*/
+/* update.h                                                                   */
+/* Author: Godwin Duan                                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef UPDATE_INCLUDED
+#define UPDATE_INCLUDED
+
+#include <stdbool.h>
+#include "types.h"
+#include "loadedstring.h"
+
+/* Internal to libloadedstring. */
+
+/* A change to one mass or one connection of a string or spring system */
+typedef struct change
+{
+    bool mass; /* True if the mass of bead index changed, false if connection
+                  index changed */
+    int index; /* Zero indexed bead or connection */
+    double old_value; /* The mass or connection before the change */
+} Change;
+
+/* Updates result, the solution of sim before change was made to it, to the
+ * solution of sim, a chain. In the basis of the old modes the change is a
+ * rank-one change of the diagonal matrix of squared eigenfrequencies, whose
+ * eigenvalues are the roots of a secular equation, each found in a few O(N)
+ * steps. Modes the change barely reaches keep their eigenvalue and, if it is
+ * still one to within rounding, their eigenvector; in a long disordered chain
+ * most modes are localized away from the change and are kept. Every other
+ * eigenvector is found from its eigenvalue by inverse iteration on the
+ * tridiagonal dynamical matrix of sim in O(N) and written straight into
+ * result; only the vectors of the cluster of close eigenvalues being found
+ * are kept aside. The update is O(N^2) and coefficients are recomputed.
+ * Returns LS_ERR_SOLVER if two coupled modes share an eigenvalue or a new
+ * eigenvector fails the residual or orthogonality checks of tdsolve, in which
+ * case result is left inconsistent and must be solved again from scratch. */
+LsStatus update_modes(const Simulation *sim, Change change,
+        const LsAllocator *allocator, Result *result);
+
+/* Recomputes the coefficients of result, which holds the modes of sim, from
+ * the initial conditions of sim. The modes are orthogonal with respect to the
+ * mass matrix, so this costs O(N^2) rather than an LU decomposition. */
+LsStatus update_coefficients(const Simulation *sim,
+        const LsAllocator *allocator, Result *result);
+
+#endif